@@ -1564,6 +1564,16 @@ class TinyGLTF {
 
   size_t GetMaxExternalFileSize() const { return max_external_file_size_; }
 
+  ///
+  /// Leave the GLB BIN chunk in the memory passed to `LoadBinaryFromMemory`
+  /// instead of copying it into `Buffer::data` (default = false).
+  /// When enabled, the embedded buffer's `data` stays empty and the caller
+  /// must keep the GLB bytes alive and resolve accessors against them.
+  ///
+  void SetBinaryChunkAsView(bool onoff) { binary_chunk_as_view_ = onoff; }
+
+  bool GetBinaryChunkAsView() const { return binary_chunk_as_view_; }
+
  private:
   ///
   /// Loads glTF asset from string(memory).
@@ -1590,6 +1600,8 @@ class TinyGLTF {
 
   bool images_as_is_ = false; /// Default false (decode/decompress images)
 
+  bool binary_chunk_as_view_ = false;  /// Default false (copy BIN chunk)
+
   size_t max_external_file_size_{
       size_t((std::numeric_limits<int32_t>::max)())};  // Default 2GB
 
@@ -4528,7 +4540,7 @@ static bool ParseBuffer(Buffer *buffer, std::string *err, const detail::json &o,
                         const std::string &basedir,
                         const size_t max_buffer_size, bool is_binary = false,
                         const unsigned char *bin_data = nullptr,
-                        size_t bin_size = 0) {
+                        size_t bin_size = 0, bool bin_as_view = false) {
   size_t byteLength;
   if (!ParseUnsignedProperty(&byteLength, err, o, "byteLength", true,
                              "Buffer")) {
@@ -4605,9 +4617,12 @@ static bool ParseBuffer(Buffer *buffer, std::string *err, const detail::json &o,
         return false;
       }
 
-      // Read buffer data
-      buffer->data.resize(static_cast<size_t>(byteLength));
-      memcpy(&(buffer->data.at(0)), bin_data, static_cast<size_t>(byteLength));
+      // Read buffer data, unless the caller keeps the BIN chunk alive itself.
+      if (!bin_as_view) {
+        buffer->data.resize(static_cast<size_t>(byteLength));
+        memcpy(&(buffer->data.at(0)), bin_data,
+               static_cast<size_t>(byteLength));
+      }
     }
 
   } else {
@@ -6157,7 +6172,7 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, std::string *warn,
       if (!ParseBuffer(&buffer, err, o,
                        store_original_json_for_extras_and_extensions_, &fs,
                        &uri_cb, base_dir, max_external_file_size_, is_binary_,
-                       bin_data_, bin_size_)) {
+                       bin_data_, bin_size_, binary_chunk_as_view_)) {
         return false;
       }
 
@@ -6452,9 +6467,14 @@ bool TinyGLTF::LoadFromString(Model *model, std::string *err, std::string *warn,
           }
           return false;
         }
+        const unsigned char *bufferData = buffer.data.data();
+        if (buffer.data.empty() && buffer.uri.empty() && is_binary_) {
+          // BIN chunk left in place (see SetBinaryChunkAsView).
+          bufferData = bin_data_;
+        }
         bool ret = LoadImageData(
             &image, idx, err, warn, image.width, image.height,
-            &buffer.data[bufferView.byteOffset],
+            bufferData + bufferView.byteOffset,
             static_cast<int>(bufferView.byteLength), load_image_user_data);
         if (!ret) {
           return false;
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include "LoadModel.h"
+
+// Typed, stride-aware view of a glTF accessor inside its (possibly mapped)
+// buffer. Covers every glTF component type and normalized integer formats.
+struct AccessorView {
+    const unsigned char *data = nullptr; // first element
+    size_t count = 0;
+    size_t stride = 0;                   // bytes between elements
+    int componentType = 0;               // TINYGLTF_COMPONENT_TYPE_*
+    int components = 0;                  // 1 for SCALAR .. 4 for VEC4
+    bool normalized = false;
+    // Sparse accessors: elements replaced on top of the ones above. Both
+    // arrays are tightly packed; values have the view's type.
+    size_t sparseCount = 0;
+    const unsigned char *sparseIndices = nullptr;
+    int sparseIndexType = 0;
+    const unsigned char *sparseValues = nullptr;
+};
+
+// Fails for out-of-range accessors, unresolved buffers and elements (dense
+// or sparse) that run past their bufferView or buffer. An accessor
+// without a bufferView yields a view with data == nullptr, which the readers
+// below treat as all zeros; sparse substitutions are applied on top.
+bool MakeAccessorView(const GLTFAsset &asset, int accessorIndex, AccessorView &view);
+
+// Converts every element to float, writing the first outComponents values to
+// out + i * outStride bytes. Missing components are zero-filled; normalized
+// integers are mapped to [0, 1] / [-1, 1] as the glTF spec requires.
+void ReadAccessorFloats(const AccessorView &view, void *out, size_t outStride, int outComponents);
+
+// Widens scalar unsigned byte/short/int indices into a tightly packed array.
+void ReadAccessorIndices(const AccessorView &view, unsigned int *out);
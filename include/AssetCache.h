@@ -0,0 +1,37 @@
+#ifndef ASSETCACHE_H
+#define ASSETCACHE_H
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "AsyncLoader.h"
+
+// Hands out shared, ref-counted models so every instance of the same file
+// uses one set of meshes, materials and animations. Entries are keyed by
+// path and modification time: a model that changed on disk is loaded again,
+// and entries whose last handle has gone away are dropped. A request for more
+// retained CPU geometry than the live entry has loads the model again.
+class AssetCache {
+public:
+    explicit AssetCache(AsyncLoader &loader) : loader(loader) {}
+
+    ModelHandle get(const std::string &path, GLTFLoadMode mode = GLTFLoadMode::Copy,
+                    GeometryRetention retention = GeometryRetention::Discard);
+
+    // Forgets entries no instance refers to any more.
+    void prune();
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        std::time_t lastWriteTime;
+        GeometryRetention retention;
+        std::weak_ptr<ModelLoad> load;
+    };
+
+    AsyncLoader &loader;
+    std::unordered_map<std::string, Entry> entries;
+};
+
+#endif // ASSETCACHE_H
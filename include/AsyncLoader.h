@@ -0,0 +1,121 @@
+#ifndef ASYNCLOADER_H
+#define ASYNCLOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ModelData.h"
+
+// GPU-side result of a finished load. Shared by every instance of the model;
+// the GL objects are released when the last handle goes away.
+struct LoadedModel {
+    LoadedModel() = default;
+    ~LoadedModel();
+    LoadedModel(const LoadedModel &) = delete;
+    LoadedModel &operator=(const LoadedModel &) = delete;
+
+    std::vector<Mesh> meshes;
+    std::vector<AnimationData> animations;
+    std::vector<Material> materials;
+    std::vector<Light> lights;
+    // Object-space union of the mesh bounds, set once every mesh is uploaded.
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+};
+
+enum class LoadState {
+    Queued,    // waiting for a worker
+    Decoding,  // file I/O, JSON parsing and accessor decoding on a worker
+    Uploading, // waiting in (or partway through) the render-thread upload queue
+    Ready,
+    Failed
+};
+
+// Shared by the handle, the decoding worker and the upload queue.
+struct ModelLoad {
+    std::string path;
+    GLTFLoadMode mode = GLTFLoadMode::Copy;
+    GeometryRetention retention = GeometryRetention::Discard;
+    std::atomic<LoadState> state{LoadState::Queued};
+    ModelData data;       // filled by the worker, drained by the upload queue
+    size_t nextMesh = 0;  // render thread only
+    LoadedModel model;    // complete once state is Ready
+};
+
+class ModelHandle {
+public:
+    ModelHandle() = default;
+    explicit ModelHandle(std::shared_ptr<ModelLoad> load) : load(std::move(load)) {}
+
+    bool valid() const { return load != nullptr; }
+    LoadState state() const { return load ? load->state.load() : LoadState::Failed; }
+    bool ready() const { return state() == LoadState::Ready; }
+    bool failed() const { return state() == LoadState::Failed; }
+    const std::string &path() const { return load->path; }
+    std::weak_ptr<ModelLoad> weak() const { return load; }
+
+    // Only meaningful once ready().
+    LoadedModel &model() const { return load->model; }
+
+private:
+    std::shared_ptr<ModelLoad> load;
+};
+
+// Loads models in the background. load() returns immediately; workers do the
+// file I/O, glTF parsing and accessor decoding, and processUploads() creates
+// the GL objects on the render thread within a per-call time budget.
+class AsyncLoader {
+public:
+    explicit AsyncLoader(unsigned workerCount = 0); // 0 = one less than the hardware threads
+    ~AsyncLoader();
+
+    AsyncLoader(const AsyncLoader &) = delete;
+    AsyncLoader &operator=(const AsyncLoader &) = delete;
+
+    ModelHandle load(const std::string &path, GLTFLoadMode mode = GLTFLoadMode::Copy,
+                     GeometryRetention retention = GeometryRetention::Discard);
+
+    // Render thread only. Uploads decoded meshes until budgetSeconds has been
+    // spent (at least one mesh per call if any is waiting) and returns how
+    // many meshes were uploaded.
+    size_t processUploads(double budgetSeconds);
+
+    bool idle();
+
+    // Render thread, while the context and the geometry pool are still
+    // alive. Stops and joins the workers, fails the queued loads and frees
+    // the meshes of partly uploaded ones. Nothing can be loaded afterwards.
+    void shutdown();
+
+    // Meshes uploaded afterwards are suballocated from the pool when their
+    // layout allows. The pool must outlive every model loaded through it.
+    void setGeometryPool(GeometryPool *pool) { geometryPool = pool; }
+    // Prints one line per finished model (cache use, LODs, optimization and
+    // pooling) from processUploads().
+    void setImportReports(bool enabled) { importReports = enabled; }
+
+private:
+    void workerLoop();
+    void stopWorkers();
+    void printReport(const ModelLoad &load) const;
+
+    std::vector<std::thread> workers;
+    GeometryPool *geometryPool = nullptr;
+    bool importReports = false;
+
+    std::mutex jobMutex;
+    std::condition_variable jobAvailable;
+    std::deque<std::shared_ptr<ModelLoad>> jobs;
+    bool stopping = false;
+    size_t activeJobs = 0;
+
+    std::mutex uploadMutex;
+    std::deque<std::shared_ptr<ModelLoad>> uploads;
+};
+
+#endif // ASYNCLOADER_H
@@ -0,0 +1,122 @@
+#ifndef COMMANDLIST_H
+#define COMMANDLIST_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "AsyncLoader.h"
+#include "FrustumCuller.h"
+#include "RenderGLTF.h"
+
+// Per-instance vertex attributes, written into the render queue's stream
+// buffer every frame.
+struct InstanceData {
+    glm::mat4 model;
+    glm::vec4 color; // multiplies the material base color
+};
+
+// A model, mesh and LOD; also fixes the material.
+struct InstanceBatchKey {
+    const LoadedModel *model;
+    size_t mesh;
+    size_t lod;
+    bool operator==(const InstanceBatchKey &other) const { return model == other.model && mesh == other.mesh && lod == other.lod; }
+};
+
+struct InstanceBatchKeyHash {
+    size_t operator()(const InstanceBatchKey &key) const {
+        return std::hash<const void *>()(key.model) ^ (key.mesh * 0x9E3779B97F4A7C15ull) ^ (key.lod << 48);
+    }
+};
+
+// True when both batches hold one identical instance of the same model: the
+// meshes of an object drawn on its own. Such batches share one copy of the
+// instance, so their draws differ only in the range and can be merged into
+// one multi-draw.
+bool SharesInstance(const InstanceBatchKey &a, const std::vector<InstanceData> &aInstances, const InstanceBatchKey &b,
+                    const std::vector<InstanceData> &bInstances);
+
+// Draw commands recorded without touching GL, so any thread can fill one.
+// Instances are grouped by batch key as they are recorded; the GL thread
+// replays lists through InstanceRenderer::flush.
+class CommandList {
+public:
+    struct Batch {
+        InstanceBatchKey key;
+        std::vector<InstanceData> instances;
+        float nearestDepth;
+    };
+
+    void reset();
+    // Queues one instance of every mesh of model. With a frustum, meshes of
+    // multi-mesh models are also culled one by one; the caller is expected to
+    // have culled the model as a whole already.
+    void drawModel(const LoadedModel &model, const glm::mat4 &modelMatrix, const glm::vec4 &color, const LodSelector &lods,
+                   const Frustum *frustum = nullptr);
+
+    size_t batchCount() const { return activeBatches; }
+    const Batch &batch(size_t index) const { return batches[index]; }
+
+private:
+    std::vector<Batch> batches; // reused across frames; only the first activeBatches are live
+    size_t activeBatches = 0;
+    std::unordered_map<InstanceBatchKey, size_t, InstanceBatchKeyHash> batchIndex;
+};
+
+// Records command lists on persistent worker threads, one list per chunk of
+// items; the calling thread takes chunks too. Lists come back in chunk
+// order, so replaying them gives the same draws as recording serially.
+class CommandRecorder {
+public:
+    using RecordFunction = std::function<void(CommandList &list, size_t begin, size_t end)>;
+    using ChunkFunction = std::function<void(size_t begin, size_t end)>;
+
+    // workerCount 0 uses every hardware thread but the caller's.
+    explicit CommandRecorder(unsigned workerCount = 0);
+    ~CommandRecorder();
+
+    CommandRecorder(const CommandRecorder &) = delete;
+    CommandRecorder &operator=(const CommandRecorder &) = delete;
+
+    // Resets the lists and records items [0, count) into them, at least
+    // minChunk items per list. Returns once every chunk is recorded.
+    void record(size_t count, size_t minChunk, const RecordFunction &recordChunk);
+    // The same split for work that records nothing.
+    void parallelFor(size_t count, size_t minChunk, const ChunkFunction &function);
+
+    const CommandList *lists() const { return commandLists.data(); }
+    size_t listCount() const { return activeLists; }
+
+private:
+    using Job = std::function<void(size_t chunk, size_t begin, size_t end)>;
+
+    size_t chunkCount(size_t count, size_t minChunk) const;
+    void run(size_t count, size_t chunks, const Job &function);
+    void runChunks();
+    void workerLoop();
+
+    std::vector<CommandList> commandLists;
+    size_t activeLists = 0;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable startWork;
+    std::condition_variable workDone;
+    unsigned generation = 0;
+    unsigned pending = 0;
+    bool stopping = false;
+
+    // The job being run; written before generation changes.
+    const Job *job = nullptr;
+    size_t jobCount = 0;
+    size_t jobChunks = 0;
+    std::atomic<size_t> nextChunk{0};
+};
+
+#endif // COMMANDLIST_H
@@ -0,0 +1,81 @@
+#ifndef DEFERREDRENDERER_H
+#define DEFERREDRENDERER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "FrustumCuller.h"
+#include "ModelData.h"
+#include "Shader.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+
+struct DeferredStats {
+    size_t lightVolumes = 0; // ranged lights drawn this frame
+    size_t culledVolumes = 0; // outside the frustum
+};
+
+// Deferred shading. Opaque geometry writes albedo and metallic (RGBA8),
+// world normal and roughness (RGBA16F) and depth into a G-buffer; lighting
+// then runs once per covered pixel instead of once per shaded fragment. The
+// unbounded lights take one full-screen pass; every ranged light is an
+// instanced sphere drawn with its back faces against the scene depth, so it
+// only shades the pixels inside its range. Results accumulate in an RGBA16F
+// light buffer whose depth is a copy of the G-buffer's, so transparent
+// draws can be shaded forward on top before the copy to the window.
+class DeferredRenderer {
+public:
+    // shaderDirectory holds the .glsl files, with a trailing slash.
+    explicit DeferredRenderer(const std::string &shaderDirectory);
+    ~DeferredRenderer();
+
+    DeferredRenderer(const DeferredRenderer &) = delete;
+    DeferredRenderer &operator=(const DeferredRenderer &) = delete;
+
+    // Recreates the targets when the size changes; false if the driver
+    // rejects them, in which case the forward path should be used.
+    bool resize(int width, int height);
+    // Binds and clears the G-buffer; draw the opaque pass with
+    // geometryShader() next.
+    void beginGeometry();
+    // Shades the G-buffer into the light buffer and leaves it bound, with
+    // depth testing, for forward-shaded transparent draws. Ranged lights
+    // outside the frustum are skipped; the others are written into stream,
+    // which must be inside its frame.
+    void light(StreamBuffer &stream, const std::vector<Light> &unbounded, const std::vector<Light> &ranged, const Frustum &frustum, const glm::vec3 &background);
+    // Copies the light buffer to the default framebuffer and binds it.
+    void present();
+    void reloadShadersIfModified();
+    // GL thread, while the context is still current.
+    void release();
+
+    Shader &geometryShader() { return gbufferShader; }
+    const DeferredStats &stats() const { return frameStats; }
+
+private:
+    void createVolumeMesh();
+    void releaseTargets();
+    void drawLightVolumes(StreamBuffer &stream, const std::vector<Light> &ranged, const Frustum &frustum);
+
+    Shader gbufferShader;
+    Shader lightsShader;
+    Shader volumeShader;
+    UniformHandle<glm::vec3> backgroundUniform;
+
+    int width = 0, height = 0;
+    GLuint gbuffer = 0;     // albedo, normal, depth textures
+    GLuint lightBuffer = 0; // light texture, depth renderbuffer
+    GLuint albedoTexture = 0, normalTexture = 0, depthTexture = 0, lightTexture = 0;
+    GLuint lightDepth = 0;
+
+    GLuint emptyVao = 0; // the full-screen triangle has no attributes
+    GLuint volumeVao = 0, volumeVertices = 0, volumeIndices = 0;
+    GLsizei volumeIndexCount = 0;
+    std::vector<glm::vec4> volumeData; // position and range, color and intensity
+    UniformBlock lightBlock;
+    DeferredStats frameStats;
+};
+
+#endif // DEFERREDRENDERER_H
@@ -0,0 +1,52 @@
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// The six planes of a projection * view matrix (Gribb/Hartmann), normalized
+// and facing inward: a point p is inside when dot(plane.xyz, p) + plane.w >= 0.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum FromMatrix(const glm::mat4 &viewProjection);
+
+    // Scalar test of one world-space box. Conservative: boxes that straddle
+    // two planes outside a frustum corner are kept.
+    bool intersects(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const;
+};
+
+// World-space AABB enclosing an object-space box under modelMatrix.
+void TransformBounds(const glm::mat4 &modelMatrix, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+                     glm::vec3 &worldMin, glm::vec3 &worldMax);
+
+struct CullStats {
+    size_t tested = 0;
+    size_t visible = 0;
+};
+
+// Holds a frame's world-space boxes as center/extent arrays (structure of
+// arrays) and tests four of them per iteration against a frustum with SSE2,
+// falling back to scalar code elsewhere. Each box carries a caller id, and
+// cull() appends the ids of the visible boxes in the order they were added.
+class FrustumCuller {
+public:
+    void clear();
+    void add(const glm::vec3 &worldMin, const glm::vec3 &worldMax, uint32_t id);
+    void cull(const Frustum &frustum, std::vector<uint32_t> &visible);
+
+    size_t size() const { return count; }
+    const CullStats &stats() const { return lastStats; }
+
+private:
+    // Padded with empty boxes to a multiple of four while cull() runs.
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<uint32_t> ids;
+    size_t count = 0;
+    CullStats lastStats;
+};
+
+#endif // FRUSTUMCULLER_H
@@ -0,0 +1,108 @@
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <glad/glad.h>
+
+struct GLStateCounter {
+    size_t issued = 0;
+    size_t skipped = 0;
+};
+
+struct GLStateStats {
+    GLStateCounter programs;
+    GLStateCounter vertexArrays;
+    GLStateCounter buffers;
+    GLStateCounter textures;
+    GLStateCounter fixedFunction; // enable/disable, blend and depth state
+    GLStateCounter uniforms;
+
+    size_t issued() const;
+    size_t skipped() const;
+};
+
+// Shadow copy of the GL state this renderer touches. Every setter compares
+// against the shadow and only reaches the driver when the value changes.
+// All binds and deletes of programs, VAOs, buffers and textures must go
+// through it (or be followed by invalidate()) for the shadow to stay right.
+// GL thread only; there is one context, so there is one cache.
+class GLStateCache {
+public:
+    static GLStateCache &get();
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    // GL_ELEMENT_ARRAY_BUFFER belongs to the bound VAO and is always issued.
+    void bindBuffer(GLenum target, GLuint buffer);
+    // Indexed uniform buffer bindings are cached per binding point; like GL,
+    // this also changes the plain GL_UNIFORM_BUFFER binding.
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    void setCapability(GLenum capability, bool enabled);
+    void blendFunc(GLenum source, GLenum destination);
+    void depthFunc(GLenum function);
+    void depthMask(GLboolean enabled);
+    void cullFace(GLenum face);
+
+    // Uniform values are remembered per program and location. The program is
+    // made current first if it isn't already.
+    void uniform1i(GLuint program, GLint location, int value);
+    void uniform1f(GLuint program, GLint location, float value);
+    void uniform3fv(GLuint program, GLint location, const float *value);
+    void uniform4fv(GLuint program, GLint location, const float *value);
+    void uniformMatrix4fv(GLuint program, GLint location, const float *value);
+
+    // Deleting unbinds the object, and GL may hand its name out again.
+    void deleteProgram(GLuint program);
+    void deleteVertexArrays(GLsizei count, const GLuint *vaos);
+    void deleteBuffers(GLsizei count, const GLuint *buffers);
+    void deleteTextures(GLsizei count, const GLuint *textures);
+
+    // Forget everything, e.g. after code outside the cache changed state.
+    void invalidate();
+
+    const GLStateStats &stats() const { return counters; }
+    void resetStats() { counters = GLStateStats(); }
+
+private:
+    GLStateCache() { invalidate(); }
+
+    static const GLuint Unknown = 0xFFFFFFFFu;
+    static const GLuint TextureUnits = 32;
+    static const GLuint BufferTargets = 8;
+    static const GLuint UniformBindings = 16;
+
+    struct BufferRange {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    struct UniformValue {
+        float data[16];
+        uint8_t count;
+    };
+
+    bool uniformChanged(GLuint program, GLint location, const float *value, uint8_t count);
+    int bufferSlot(GLenum target) const;
+
+    GLuint program = Unknown;
+    GLuint vertexArray = Unknown;
+    GLuint buffers[BufferTargets];
+    BufferRange uniformRanges[UniformBindings];
+    GLuint activeUnit = Unknown;
+    GLuint textures[TextureUnits];
+    GLenum textureTargets[TextureUnits];
+    std::unordered_map<GLenum, bool> capabilities;
+    GLenum blendSource = Unknown, blendDestination = Unknown;
+    GLenum depthFunction = Unknown;
+    int depthWrite = -1;
+    GLenum culledFace = Unknown;
+    std::unordered_map<uint64_t, UniformValue> uniforms;
+    GLStateStats counters;
+};
+
+#endif // GLSTATECACHE_H
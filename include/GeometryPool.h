@@ -0,0 +1,96 @@
+#ifndef GEOMETRYPOOL_H
+#define GEOMETRYPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glad/glad.h>
+#include "OffsetAllocator.h"
+#include "RenderGLTF.h"
+
+class GeometryPool;
+struct GeometryArena;
+
+// Where a pooled mesh lives. Owned by the pool at a stable address; the
+// offsets change when an arena grows or is defragmented.
+struct GeometrySlot {
+    GeometryPool *pool = nullptr;
+    GeometryArena *arena = nullptr;
+    OffsetAllocator::Allocation vertices; // in vertices of the arena's stride
+    OffsetAllocator::Allocation indices;  // in indices of the arena's index type
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    size_t slotIndex = 0;
+};
+
+// One shared VAO with one VBO and one EBO, holding every mesh that has the
+// same interleaved vertex format and index type. Meshes are drawn with
+// glDraw*BaseVertex, so their indices stay local to the mesh.
+struct GeometryArena {
+    std::vector<VertexAttribute> attributes; // offsets relative to a vertex
+    GLsizei stride = 0;
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    OffsetAllocator vertexSpace;
+    OffsetAllocator indexSpace;
+    std::vector<std::unique_ptr<GeometrySlot>> slots;
+};
+
+// Suballocates mesh geometry out of a few large buffers instead of one
+// VAO/VBO/EBO per mesh. Arenas grow by doubling (copying on the GPU) and can
+// be compacted with defragment(). GL thread only.
+class GeometryPool {
+public:
+    GeometryPool() = default;
+    ~GeometryPool();
+
+    GeometryPool(const GeometryPool &) = delete;
+    GeometryPool &operator=(const GeometryPool &) = delete;
+
+    // Uploads the mesh data into a matching arena. Returns null when the
+    // vertex layout is not interleaved; the caller keeps its own buffers then.
+    // 8-bit indices are widened to 16 bits, which pooled draws use instead.
+    GeometrySlot *upload(const MeshData &data);
+    void free(GeometrySlot *slot);
+
+    // Compacts arenas whose free space is split up by more than the given
+    // fraction of their capacity. Returns the number of arenas compacted.
+    size_t defragment(float fragmentationThreshold = 0.25f);
+
+    void release();
+
+    size_t arenaCount() const { return arenas.size(); }
+
+private:
+    GeometryArena *findArena(const MeshData &data, GLenum indexType);
+    bool reserve(GeometryArena &arena, uint32_t vertexCount, uint32_t indexCount);
+    void bindArenaLayout(GeometryArena &arena);
+    void compact(GeometryArena &arena);
+
+    std::vector<std::unique_ptr<GeometryArena>> arenas;
+};
+
+// Collects draws that share a VAO, uniforms and instance attributes (the
+// meshes of one object) and issues one glMultiDrawElementsBaseVertex per
+// arena. A non-pooled mesh has a VAO of its own and gets a run to itself.
+class MultiDrawList {
+public:
+    void add(const Mesh &mesh, size_t lod);
+    void add(const DrawRange &range);
+    // Returns the number of GL draw calls issued.
+    size_t submit();
+    void clear();
+
+private:
+    struct Run {
+        GLuint VAO;
+        GLenum indexType;
+        std::vector<GLsizei> counts;
+        std::vector<const void *> offsets;
+        std::vector<GLint> baseVertices;
+    };
+    std::vector<Run> runs;
+};
+
+#endif // GEOMETRYPOOL_H
@@ -0,0 +1,143 @@
+#ifndef GPUSCENE_H
+#define GPUSCENE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "AsyncLoader.h"
+#include "FrustumCuller.h"
+#include "ModelData.h"
+#include "RenderGLTF.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+#include "UniformBlocks.h"
+
+// LODs a mesh can have on the GPU path; further ones are never picked.
+const int GpuSceneMaxLods = 4;
+
+struct GpuSceneStats {
+    size_t objects = 0;
+    size_t instances = 0;   // one per object and mesh
+    size_t meshes = 0;
+    size_t commands = 0;    // one per mesh and LOD
+    size_t multiDraws = 0;  // glMultiDrawElementsIndirect calls
+};
+
+// GPU-driven rendering for GL 4.3 contexts. Instances (one per object and
+// mesh) live in a shader storage buffer and only change when an object is
+// added or moves. Each frame a compute shader tests every instance against
+// the frustum, picks its LOD like LodSelector, and appends its transform to
+// the indirect draw command of that mesh and LOD. Draws sharing a VAO and
+// material then go out as one glMultiDrawElementsIndirect with the
+// per-instance attributes of vertex_shader.glsl fetched through
+// baseInstance. The CPU's per-frame work grows with the distinct meshes,
+// not with the objects.
+class GpuScene {
+public:
+    using Handle = uint32_t;
+    static const Handle InvalidHandle = 0xFFFFFFFFu;
+
+    // Compute shaders, storage buffers and indirect multi-draws.
+    static bool supported();
+
+    explicit GpuScene(const std::string &shaderDirectory);
+    ~GpuScene();
+
+    GpuScene(const GpuScene &) = delete;
+    GpuScene &operator=(const GpuScene &) = delete;
+
+    // model must outlive the scene.
+    Handle add(const LoadedModel &model, const glm::mat4 &modelMatrix, const glm::vec4 &color);
+    void update(Handle handle, const glm::mat4 &modelMatrix);
+
+    // Uploads what changed, culls on the GPU and writes the draw commands.
+    // lights reach the draws through the Lights block.
+    void prepare(const Frustum &frustum, const LodSelector &lods, const std::vector<Light> &lights);
+    // Draws the pass's materials with shader, instanced; after prepare().
+    // Transparent draws are not sorted.
+    void draw(Shader &shader, RenderPass pass);
+    void reloadShadersIfModified() { cullShader.reloadIfModified(); }
+    // GL thread, while the context is still current.
+    void release();
+
+    const GpuSceneStats &stats() const { return frameStats; }
+
+private:
+    // std430 mirrors of the structs in gpu_cull_compute.glsl.
+    struct InstanceRecord {
+        glm::mat4 model;
+        glm::vec4 color;
+        uint32_t mesh;
+        uint32_t padding[3];
+    };
+    struct MeshRecord {
+        glm::vec4 boundsMin;  // w: LOD count
+        glm::vec4 boundsMax;
+        glm::vec4 lodErrors;  // object space
+        uint32_t firstCommand; // then one per LOD
+        uint32_t padding[3];
+    };
+    // Layout fixed by glMultiDrawElementsIndirect.
+    struct IndirectCommand {
+        uint32_t count;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t baseVertex;
+        uint32_t baseInstance;
+    };
+
+    struct MeshEntry {
+        const LoadedModel *model;
+        size_t mesh;
+        uint32_t instanceCount;
+    };
+    struct ObjectEntry {
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+    struct DrawGroup {
+        GLuint vao;
+        GLenum indexType;
+        const Material *material;
+        size_t materialOffset; // into materialBlock
+        std::vector<uint32_t> meshes;
+        size_t firstCommand;
+        size_t commandCount;
+    };
+
+    void buildCommands();
+    void uploadInstances();
+
+    Shader cullShader;
+    UniformHandle<glm::vec4> planeUniforms[6];
+    UniformHandle<glm::vec3> cameraUniform;
+    UniformHandle<float> pixelScaleUniform;
+    UniformHandle<float> maxErrorUniform;
+    UniformHandle<int> countUniform;
+
+    std::vector<MeshEntry> meshes;
+    std::map<std::pair<const LoadedModel *, size_t>, uint32_t> meshIds;
+    std::vector<ObjectEntry> objects;
+    std::vector<InstanceRecord> instances;
+    size_t dirtyBegin = 0, dirtyEnd = 0;     // instances to upload
+
+    std::vector<DrawGroup> groups;
+    std::map<std::tuple<GLuint, GLenum, const Material *>, size_t> groupIds;
+    std::vector<MeshRecord> meshRecords;
+    std::vector<IndirectCommand> commands;
+    std::vector<unsigned char> materialRecords; // MaterialUniforms at the uniform buffer alignment
+    size_t visibleCapacity = 0; // instance slots over all commands
+
+    GLuint instanceBuffer = 0, meshBuffer = 0, commandBuffer = 0, visibleBuffer = 0;
+    size_t instanceBufferCapacity = 0, visibleBufferCapacity = 0;
+    UniformBlock materialBlock;
+    UniformBlock lightBlock;
+    GpuSceneStats frameStats;
+};
+
+#endif // GPUSCENE_H
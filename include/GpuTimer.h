@@ -0,0 +1,37 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <glad/glad.h>
+
+// GPU time spent between begin() and end(), from GL_TIME_ELAPSED queries.
+// Queries rotate through a small ring and are only read once the driver
+// reports them available, so timing never stalls the pipeline; the value
+// lags the current frame by a few frames. Timed ranges must not nest.
+class GpuTimer {
+public:
+    static const unsigned QueryCount = 4;
+
+    GpuTimer() = default;
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin();
+    void end();
+    // GL thread, while the context is still current.
+    void release();
+
+    // Latest finished measurement; 0 until the first one arrives.
+    double milliseconds() const { return lastMilliseconds; }
+
+private:
+    void collect();
+
+    GLuint queries[QueryCount] = {};
+    bool pending[QueryCount] = {};
+    unsigned next = 0;
+    double lastMilliseconds = 0.0;
+};
+
+#endif // GPUTIMER_H
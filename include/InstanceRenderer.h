@@ -0,0 +1,59 @@
+#ifndef INSTANCERENDERER_H
+#define INSTANCERENDERER_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "CommandList.h"
+#include "RenderGLTF.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+// Shader locations of the per-instance attributes; the matrix uses four.
+const GLuint InstanceModelLocation = 3;
+const GLuint InstanceColorLocation = 7;
+
+// Points the per-instance attributes of the bound VAO at InstanceData
+// starting byteOffset into buffer.
+void BindInstanceAttributes(GLuint buffer, size_t byteOffset);
+// Leaves a VAO usable by the non-instanced RenderMesh path.
+void DisableInstanceAttributes();
+
+// Replays command lists on the GL thread: batches with the same model, mesh
+// and LOD (which also fixes the material) are merged across lists and each
+// becomes a single instanced DrawItem for the RenderQueue.
+class InstanceRenderer {
+public:
+    // Writes every batch's instances into the queue's stream buffer and
+    // submits one draw per batch; call between queue.clear() and execute().
+    // Transparent batches use transparentShader when given, so a deferred
+    // frame can still shade them forward.
+    void flush(Shader &shader, RenderQueue &queue, const CommandList *lists, size_t listCount, Shader *transparentShader = nullptr);
+
+    size_t batchCount() const { return activeBatches; }
+
+private:
+    static const size_t NoPart = ~size_t(0);
+
+    // One list's instances of a batch, chained in list order.
+    struct Part {
+        const std::vector<InstanceData> *instances;
+        size_t next;
+    };
+    struct MergedBatch {
+        InstanceBatchKey key;
+        float nearestDepth;
+        size_t instanceCount;
+        size_t firstPart;
+        size_t lastPart = NoPart;
+    };
+
+    std::vector<MergedBatch> mergedBatches;
+    std::unordered_map<InstanceBatchKey, size_t, InstanceBatchKeyHash> mergedIndex;
+    std::vector<Part> parts;
+    size_t activeBatches = 0;
+};
+
+#endif // INSTANCERENDERER_H
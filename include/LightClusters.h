@@ -0,0 +1,79 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "ModelData.h"
+#include "UniformBlocks.h"
+
+struct LightClusterStats {
+    size_t lights = 0;        // clustered lights this frame
+    size_t references = 0;    // light-cluster pairs
+    size_t maxPerCluster = 0;
+    size_t dropped = 0;       // lights that no longer fit the index buffer
+};
+
+// Clustered forward lighting. The view frustum is cut into GridX x GridY
+// screen tiles and GridZ slices spaced exponentially in view depth. Each
+// frame the CPU bins every light with a range into the clusters its sphere
+// touches (sphere against cluster box, four clusters at a time with SSE2),
+// and uploads the lights, per-cluster ranges and light indices as buffer
+// textures. A pixel then shades only the lights listed for its cluster.
+class LightClusters {
+public:
+    static const int GridX = 16;
+    static const int GridY = 9;
+    static const int GridZ = 24;
+    static const int ClusterCount = GridX * GridY * GridZ;
+
+    LightClusters() = default;
+    ~LightClusters();
+
+    LightClusters(const LightClusters &) = delete;
+    LightClusters &operator=(const LightClusters &) = delete;
+
+    // World-space lights; those without a range are left to the Lights block.
+    void build(const std::vector<Light> &lights, const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane);
+    // Uploads the last build and binds it to the Clusters block and the
+    // cluster texture units.
+    void upload();
+    // GL thread, while the context is still current.
+    void release();
+
+    const LightClusterStats &stats() const { return frameStats; }
+
+private:
+    struct Reference {
+        uint32_t cluster;
+        uint32_t light;
+    };
+
+    void buildClusterBounds(const glm::mat4 &projection, float nearPlane, float farPlane);
+    int sliceOf(float depth) const;
+    void binLight(const glm::vec3 &center, float radius, uint32_t light);
+
+    // View-space cluster boxes, x fastest; the row arrays hold the y and z
+    // extent shared by all clusters of a tile row in a slice.
+    std::vector<float> minX, maxX, minY, maxY, minZ, maxZ;
+    std::vector<float> rowMinY, rowMaxY, rowMinZ, rowMaxZ;
+    glm::mat4 boundsProjection = glm::mat4(0.0f);
+    float nearPlane = 0.0f, farPlane = 0.0f;
+    float sliceScale = 0.0f, sliceBias = 0.0f;
+
+    std::vector<Reference> references;
+    std::vector<glm::vec4> lightTexels;   // position and range, color and intensity
+    std::vector<uint32_t> clusterRanges;  // first index and count per cluster
+    std::vector<uint32_t> lightIndices;
+    std::vector<uint32_t> scratchCursor;
+    LightClusterStats frameStats;
+
+    GLuint buffers[3] = {};
+    GLuint textures[3] = {};
+    UniformBlock clusterBlock;
+    size_t maxTexels = 0;
+};
+
+#endif // LIGHTCLUSTERS_H
@@ -2,5 +2,27 @@
 
 #include <tiny_gltf.h>
 #include <string>
+#include "MappedFile.h"
+
+enum class GLTFLoadMode {
+    Copy,   // Read the file into memory and let tinygltf copy the BIN chunk into Buffer::data
+    Mapped  // mmap the .glb and leave the BIN chunk in the mapping (zero-copy)
+};
+
+// A parsed glTF model together with the storage its buffers live in.
+// Resolve buffer bytes through bufferData() rather than Buffer::data, which
+// stays empty for the embedded GLB buffer in Mapped mode.
+struct GLTFAsset {
+    tinygltf::Model model;
+    MappedFile file;
+    const unsigned char *binChunk = nullptr;
+    size_t binChunkSize = 0;
+
+    bool isMapped() const { return file.isOpen(); }
+    const unsigned char *bufferData(int buffer) const;
+    // Bytes behind bufferData(), which may be less than the declared byteLength.
+    size_t bufferSize(int buffer) const;
+};
 
 bool LoadGLTFModel(tinygltf::Model &model, const std::string &filename);
+bool LoadGLTFAsset(GLTFAsset &asset, const std::string &filename, GLTFLoadMode mode = GLTFLoadMode::Copy);
@@ -0,0 +1,31 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. The mapping is released when the
+// object is destroyed, so anything pointing into data() must not outlive it.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    bool open(const std::string &path);
+    void close();
+
+    const unsigned char *data() const { return bytes; }
+    std::size_t size() const { return length; }
+    bool isOpen() const { return bytes != nullptr; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    std::size_t length = 0;
+};
+
+#endif // MAPPEDFILE_H
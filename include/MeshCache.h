@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "ModelData.h"
+
+// .tcmesh is a versioned snapshot of a model's GPU-ready vertex and index
+// blobs, mesh bounds, LOD ranges and occluder flags, materials, lights and
+// animation tables. It lives next to the source .glb and is keyed by a hash
+// of the .glb contents, so a stale cache is simply ignored and rewritten.
+// Models that do not fit the format (too many attributes or LODs) are not
+// cached at all.
+const uint32_t MeshCacheVersion = 10;
+
+std::string MeshCachePath(const std::string &sourcePath);
+bool HashSourceFile(const std::string &path, uint64_t &hash);
+
+// Maps the cache into data.cacheFile and points the MeshData blobs into the
+// mapping. Fails on a missing file, a version or hash mismatch, or a
+// malformed layout.
+bool LoadMeshCache(ModelData &data, const std::string &sourcePath, uint64_t sourceHash);
+bool WriteMeshCache(const ModelData &data, const std::string &sourcePath, uint64_t sourceHash);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "RenderGLTF.h"
+
+// Import-time reordering for GPU efficiency. Triangles are reordered for the
+// post-transform vertex cache, then grouped into clusters that are sorted to
+// reduce overdraw, and finally decoded vertices are renumbered in first-use
+// order for fetch locality.
+
+struct MeshStats {
+    float acmr = 0.0f;     // transformed vertices per triangle
+    float atvr = 0.0f;     // transformed vertices per referenced vertex
+    float overdraw = 0.0f; // shaded pixels per covered pixel
+};
+
+// Vertex cache statistics with a FIFO cache of the given size.
+void AnalyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount, size_t cacheSize, MeshStats &stats);
+// Overdraw measured by rasterizing the mesh along the six axis directions.
+void AnalyzeOverdraw(const unsigned int *indices, size_t indexCount, const std::vector<glm::vec3> &positions, MeshStats &stats);
+
+// Forsyth's linear-speed vertex cache optimization, in place.
+void OptimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount);
+// Reorders cache-optimized triangles in clusters, outward-facing clusters
+// first. threshold bounds the ACMR loss allowed when splitting clusters.
+void OptimizeOverdraw(unsigned int *indices, size_t indexCount, const std::vector<glm::vec3> &positions, float threshold = 1.05f);
+
+// Runs all passes over each LOD of the primitive and renumbers its decoded
+// vertices; before and after receive statistics of the full-detail LOD.
+// Mapped primitives only get new indices; their vertex bytes stay in the
+// mapping. Run after GenerateLods and before PackIndices.
+void OptimizeMesh(MeshData &data, MeshStats &before, MeshStats &after);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "RenderGLTF.h"
+
+// Quadric edge-collapse simplification that keeps the vertex buffer as-is and
+// only produces a new index list, so every LOD of a primitive can share one
+// VBO. Vertices collapse onto a neighbour; open mesh borders are locked.
+// The vertices of an attribute seam (one position, several vertices) move
+// together, each onto its own side's vertex at the target, so seams slide
+// along themselves but are never crossed. Collapse cost includes a normal/UV
+// penalty so shading discontinuities survive.
+//
+// Stops at targetIndexCount or when the next collapse would exceed maxError
+// (object-space units). resultError receives the largest error introduced.
+std::vector<unsigned int> SimplifyMesh(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices,
+                                       size_t targetIndexCount, float maxError, float &resultError);
+
+// Appends a chain of simplified LODs to the primitive's indices and fills
+// data.lods. Works on decoded and mapped primitives; run before PackIndices.
+void GenerateLods(MeshData &data);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "LoadModel.h"
+#include "MeshOptimize.h"
+#include "RenderGLTF.h"
+
+struct AnimationData {
+    std::vector<float> times;
+    std::vector<glm::vec3> translations;
+    std::vector<glm::vec3> scales;
+};
+
+struct Material {
+    glm::vec4 baseColor;
+    float metallic;
+    float roughness;
+};
+
+struct Light {
+    glm::vec3 position;
+    glm::vec3 color;
+    float intensity;
+    float range = 0.0f; // 0 reaches everywhere and is shaded unattenuated
+};
+
+// A light infinitely far away, like the sun; the only kind that casts shadows.
+struct DirectionalLight {
+    glm::vec3 direction; // the way the light travels
+    glm::vec3 color;
+    float intensity;
+};
+
+// What importing a model did, summed over its meshes. Filled on the decoding
+// thread; AsyncLoader prints it on the render thread when asked to. Cache
+// hits skip the optimization passes, so before and after stay zero.
+struct ImportReport {
+    bool fromCache = false;
+    bool cacheWritten = false;
+    size_t triangles = 0;      // full detail
+    size_t lodMeshes = 0;      // meshes with a LOD chain
+    size_t lodTriangles = 0;   // coarsest LOD of each mesh
+    MeshStats before, after;   // weighted by triangles
+};
+
+// Everything a model needs before it reaches the GPU: the parsed asset or
+// the mapped .tcmesh cache (either of which may back the mesh blobs),
+// decoded geometry, animations, materials and lights. Loading it touches no
+// GL state, so it can run on any thread.
+struct ModelData {
+    GLTFAsset asset;
+    MappedFile cacheFile;
+    std::vector<MeshData> meshes;
+    std::vector<AnimationData> animations;
+    std::vector<Material> materials;
+    std::vector<Light> lights;
+    ImportReport report;
+};
+
+void LoadAnimationData(const GLTFAsset &asset, std::vector<AnimationData> &animations);
+void LoadMaterialData(const tinygltf::Model &model, std::vector<Material> &materials);
+void LoadLightData(const tinygltf::Model &model, std::vector<Light> &lights);
+
+// Uses the .tcmesh next to path when its content hash matches, otherwise
+// decodes the glTF and (with useMeshCache) writes a fresh cache.
+bool LoadModelData(ModelData &data, const std::string &path, GLTFLoadMode mode = GLTFLoadMode::Copy, bool useMeshCache = true);
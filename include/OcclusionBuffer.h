@@ -0,0 +1,79 @@
+#ifndef OCCLUSIONBUFFER_H
+#define OCCLUSIONBUFFER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "RenderGLTF.h"
+
+// Import stage: marks a primitive as an occluder when it covers its bounding
+// box seen along each axis, so the box can stand in for it without hiding
+// anything the real mesh would not.
+void DetectOccluder(MeshData &data);
+
+struct OcclusionStats {
+    size_t occluders = 0;
+    size_t triangles = 0;
+    size_t tested = 0;
+    size_t occluded = 0;
+};
+
+// Low-resolution CPU depth buffer for occlusion culling, with no GPU
+// readback. Each frame, occluder boxes are rasterized into it and candidate
+// AABBs are tested against it. The buffer holds 1/w, so larger is nearer and
+// values interpolate linearly in screen space. Each 8x8 tile also keeps its
+// farthest value, so most tests never touch single pixels. Rasterization is
+// SSE2, four pixels at a time, split into horizontal bands across persistent
+// worker threads.
+class OcclusionBuffer {
+public:
+    // Sizes round up to multiples of 8. workerCount 0 picks up to three
+    // helpers from the hardware threads.
+    explicit OcclusionBuffer(int width = 256, int height = 128, unsigned workerCount = 0);
+    ~OcclusionBuffer();
+
+    OcclusionBuffer(const OcclusionBuffer &) = delete;
+    OcclusionBuffer &operator=(const OcclusionBuffer &) = delete;
+
+    void begin(const glm::mat4 &viewProjection);
+    // An object-space box under modelMatrix. Boxes that cross the near plane
+    // or cover only a few pixels are skipped.
+    void addOccluder(const glm::mat4 &modelMatrix, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+    void rasterize();
+    // False only when every pixel the box may cover is behind an occluder.
+    bool isVisible(const glm::vec3 &worldMin, const glm::vec3 &worldMax);
+
+    const OcclusionStats &stats() const { return frameStats; }
+
+private:
+    static const int TileSize = 8;
+
+    struct Triangle {
+        float x[3], y[3], invW[3];
+        int minX, maxX, minY, maxY;
+    };
+
+    void rasterizeBand(unsigned band);
+    void workerLoop(unsigned band);
+
+    int width, height;
+    int tilesX, tilesY;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    std::vector<float> depth;     // 1/w per pixel, 0 where nothing was drawn
+    std::vector<float> tileDepth; // smallest 1/w per tile
+    std::vector<Triangle> triangles;
+    OcclusionStats frameStats;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable startWork;
+    std::condition_variable workDone;
+    unsigned generation = 0;
+    unsigned pending = 0;
+    bool stopping = false;
+};
+
+#endif // OCCLUSIONBUFFER_H
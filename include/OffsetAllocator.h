@@ -0,0 +1,66 @@
+#ifndef OFFSETALLOCATOR_H
+#define OFFSETALLOCATOR_H
+
+#include <cstdint>
+#include <vector>
+
+// Two-level segregated fit (TLSF) allocator over an abstract range of units.
+// It hands out offsets, not memory, so it can manage ranges inside GPU
+// buffers. Free blocks are binned by a 3-bit mantissa floating point size
+// class; allocate and free are O(1), and freed blocks merge with free
+// neighbours immediately.
+class OffsetAllocator {
+public:
+    static const uint32_t NoSpace = 0xFFFFFFFFu;
+
+    struct Allocation {
+        uint32_t offset = NoSpace;
+        uint32_t node = NoSpace;
+        bool valid() const { return offset != NoSpace; }
+    };
+
+    explicit OffsetAllocator(uint32_t size = 0);
+
+    Allocation allocate(uint32_t size);
+    void free(Allocation allocation);
+    // Extends the managed range at the end; existing allocations stay put.
+    void grow(uint32_t newSize);
+    // Drops every allocation.
+    void reset(uint32_t size);
+
+    uint32_t size() const { return totalSize; }
+    uint32_t freeSpace() const { return freeUnits; }
+    uint32_t largestFreeRegion() const;
+    uint32_t allocationSize(Allocation allocation) const;
+
+private:
+    static const uint32_t BinCount = 256;
+    static const uint32_t LeafBins = 8;
+    static const uint32_t Unused = 0xFFFFFFFFu;
+
+    struct Node {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        uint32_t binPrev = Unused;
+        uint32_t binNext = Unused;
+        uint32_t neighborPrev = Unused;
+        uint32_t neighborNext = Unused;
+        bool used = false;
+    };
+
+    uint32_t newNode();
+    void insertFree(uint32_t node);
+    void removeFree(uint32_t node);
+    uint32_t findFreeBin(uint32_t minBin) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> spareNodes;
+    uint32_t binHeads[BinCount];
+    uint32_t topBins = 0;            // bit per group of LeafBins bins
+    uint8_t leafBins[BinCount / LeafBins] = {};
+    uint32_t lastNode = Unused;      // node at the end of the range
+    uint32_t totalSize = 0;
+    uint32_t freeUnits = 0;
+};
+
+#endif // OFFSETALLOCATOR_H
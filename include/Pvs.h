@@ -0,0 +1,86 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Precomputed potentially visible sets. The scene's XZ extent is divided into
+// square view cells spanning an eye height range. Each cell stores a bitset
+// over object ids, compressed by run-length encoding its zero bytes. Built
+// offline by BuildPvs and saved as a .pvs file next to the scene's assets.
+const uint32_t PvsVersion = 1;
+
+// Object id i is element i. Dynamic objects are neither tested nor treated
+// as blockers; they are marked visible from every cell.
+struct PvsObject {
+    glm::vec3 boundsMin, boundsMax; // world space
+    bool dynamic = false;
+};
+
+// Static geometry that blocks rays: an object-space box under modelMatrix,
+// belonging to object owner (which never blocks rays aimed at itself).
+struct PvsOccluder {
+    glm::mat4 modelMatrix;
+    glm::vec3 boundsMin, boundsMax;
+    uint32_t owner;
+};
+
+struct PvsBuildSettings {
+    float cellSize = 16.0f;
+    float eyeMin = 0.0f;             // world-space Y range the camera may occupy
+    float eyeMax = 10.0f;
+    int samplesPerCell = 16;         // jittered eye positions per cell
+    int raysPerObject = 8;           // random target points per eye position
+    float maxDistance = 1000.0f;     // objects farther from a cell are never visible
+    int dilateCells = 1;             // merge the sets of neighbours this many cells away
+    unsigned threadCount = 0;        // 0 = one per hardware thread
+};
+
+class PvsData {
+public:
+    bool valid() const { return cellsX > 0; }
+    size_t objectCount() const { return objects; }
+    size_t cellCount() const { return size_t(cellsX) * cellsZ; }
+
+    // Cell containing position, or -1 outside the grid or the eye range.
+    int cellAt(const glm::vec3 &position) const;
+    // Ids of the objects visible from cell, decoded on first use; repeated
+    // calls for the same cell are free.
+    const std::vector<uint32_t> &visibleObjects(int cell);
+    // Compressed bytes of every cell; for reporting.
+    size_t compressedSize() const { return compressed.size(); }
+
+private:
+    friend bool BuildPvs(const std::vector<PvsObject> &, const std::vector<PvsOccluder> &, const PvsBuildSettings &, PvsData &);
+    friend bool LoadPvs(const std::string &, size_t, PvsData &);
+    friend bool WritePvs(const std::string &, const PvsData &);
+
+    glm::vec2 gridMin = glm::vec2(0.0f);
+    float cellSize = 1.0f;
+    float eyeMin = 0.0f, eyeMax = 0.0f;
+    uint32_t cellsX = 0, cellsZ = 0;
+    uint32_t objects = 0;
+    std::vector<uint32_t> cellOffsets; // cellCount() + 1 offsets into compressed
+    std::vector<uint8_t> compressed;
+
+    int decodedCell = -1;
+    std::vector<uint32_t> decoded;
+};
+
+// Casts rays from jittered eye positions in every cell to random points
+// inside each static object's bounds; one unblocked ray makes the object
+// visible from the cell. Cells are spread over worker threads. Sampling can
+// miss narrow gaps, so more samples trade build time for fewer false rejects.
+bool BuildPvs(const std::vector<PvsObject> &objects, const std::vector<PvsOccluder> &occluders,
+              const PvsBuildSettings &settings, PvsData &pvs);
+
+// Fails on a missing or malformed file, including any cell whose run stream
+// does not expand to one bit per object, and when the file was built for a
+// different number of objects.
+bool LoadPvs(const std::string &path, size_t objectCount, PvsData &pvs);
+bool WritePvs(const std::string &path, const PvsData &pvs);
+
+#endif // PVS_H
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
+#include "LoadModel.h"
 
 struct Vertex {
     glm::vec3 Position;
@@ -11,11 +13,133 @@ struct Vertex {
     glm::vec2 TexCoords;
 };
 
-struct Mesh {
+// Layout of one vertex attribute inside a vertex byte range.
+struct VertexAttribute {
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    size_t offset;
+};
+
+// One level of detail: a range of the primitive's index buffer plus the
+// object-space error it introduces relative to the full mesh.
+struct MeshLod {
+    GLsizei indexOffset;  // in indices, not bytes
+    GLsizei indexCount;
+    float error;
+};
+
+// GL-free geometry of one primitive. Produced by DecodeMeshFromGLTF on any
+// thread and turned into a Mesh by UploadMesh on the GL thread. Decoded
+// primitives fill vertices and 32-bit indices, which import stages work on
+// until PackIndices narrows them into packedIndices. Mapped and cached ones
+// point into a file mapping that must stay alive until the upload. LODs are
+// stored back to back in the index buffer; lods is empty when there is only
+// the full mesh.
+struct MeshData {
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
-    GLuint VAO, VBO, EBO;
+    std::vector<unsigned char> packedIndices;
+    const unsigned char *vertexBytes = nullptr;
+    size_t vertexByteSize = 0;
+    const unsigned char *indexBytes = nullptr;
+    size_t indexByteSize = 0;
+    std::vector<VertexAttribute> attributes;
+    size_t vertexCount = 0;
+    GLsizei indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    std::vector<MeshLod> lods;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    bool occluder = false;  // the bounds can stand in for the mesh in occlusion culling
+
+    // GPU-ready bytes, whichever representation currently holds them.
+    const void *vertexSource() const;
+    size_t vertexSourceSize() const;
+    const void *indexSource() const;
+    size_t indexSourceSize() const;
 };
 
-void CreateMeshFromGLTF(const tinygltf::Model &model, const tinygltf::Mesh &gltfMesh, std::vector<Mesh> &meshes);
-void RenderMesh(const Mesh &mesh);
+// What CPU-side geometry survives UploadMesh. Rendering only needs the GL
+// objects, so the default drops everything; picking and collision can ask
+// for positions plus indices, or for the full vertices.
+enum class GeometryRetention {
+    Discard,
+    Positions,
+    Full
+};
+
+// CPU copy of an uploaded mesh, kept only on request.
+struct MeshGeometry {
+    std::vector<glm::vec3> positions;  // always filled when retained
+    std::vector<Vertex> vertices;      // GeometryRetention::Full only
+    std::vector<unsigned int> indices;
+};
+
+class GeometryPool;
+struct GeometrySlot;
+
+// A mesh either owns its VAO/VBO/EBO or, when uploaded through a
+// GeometryPool, lives in a slot of a shared arena (VAO/VBO/EBO stay 0).
+struct Mesh {
+    std::shared_ptr<const MeshGeometry> geometry; // null unless retained
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    GeometrySlot *slot = nullptr;
+    GLsizei indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    std::vector<MeshLod> lods;  // at least one; lods[0] is the full mesh
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    bool occluder = false;
+};
+
+// Everything a draw of one mesh LOD needs; pooled meshes share the VAO and
+// are offset with baseVertex.
+struct DrawRange {
+    GLuint VAO;
+    GLenum indexType;
+    GLsizei indexCount;
+    const void *indexOffset;
+    GLint baseVertex;
+};
+
+DrawRange GetDrawRange(const Mesh &mesh, size_t lod);
+
+// Picks the coarsest LOD whose error, projected to the screen, stays under
+// maxPixelError. pixelScale is viewportHeight / (2 * tan(fovy / 2)). A
+// maxPixelError of 0 keeps every mesh at LOD 0 wherever the camera is.
+struct LodSelector {
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float pixelScale = 1.0f;
+    float maxPixelError = 1.0f;
+
+    size_t select(const Mesh &mesh, const glm::mat4 &modelMatrix) const;
+};
+
+// Produces one MeshData per primitive without touching GL. For a mapped asset
+// the attribute and index bytes are referenced in their stored layout inside
+// the file mapping; otherwise they are decoded into interleaved Vertex arrays.
+void DecodeMeshFromGLTF(const GLTFAsset &asset, const tinygltf::Mesh &gltfMesh, std::vector<MeshData> &meshData);
+// With a pool, interleaved meshes are suballocated from its shared buffers;
+// anything else gets buffers of its own.
+Mesh UploadMesh(MeshData &&data, GeometryRetention retention = GeometryRetention::Discard, GeometryPool *pool = nullptr);
+
+// Narrowest of GL_UNSIGNED_BYTE/SHORT/INT that can hold maxIndex.
+GLenum SmallestIndexType(unsigned int maxIndex);
+size_t IndexTypeSize(GLenum indexType);
+
+// Moves 32-bit indices into packedIndices using the smallest index type that
+// fits the primitive. No-op once packed.
+void PackIndices(MeshData &data);
+
+// Float vertices and 32-bit indices of a MeshData in any representation,
+// for import stages that run after a mapped decode or a cache load.
+void ReadMeshVertices(const MeshData &data, std::vector<Vertex> &vertices);
+void ReadMeshIndices(const MeshData &data, std::vector<unsigned int> &indices, size_t count);
+
+// Decode and upload in one step, on the GL thread.
+void CreateMeshFromGLTF(const GLTFAsset &asset, const tinygltf::Mesh &gltfMesh, std::vector<Mesh> &meshes);
+void ReleaseMesh(Mesh &mesh);
+void RenderMesh(const Mesh &mesh, size_t lod = 0);
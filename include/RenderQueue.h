@@ -0,0 +1,113 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+#include "GeometryPool.h"
+#include "ModelData.h"
+#include "RenderGLTF.h"
+#include "Shader.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+
+enum class RenderPass : uint8_t {
+    Opaque = 0,      // front to back within a state bucket
+    Transparent = 1  // back to front, state second
+};
+
+// One draw as submitted to the queue. Pointers must stay valid until
+// execute(); material and lights are compared by address. Items without
+// lights of their own are lit by the scene lights.
+struct DrawItem {
+    RenderPass pass = RenderPass::Opaque;
+    Shader *shader = nullptr;
+    const Material *material = nullptr;
+    const std::vector<Light> *lights = nullptr;
+    DrawRange draw = {};
+    GLuint instanceBuffer = 0;  // 0 draws one copy with modelMatrix
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    size_t instanceOffset = 0;  // bytes into instanceBuffer
+    GLsizei instanceCount = 1;
+    float depth = 0.0f;         // view distance
+};
+
+// State changes executed in a frame, and what submission order would have cost.
+struct RenderQueueStats {
+    size_t draws = 0;
+    size_t mergedDraws = 0; // items drawn through multi-draws
+    size_t programChanges = 0;
+    size_t vaoChanges = 0;
+    size_t materialChanges = 0;
+    size_t lightChanges = 0;
+    size_t unsortedProgramChanges = 0;
+    size_t unsortedVaoChanges = 0;
+    size_t unsortedMaterialChanges = 0;
+};
+
+// Collects a frame's draws, sorts them by packed 64-bit keys and executes
+// them, skipping program, VAO and material changes that would not change
+// anything. The frame's distinct materials and light lists are written into
+// the stream buffer up front, so a change is one buffer range bind. Opaque
+// keys are
+//   pass:2 | shader:8 | material:16 | geometry:16 | depth:22
+// and transparent ones move depth (inverted) ahead of the state fields.
+class RenderQueue {
+public:
+    // Starts a frame: drops the last frame's items and opens the next region
+    // of the stream buffer.
+    void clear();
+    void submit(const DrawItem &item);
+    // Sorts and draws everything submitted since clear(); call once a frame.
+    // Same as prepare(), draw() of each pass, finish().
+    void execute();
+    // The split form, for renderers that interleave their own passes: sorts,
+    // writes the frame's uniform blocks and flushes the stream buffer...
+    void prepare();
+    // ...draws the items of one pass, any number of times...
+    void draw(RenderPass pass);
+    // ...and closes the stream frame once every draw is issued.
+    void finish();
+    // Lights for items that bring none; must stay valid across execute().
+    void setSceneLights(const std::vector<Light> *lights) { sceneLights = lights; }
+    // Per-frame dynamic data for this frame's draws; valid between clear()
+    // and execute().
+    StreamBuffer &streamBuffer() { return stream; }
+    // GL thread, while the context is still current.
+    void release();
+
+    const RenderQueueStats &stats() const { return frameStats; }
+
+private:
+    uint64_t makeKey(const DrawItem &item);
+    // First sorted position of pass; the pass is the top of the key.
+    size_t passBegin(RenderPass pass) const;
+    void sortKeys();
+    void uploadUniforms();
+    const std::vector<Light> *resolveLights(const DrawItem &item) const;
+    void resolveShaderUniforms(Shader *shader);
+
+    struct ShaderUniforms {
+        UniformHandle<glm::mat4> model;
+        UniformHandle<int> instanced;
+    };
+
+    std::vector<DrawItem> items;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchOrder;
+    std::unordered_map<const void *, uint32_t> materialIds;
+    std::unordered_map<GLuint, uint32_t> geometryIds;
+    const std::vector<Light> *sceneLights = nullptr;
+    StreamBuffer stream;
+    std::vector<StreamAllocation> materialBlocks; // by material id
+    std::unordered_map<const std::vector<Light> *, StreamAllocation> lightBlocks;
+    MultiDrawList multiDraws;
+    std::unordered_map<const Shader *, ShaderUniforms> shaderUniforms;
+    RenderQueueStats frameStats;
+};
+
+#endif // RENDERQUEUE_H
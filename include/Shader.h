@@ -4,51 +4,123 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "GLStateCache.h"
+#include <cstdint>
+#include <ctime>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// GL type a uniform must have to be set from a C++ type. Ints also accept
+// bools and samplers.
+template <typename T> struct UniformGLType;
+template <> struct UniformGLType<glm::mat4> { static const GLenum value = GL_FLOAT_MAT4; };
+template <> struct UniformGLType<glm::vec3> { static const GLenum value = GL_FLOAT_VEC3; };
+template <> struct UniformGLType<glm::vec4> { static const GLenum value = GL_FLOAT_VEC4; };
+template <> struct UniformGLType<float> { static const GLenum value = GL_FLOAT; };
+template <> struct UniformGLType<int> { static const GLenum value = GL_INT; };
+
+// Slot in the uniform table of the Shader that handed it out. Handles stay
+// valid across reloads: every relink re-resolves the whole table. A
+// default-constructed (never resolved) handle sets nothing.
+template <typename T>
+struct UniformHandle {
+    uint32_t slot = 0xFFFFFFFFu;
+};
+
 class Shader {
 public:
-    unsigned int ID;
+    unsigned int ID = 0;
 
     Shader(const char* vertexPath, const char* fragmentPath);
+    // A compute program; needs a GL 4.3 context.
+    explicit Shader(const char* computePath);
 
+    // Program binds and uniform uploads go through the GL state cache, so
+    // repeating the current value costs no driver call.
     void use() const {
-        glUseProgram(ID);
+        GLStateCache::get().useProgram(ID);
+    }
+
+    // Resolve once, outside the draw loop. A uniform the program does not
+    // use (or whose type differs from T) gets location -1, which sets nothing.
+    template <typename T>
+    UniformHandle<T> uniform(const char *name) {
+        UniformHandle<T> handle;
+        handle.slot = findUniform(name, UniformGLType<T>::value);
+        return handle;
     }
 
-    void setMat4(const std::string &name, const glm::mat4 &mat) const {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+    void set(UniformHandle<glm::mat4> handle, const glm::mat4 &mat) const {
+        GLStateCache::get().uniformMatrix4fv(ID, location(handle.slot), glm::value_ptr(mat));
     }
 
-    void setVec3(const std::string &name, const glm::vec3 &value) const {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    void set(UniformHandle<glm::vec3> handle, const glm::vec3 &value) const {
+        GLStateCache::get().uniform3fv(ID, location(handle.slot), glm::value_ptr(value));
     }
 
-    void setVec4(const std::string &name, const glm::vec4 &value) const {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    void set(UniformHandle<glm::vec4> handle, const glm::vec4 &value) const {
+        GLStateCache::get().uniform4fv(ID, location(handle.slot), glm::value_ptr(value));
     }
 
-    void setFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    void set(UniformHandle<float> handle, float value) const {
+        GLStateCache::get().uniform1f(ID, location(handle.slot), value);
     }
 
-    void setInt(const std::string &name, int value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    void set(UniformHandle<int> handle, int value) const {
+        GLStateCache::get().uniform1i(ID, location(handle.slot), value);
     }
 
+    // By-name setters cost a hash of name on top of the handle path.
+    void setMat4(const char *name, const glm::mat4 &mat) { set(uniform<glm::mat4>(name), mat); }
+    void setVec3(const char *name, const glm::vec3 &value) { set(uniform<glm::vec3>(name), value); }
+    void setVec4(const char *name, const glm::vec4 &value) { set(uniform<glm::vec4>(name), value); }
+    void setFloat(const char *name, float value) { set(uniform<float>(name), value); }
+    void setInt(const char *name, int value) { set(uniform<int>(name), value); }
+
     void reloadIfModified();
 private:
-    std::string vertexPath;
-    std::string fragmentPath;
-    std::time_t vertexShaderLastWriteTime;
-    std::time_t fragmentShaderLastWriteTime;
+    struct UniformSlot {
+        std::string name;
+        GLenum type;
+    };
+    struct ActiveUniform {
+        GLint location;
+        GLenum type;
+    };
+
+    GLint location(uint32_t slot) const {
+        return slot < uniformLocations.size() ? uniformLocations[slot] : -1;
+    }
+    uint32_t findUniform(const char *name, GLenum type);
+    GLint resolveUniform(const UniformSlot &slot) const;
+    void introspectUniforms();
+
+    std::vector<UniformSlot> uniformSlots;
+    std::vector<GLint> uniformLocations; // by slot, for the current program
+    std::unordered_multimap<uint32_t, uint32_t> slotsByHash;
+    std::unordered_map<std::string, ActiveUniform> activeUniforms;
+
+    struct Stage {
+        GLenum type;
+        std::string path;
+        std::time_t lastWriteTime;
+    };
+    std::vector<Stage> stages;
+    // common.glsl next to the first stage, inserted after each #version.
+    std::string commonPath;
+    std::time_t commonWriteTime = 0;
 
     std::time_t getLastWriteTime(const std::string& path) const;
     void checkForModification();
-    void compileAndLinkShaders(const std::string& vertexCode, const std::string& fragmentCode);
+    // Reads common.glsl and every stage and relinks; false if a file could
+    // not be opened.
+    bool load();
+    void compileAndLinkShaders(const std::vector<std::string>& sources);
+    std::string describe() const;
 };
 
 #endif // SHADER_H
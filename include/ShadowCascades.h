@@ -0,0 +1,110 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "CommandList.h"
+#include "FrustumCuller.h"
+#include "GeometryPool.h"
+#include "ModelData.h"
+#include "Shader.h"
+#include "StreamBuffer.h"
+#include "UniformBlocks.h"
+
+struct ShadowStats {
+    size_t staticRenders = 0;    // cascades whose static casters were redrawn
+    size_t dynamicCascades = 0;  // cascades with moving casters this frame
+    size_t draws = 0;
+    size_t instances = 0;
+};
+
+// Cascaded shadow maps for one directional light. The view frustum is split
+// into ShadowCascadeCount slices (a blend of logarithmic and uniform
+// splits); each gets an orthographic map around the slice's bounding
+// sphere. Turning the camera swings the sphere's center around but never
+// changes its radius, so the map keeps its size; the center is snapped to a
+// coarse light-space grid, so a cascade's matrix only changes when that
+// center crosses a grid step or the sun turns.
+//
+// Static casters are drawn into a cached map per cascade that is only
+// redrawn when the matrix changes or invalidateStatic() is called, so they
+// must be recorded at a LOD that does not depend on the camera. Each
+// frame a cascade with moving casters copies its cached map and draws just
+// those on top; one without them keeps sampling the copy it already has.
+class ShadowCascades {
+public:
+    // resolution must be a multiple of CacheSnapSteps.
+    explicit ShadowCascades(const std::string &shaderDirectory, int resolution = 2048);
+    ~ShadowCascades();
+
+    ShadowCascades(const ShadowCascades &) = delete;
+    ShadowCascades &operator=(const ShadowCascades &) = delete;
+
+    // Fits the cascades to the camera between nearPlane and farPlane and
+    // resets the caster lists. Casters up to casterDistance towards the sun
+    // from a cascade still shadow it. fieldOfView is vertical, in radians.
+    void update(const DirectionalLight &sun, const glm::mat4 &view, float fieldOfView, float aspect, float nearPlane, float farPlane,
+                float casterDistance);
+    // The static casters changed: something was loaded, moved or removed.
+    void invalidateStatic() { ++staticVersion; }
+
+    // Casters of a cascade go into these lists between update() and render().
+    // The static list is only drawn when staticStale() says so; skip
+    // recording it otherwise.
+    const Frustum &frustum(int cascade) const { return cascades[cascade].frustum; }
+    bool staticStale(int cascade) const;
+    CommandList &staticCasters(int cascade) { return cascades[cascade].staticCasters; }
+    CommandList &dynamicCasters(int cascade) { return cascades[cascade].dynamicCasters; }
+
+    // Draws the recorded casters and binds the maps and the Shadows block.
+    // Their instances go into stream, which must be inside its frame.
+    // Leaves the default framebuffer bound and restores the viewport.
+    void render(StreamBuffer &stream);
+    // GL thread, while the context is still current.
+    void release();
+
+    const ShadowStats &stats() const { return frameStats; }
+
+    // The cached maps move in steps of 1/CacheSnapSteps of their width.
+    static const int CacheSnapSteps = 16;
+
+private:
+    struct Cascade {
+        glm::mat4 lightViewProjection = glm::mat4(1.0f);
+        Frustum frustum;
+        float texelSize = 0.0f;
+        CommandList staticCasters;
+        CommandList dynamicCasters;
+        // What the cached map was drawn with.
+        glm::mat4 cachedMatrix = glm::mat4(0.0f);
+        unsigned cachedVersion = ~0u;
+        bool mapHoldsStatic = false; // the sampled layer is a plain copy of the cache
+    };
+
+    void create();
+    size_t appendInstances(const CommandList &list);
+    void drawCasters(const CommandList &list, size_t first, const glm::mat4 &lightViewProjection);
+    void attachLayer(GLuint framebuffer, GLuint texture, int layer);
+
+    Shader casterShader;
+    UniformHandle<glm::mat4> lightViewProjectionUniform;
+    int resolution;
+    Cascade cascades[ShadowCascadeCount];
+    ShadowUniforms uniforms = {};
+    unsigned staticVersion = 0;
+
+    GLuint shadowMaps = 0;   // sampled, with depth comparison
+    GLuint staticMaps = 0;   // static casters only
+    GLuint framebuffers[2] = {};
+    GLuint instanceBuffer = 0; // this frame's stream allocation
+    size_t instanceOffset = 0;
+    std::vector<InstanceData> instanceData;
+    MultiDrawList multiDraws;
+    UniformBlock shadowBlock;
+    ShadowStats frameStats;
+};
+
+#endif // SHADOWCASCADES_H
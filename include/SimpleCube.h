@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include "Shader.h"
+#include "UniformBlocks.h"
 
 class SimpleCube {
 public:
@@ -17,6 +18,7 @@ private:
     glm::vec4 color; // Material color
     float metallic;  // Material metallic factor
     float roughness; // Material roughness factor
+    UniformBlock materialBlock;
     void setupCube();
 };
 
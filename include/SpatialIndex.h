@@ -0,0 +1,100 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "FrustumCuller.h"
+
+struct RayHit {
+    uint32_t id;
+    float distance; // along the normalized ray direction
+};
+
+struct SpatialQueryStats {
+    size_t nodesVisited = 0;
+    size_t itemsAccepted = 0; // taken without a test because their node was fully inside
+    size_t itemsTested = 0;
+};
+
+// Loose quadtree over the XZ plane for a mostly flat city. Every level is a
+// full grid stored in one array, so an item's node is computed directly from
+// its box: the deepest cell whose loose bounds (the cell grown by half its
+// size on each side) contain it. Items store their world-space AABB and a
+// caller id; Y is only tracked as the range of every box ever inserted.
+// Boxes outside the world bounds live in the root, which is never rejected.
+// Queries append matching ids to the output vector.
+class SpatialIndex {
+public:
+    typedef uint32_t Handle;
+    static const Handle InvalidHandle = 0xFFFFFFFFu;
+
+    SpatialIndex(const glm::vec2 &worldMin, const glm::vec2 &worldMax, int maxDepth = 8);
+
+    Handle insert(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, uint32_t id);
+    // Cheap when the item stays in its node, which is the common case for
+    // animated objects.
+    void update(Handle handle, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+    void remove(Handle handle);
+    void clear();
+
+    // Items of fully visible nodes are accepted as a whole; the others go
+    // through culler in SIMD batches.
+    void queryFrustum(const Frustum &frustum, FrustumCuller &culler, std::vector<uint32_t> &ids);
+    void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &ids);
+    void queryBox(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, std::vector<uint32_t> &ids);
+    // Every box the ray enters within maxDistance; direction must be normalized.
+    void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<RayHit> &hits);
+    // Nearest box along the ray, if any.
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, RayHit &hit);
+
+    size_t size() const { return itemCount; }
+    const SpatialQueryStats &stats() const { return lastStats; }
+
+private:
+    struct Node {
+        int32_t firstItem = -1;
+        uint32_t subtreeItems = 0;
+    };
+    struct Item {
+        glm::vec3 boundsMin, boundsMax;
+        uint32_t id;
+        int32_t node = -1; // -1 when free
+        int32_t prev = -1, next = -1;
+        uint8_t depth;
+        uint16_t x, z;
+    };
+    struct Cell {
+        int depth;
+        int x, z;
+    };
+
+    enum class Overlap { Outside, Intersects, Inside };
+
+    size_t nodeIndex(const Cell &cell) const;
+    Cell placement(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const;
+    void looseBounds(const Cell &cell, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const;
+    void link(Handle handle, const Cell &cell);
+    void unlink(Handle handle);
+
+    // Walks every node the classifier does not reject. classify(min, max)
+    // judges a node's loose box; visit(item) tests one item of a node that
+    // is not fully inside, accept(item) takes one without a test.
+    template <typename Classify, typename Visit, typename Accept>
+    void traverse(const Cell &cell, Classify &classify, Visit &visit, Accept &accept);
+    template <typename Accept>
+    void acceptSubtree(const Cell &cell, Accept &accept);
+
+    glm::vec2 worldMin;
+    float worldSize;
+    int maxDepth;
+    float minY, maxY;
+    std::vector<Node> nodes;
+    std::vector<Item> items;
+    std::vector<Handle> freeItems;
+    size_t itemCount = 0;
+    SpatialQueryStats lastStats;
+};
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,72 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <cstddef>
+#include <vector>
+#include <glad/glad.h>
+
+struct StreamAllocation {
+    void *data = nullptr; // write-only; valid until the next allocate or flush
+    GLuint buffer = 0;
+    size_t offset = 0;    // bytes into buffer
+};
+
+struct StreamStats {
+    size_t bytes = 0;      // allocated this frame
+    size_t capacity = 0;   // per frame
+    bool waited = false;   // the GPU still held this frame's region
+    bool persistent = false;
+};
+
+// Buffer for data written once a frame and read only by that frame's draws:
+// instance transforms, per-draw uniform blocks. With GL 4.4 buffer storage it
+// stays mapped (persistent and coherent) and is split into FrameCount
+// regions; each region is fenced after its frame's draws and only waited on
+// when the CPU comes back around to it, so writes go straight into GPU
+// visible memory without stalls. Older contexts (macOS stops at 4.1) orphan
+// the buffer with glBufferData and map it again every frame instead.
+class StreamBuffer {
+public:
+    static const unsigned FrameCount = 3;
+
+    explicit StreamBuffer(size_t frameCapacity = 1 << 20);
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    void beginFrame();
+    // A frame that outgrows its region continues in a new, larger buffer;
+    // allocations already handed out keep their buffer and stay drawable.
+    StreamAllocation allocate(size_t size, size_t alignment);
+    // Before draws that read this frame's allocations. Allocating again
+    // afterwards is fine: the fallback path maps the untouched rest of the
+    // frame's storage without waiting on the draws already issued.
+    void flush();
+    // After the frame's draws.
+    void endFrame();
+    // GL thread, while the context is still current.
+    void release();
+
+    const StreamStats &stats() const { return frameStats; }
+
+private:
+    void create(size_t capacity);
+    void mapFrame();
+    void mapRest();
+    void grow(size_t minimum);
+    void deleteFences();
+
+    GLuint buffer = 0;
+    unsigned char *mapped = nullptr;
+    size_t mappedOffset = 0; // buffer offset of mapped[0]
+    size_t frameCapacity;
+    unsigned frame = 0;
+    size_t head = 0; // bytes used in the current region
+    bool persistent = false;
+    GLsync fences[FrameCount] = {};
+    std::vector<GLuint> retired; // outgrown this frame; deleted once its draws are issued
+    StreamStats frameStats;
+};
+
+#endif // STREAMBUFFER_H
@@ -0,0 +1,112 @@
+#ifndef UNIFORMBLOCKS_H
+#define UNIFORMBLOCKS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "ModelData.h"
+
+// Fixed binding points of the shared uniform blocks and texture units of the
+// shared samplers. GLSL 3.30 has no layout(binding), so Shader assigns them
+// to each program after linking.
+const GLuint CameraBlockBinding = 0;
+const GLuint LightBlockBinding = 1;
+const GLuint MaterialBlockBinding = 2;
+const GLuint ClusterBlockBinding = 3;
+const GLuint ShadowBlockBinding = 4;
+const GLuint ClusterLightsUnit = 8;
+const GLuint ClusterRangesUnit = 9;
+const GLuint ClusterIndicesUnit = 10;
+const GLuint GBufferAlbedoUnit = 11;
+const GLuint GBufferNormalUnit = 12;
+const GLuint GBufferDepthUnit = 13;
+const GLuint ShadowMapUnit = 14;
+
+// Must match MAX_LIGHTS in common.glsl; longer lists are cut short.
+const int MaxLights = 8;
+// Must match SHADOW_CASCADES in common.glsl.
+const int ShadowCascadeCount = 4;
+
+// std140 mirrors of the blocks declared in src/shaders.
+struct CameraUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection; // clip space back to world, for depth reconstruction
+    glm::vec4 position; // w unused
+};
+
+struct LightUniforms {
+    glm::vec3 position;
+    float intensity;
+    glm::vec3 color;
+    float padding;
+};
+
+struct LightBlockUniforms {
+    LightUniforms lights[MaxLights];
+    int32_t count;
+    int32_t padding[3];
+};
+
+struct MaterialUniforms {
+    glm::vec4 baseColor;
+    float metallic;
+    float roughness;
+    float padding[2];
+};
+
+struct ClusterUniforms {
+    glm::uvec4 grid;  // clusters along x, y and z; w is the clustered light count
+    glm::vec4 depth;  // slice scale, slice bias, near, far
+};
+
+struct ShadowUniforms {
+    glm::mat4 cascades[ShadowCascadeCount]; // world to shadow map texture space
+    glm::vec4 splits;        // view depth where each cascade ends
+    glm::vec4 texelSizes;    // world size of a shadow map texel per cascade
+    glm::vec4 sunDirection;  // towards the sun; w is 1 while the sun is on
+    glm::vec4 sunColor;      // rgb color, a intensity
+};
+
+static_assert(sizeof(CameraUniforms) == 272, "CameraUniforms must match the std140 Camera block");
+static_assert(sizeof(LightUniforms) == 32, "LightUniforms must match the std140 Light struct");
+static_assert(sizeof(LightBlockUniforms) == 32 * MaxLights + 16, "LightBlockUniforms must match the std140 Lights block");
+static_assert(sizeof(MaterialUniforms) == 32, "MaterialUniforms must match the std140 Material block");
+static_assert(sizeof(ClusterUniforms) == 32, "ClusterUniforms must match the std140 Clusters block");
+static_assert(sizeof(ShadowUniforms) == 64 * ShadowCascadeCount + 64, "ShadowUniforms must match the std140 Shadows block");
+
+// Points the shared blocks and samplers of program at their binding points
+// and units; ones the program does not use are skipped.
+void AssignSharedBindings(GLuint program);
+
+MaterialUniforms PackMaterialBlock(const Material &material);
+// The first MaxLights of lights, as the Lights block stores them.
+LightBlockUniforms PackLightBlock(const std::vector<Light> &lights);
+
+// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, queried once.
+size_t UniformBufferAlignment();
+
+// A uniform buffer that is rewritten as a whole. Each upload orphans the
+// previous storage, so draws still reading it never stall the CPU.
+class UniformBlock {
+public:
+    UniformBlock() = default;
+    ~UniformBlock();
+
+    UniformBlock(const UniformBlock &) = delete;
+    UniformBlock &operator=(const UniformBlock &) = delete;
+
+    void upload(const void *data, size_t size);
+    void bind(GLuint binding, size_t offset, size_t size) const;
+    // GL thread, while the context is still current.
+    void release();
+
+private:
+    GLuint buffer = 0;
+    size_t capacity = 0;
+};
+
+#endif // UNIFORMBLOCKS_H
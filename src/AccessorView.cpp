@@ -0,0 +1,403 @@
+#include "AccessorView.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TCITY_ACCESSOR_SSE2 1
+#endif
+
+namespace {
+
+// bytes at offset inside a buffer view, or nullptr when they don't fit.
+const unsigned char *BufferViewData(const GLTFAsset &asset, int bufferViewIndex, size_t offset, size_t bytes) {
+    const tinygltf::Model &model = asset.model;
+    if (bufferViewIndex < 0 || static_cast<size_t>(bufferViewIndex) >= model.bufferViews.size()) {
+        return nullptr;
+    }
+    const tinygltf::BufferView &bufferView = model.bufferViews[bufferViewIndex];
+    const unsigned char *buffer = asset.bufferData(bufferView.buffer);
+    size_t bufferSize = asset.bufferSize(bufferView.buffer);
+    if (!buffer || bufferView.byteOffset > bufferSize || bufferView.byteLength > bufferSize - bufferView.byteOffset ||
+        offset > bufferView.byteLength || bytes > bufferView.byteLength - offset) {
+        return nullptr;
+    }
+    return buffer + bufferView.byteOffset + offset;
+}
+
+// Bytes from the first element to the end of the last; false on overflow.
+bool ElementSpan(size_t count, size_t stride, size_t elementSize, size_t &bytes) {
+    if (count == 0) {
+        bytes = 0;
+        return true;
+    }
+    if (stride != 0 && count - 1 > (SIZE_MAX - elementSize) / stride) {
+        return false;
+    }
+    bytes = (count - 1) * stride + elementSize;
+    return true;
+}
+
+// Views of a sparse accessor's substitutions, as dense tightly packed arrays.
+AccessorView SparseIndexView(const AccessorView &view) {
+    AccessorView indices;
+    indices.data = view.sparseIndices;
+    indices.count = view.sparseCount;
+    indices.componentType = view.sparseIndexType;
+    indices.components = 1;
+    indices.stride = tinygltf::GetComponentSizeInBytes(view.sparseIndexType);
+    return indices;
+}
+
+AccessorView SparseValueView(const AccessorView &view) {
+    AccessorView values = view;
+    values.data = view.sparseValues;
+    values.count = view.sparseCount;
+    values.stride = size_t(tinygltf::GetComponentSizeInBytes(view.componentType)) * view.components;
+    values.sparseCount = 0;
+    return values;
+}
+
+} // namespace
+
+bool MakeAccessorView(const GLTFAsset &asset, int accessorIndex, AccessorView &view) {
+    const tinygltf::Model &model = asset.model;
+    if (accessorIndex < 0 || static_cast<size_t>(accessorIndex) >= model.accessors.size()) {
+        return false;
+    }
+    const tinygltf::Accessor &accessor = model.accessors[accessorIndex];
+    view = AccessorView();
+    view.count = accessor.count;
+    view.componentType = accessor.componentType;
+    view.components = tinygltf::GetNumComponentsInType(accessor.type);
+    view.normalized = accessor.normalized;
+    if (view.components < 1 || view.components > 4 || tinygltf::GetComponentSizeInBytes(accessor.componentType) < 1) {
+        std::cerr << "Unsupported accessor type or component type.\n";
+        return false;
+    }
+    if (accessor.sparse.isSparse) {
+        const auto &sparse = accessor.sparse;
+        int indexType = sparse.indices.componentType;
+        size_t count = sparse.count > 0 ? size_t(sparse.count) : 0;
+        size_t elementSize = size_t(tinygltf::GetComponentSizeInBytes(accessor.componentType)) * view.components;
+        bool indexTypeValid = indexType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE || indexType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT ||
+                              indexType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+        size_t indexBytes = 0, valueBytes = 0;
+        const unsigned char *indices = nullptr;
+        const unsigned char *values = nullptr;
+        if (indexTypeValid && ElementSpan(count, tinygltf::GetComponentSizeInBytes(indexType), tinygltf::GetComponentSizeInBytes(indexType), indexBytes) &&
+            ElementSpan(count, elementSize, elementSize, valueBytes)) {
+            indices = BufferViewData(asset, sparse.indices.bufferView, sparse.indices.byteOffset, indexBytes);
+            values = BufferViewData(asset, sparse.values.bufferView, sparse.values.byteOffset, valueBytes);
+        }
+        if (!indices || !values) {
+            std::cerr << "Unreadable sparse accessor.\n";
+            return false;
+        }
+        view.sparseCount = count;
+        view.sparseIndices = indices;
+        view.sparseIndexType = indexType;
+        view.sparseValues = values;
+    }
+    if (accessor.bufferView < 0) {
+        return true;
+    }
+
+    // Every element must lie inside the view and the view inside its buffer:
+    // the readers below touch every byte of that span without checking.
+    if (static_cast<size_t>(accessor.bufferView) >= model.bufferViews.size()) {
+        return false;
+    }
+    int stride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+    size_t elementSize = size_t(tinygltf::GetComponentSizeInBytes(accessor.componentType)) * view.components;
+    size_t bytes = 0;
+    if (stride <= 0 || !ElementSpan(view.count, size_t(stride), elementSize, bytes)) {
+        std::cerr << "Accessor with an invalid byteStride or count.\n";
+        return false;
+    }
+    view.stride = size_t(stride);
+    view.data = BufferViewData(asset, accessor.bufferView, accessor.byteOffset, bytes);
+    if (!view.data) {
+        std::cerr << "Accessor runs past its bufferView or buffer.\n";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+template <typename T>
+T LoadComponent(const unsigned char *src) {
+    T value;
+    std::memcpy(&value, src, sizeof(T));
+    return value;
+}
+
+// Scale applied to normalized integers; signed formats clamp at -1.
+template <typename T> constexpr float NormalizeScale() { return 1.0f / float(std::numeric_limits<T>::max()); }
+
+template <typename T>
+void ReadScalar(const AccessorView &view, unsigned char *out, size_t outStride, int outComponents) {
+    const int copied = std::min(view.components, outComponents);
+    const float scale = view.normalized ? NormalizeScale<T>() : 1.0f;
+    for (size_t i = 0; i < view.count; ++i) {
+        const unsigned char *src = view.data + i * view.stride;
+        float values[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int c = 0; c < copied; ++c) {
+            values[c] = float(LoadComponent<T>(src + c * sizeof(T))) * scale;
+            if (std::is_signed<T>::value && view.normalized) {
+                values[c] = std::max(values[c], -1.0f);
+            }
+        }
+        std::memcpy(out + i * outStride, values, outComponents * sizeof(float));
+    }
+}
+
+#ifdef TCITY_ACCESSOR_SSE2
+// Stores the low 1-4 lanes without touching the bytes after them, so
+// neighbouring attributes of an interleaved vertex stay intact.
+inline void StorePartial(unsigned char *dst, __m128 value, int components) {
+    float *out = reinterpret_cast<float *>(dst);
+    switch (components) {
+    case 1: _mm_store_ss(out, value); break;
+    case 2: _mm_storel_pi(reinterpret_cast<__m64 *>(out), value); break;
+    case 3:
+        _mm_storel_pi(reinterpret_cast<__m64 *>(out), value);
+        _mm_store_ss(out + 2, _mm_movehl_ps(value, value));
+        break;
+    default: _mm_storeu_ps(out, value); break;
+    }
+}
+
+// Zeroes the lanes from count on.
+inline __m128 KeepLanes(__m128 value, int count) {
+    alignas(16) static const uint32_t masks[5][4] = {
+        {0, 0, 0, 0}, {~0u, 0, 0, 0}, {~0u, ~0u, 0, 0}, {~0u, ~0u, ~0u, 0}, {~0u, ~0u, ~0u, ~0u}};
+    return _mm_and_ps(value, _mm_load_ps(reinterpret_cast<const float *>(masks[count])));
+}
+
+// Widens four 8- or 16-bit components to 32 bits, keeping their sign.
+template <typename T>
+inline __m128i WidenLow(__m128i raw) {
+    const __m128i zero = _mm_setzero_si128();
+    if (sizeof(T) == 1) {
+        if (std::is_signed<T>::value) {
+            __m128i bytes16 = _mm_unpacklo_epi8(raw, raw);
+            return _mm_srai_epi32(_mm_unpacklo_epi16(bytes16, bytes16), 24);
+        }
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(raw, zero), zero);
+    }
+    if (std::is_signed<T>::value) {
+        return _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+    }
+    return _mm_unpacklo_epi16(raw, zero);
+}
+
+// Packs up to four integer components of one element into one register.
+template <typename T>
+inline __m128i LoadIntegerLanes(const unsigned char *src, int components) {
+    uint32_t packed[4] = {0, 0, 0, 0};
+    std::memcpy(packed, src, components * sizeof(T));
+    return WidenLow<T>(_mm_loadu_si128(reinterpret_cast<const __m128i *>(packed)));
+}
+
+// Converts count tightly packed components to float, one 16-byte load of
+// source per step; the last few go through the scalar path.
+template <typename T>
+void ConvertPacked(const unsigned char *src, size_t count, float *dst, __m128 scale, __m128 minimum) {
+    const size_t perLoad = 16 / sizeof(T);
+    size_t i = 0;
+    for (; i + perLoad <= count; i += perLoad) {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * sizeof(T)));
+        for (size_t part = 0; part < perLoad; part += 4) {
+            __m128 lanes = _mm_cvtepi32_ps(WidenLow<T>(raw));
+            _mm_storeu_ps(dst + i + part, _mm_max_ps(_mm_mul_ps(lanes, scale), minimum));
+            raw = _mm_srli_si128(raw, 4 * sizeof(T));
+        }
+    }
+    for (; i < count; ++i) {
+        __m128 lane = _mm_set_ss(float(LoadComponent<T>(src + i * sizeof(T))));
+        _mm_store_ss(dst + i, _mm_max_ss(_mm_mul_ss(lane, scale), minimum));
+    }
+}
+
+template <typename T>
+void ReadIntegerSSE(const AccessorView &view, unsigned char *out, size_t outStride, int outComponents) {
+    const int copied = std::min(view.components, outComponents);
+    const __m128 scale = _mm_set1_ps(view.normalized ? NormalizeScale<T>() : 1.0f);
+    const __m128 minusOne = _mm_set1_ps(view.normalized && std::is_signed<T>::value ? -1.0f : -3.4e38f);
+    const size_t packedStride = view.components * sizeof(T);
+    if (view.stride != packedStride) {
+        for (size_t i = 0; i < view.count; ++i) {
+            __m128 lanes = _mm_cvtepi32_ps(LoadIntegerLanes<T>(view.data + i * view.stride, copied));
+            StorePartial(out + i * outStride, _mm_max_ps(_mm_mul_ps(lanes, scale), minusOne), outComponents);
+        }
+        return;
+    }
+
+    // Packed source: convert it in bulk. A packed output of the same width
+    // takes the floats directly; otherwise a chunk at a time is spread out.
+    if (copied == view.components && copied == outComponents && outStride == outComponents * sizeof(float)) {
+        ConvertPacked<T>(view.data, view.count * view.components, reinterpret_cast<float *>(out), scale, minusOne);
+        return;
+    }
+    const size_t chunk = 64;
+    float converted[chunk * 4 + 4] = {}; // room for a full load at the last element
+    for (size_t first = 0; first < view.count; first += chunk) {
+        size_t elements = std::min(chunk, view.count - first);
+        ConvertPacked<T>(view.data + first * packedStride, elements * view.components, converted, scale, minusOne);
+        for (size_t i = 0; i < elements; ++i) {
+            __m128 lanes = KeepLanes(_mm_loadu_ps(converted + i * view.components), copied);
+            StorePartial(out + (first + i) * outStride, lanes, outComponents);
+        }
+    }
+}
+
+// Floats need no conversion, only a masked copy per element. A full
+// 16-byte load is used while it stays inside the accessor's bytes.
+void ReadFloatSSE(const AccessorView &view, unsigned char *out, size_t outStride, int outComponents) {
+    const int copied = std::min(view.components, outComponents);
+    if (view.components == outComponents && view.stride == outStride && outStride == outComponents * sizeof(float)) {
+        std::memcpy(out, view.data, view.count * view.stride);
+        return;
+    }
+    const size_t end = view.count > 0 ? (view.count - 1) * view.stride + view.components * sizeof(float) : 0;
+    size_t i = 0;
+    for (; i < view.count && i * view.stride + 16 <= end; ++i) {
+        __m128 lanes = _mm_loadu_ps(reinterpret_cast<const float *>(view.data + i * view.stride));
+        StorePartial(out + i * outStride, KeepLanes(lanes, copied), outComponents);
+    }
+    for (; i < view.count; ++i) {
+        alignas(16) float values[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        std::memcpy(values, view.data + i * view.stride, copied * sizeof(float));
+        StorePartial(out + i * outStride, _mm_load_ps(values), outComponents);
+    }
+}
+#endif
+
+} // namespace
+
+void ReadAccessorFloats(const AccessorView &view, void *out, size_t outStride, int outComponents) {
+    unsigned char *dst = static_cast<unsigned char *>(out);
+    if (view.sparseCount) {
+        AccessorView dense = view;
+        dense.sparseCount = 0;
+        ReadAccessorFloats(dense, out, outStride, outComponents);
+        std::vector<unsigned int> targets(view.sparseCount);
+        ReadAccessorIndices(SparseIndexView(view), targets.data());
+        std::vector<float> values(view.sparseCount * outComponents);
+        ReadAccessorFloats(SparseValueView(view), values.data(), outComponents * sizeof(float), outComponents);
+        for (size_t i = 0; i < view.sparseCount; ++i) {
+            if (targets[i] < view.count) {
+                std::memcpy(dst + targets[i] * outStride, &values[i * outComponents], outComponents * sizeof(float));
+            }
+        }
+        return;
+    }
+    if (!view.data) {
+        for (size_t i = 0; i < view.count; ++i) {
+            std::memset(dst + i * outStride, 0, outComponents * sizeof(float));
+        }
+        return;
+    }
+
+    switch (view.componentType) {
+#ifdef TCITY_ACCESSOR_SSE2
+    case TINYGLTF_COMPONENT_TYPE_FLOAT: ReadFloatSSE(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_BYTE: ReadIntegerSSE<int8_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: ReadIntegerSSE<uint8_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_SHORT: ReadIntegerSSE<int16_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: ReadIntegerSSE<uint16_t>(view, dst, outStride, outComponents); break;
+#else
+    case TINYGLTF_COMPONENT_TYPE_FLOAT: ReadScalar<float>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_BYTE: ReadScalar<int8_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: ReadScalar<uint8_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_SHORT: ReadScalar<int16_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: ReadScalar<uint16_t>(view, dst, outStride, outComponents); break;
+#endif
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: ReadScalar<uint32_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_INT: ReadScalar<int32_t>(view, dst, outStride, outComponents); break;
+    case TINYGLTF_COMPONENT_TYPE_DOUBLE: ReadScalar<double>(view, dst, outStride, outComponents); break;
+    default:
+        std::cerr << "Unsupported accessor component type " << view.componentType << ".\n";
+        break;
+    }
+}
+
+void ReadAccessorIndices(const AccessorView &view, unsigned int *out) {
+    if (view.sparseCount) {
+        AccessorView dense = view;
+        dense.sparseCount = 0;
+        ReadAccessorIndices(dense, out);
+        std::vector<unsigned int> targets(view.sparseCount);
+        std::vector<unsigned int> values(view.sparseCount);
+        ReadAccessorIndices(SparseIndexView(view), targets.data());
+        ReadAccessorIndices(SparseValueView(view), values.data());
+        for (size_t i = 0; i < view.sparseCount; ++i) {
+            if (targets[i] < view.count) {
+                out[targets[i]] = values[i];
+            }
+        }
+        return;
+    }
+    if (!view.data) {
+        std::fill(out, out + view.count, 0u);
+        return;
+    }
+
+    size_t i = 0;
+    switch (view.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+#ifdef TCITY_ACCESSOR_SSE2
+        if (view.stride == 1) {
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 16 <= view.count; i += 16) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(view.data + i));
+                __m128i low = _mm_unpacklo_epi8(bytes, zero);
+                __m128i high = _mm_unpackhi_epi8(bytes, zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_unpacklo_epi16(low, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 4), _mm_unpackhi_epi16(low, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 8), _mm_unpacklo_epi16(high, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 12), _mm_unpackhi_epi16(high, zero));
+            }
+        }
+#endif
+        for (; i < view.count; ++i) {
+            out[i] = view.data[i * view.stride];
+        }
+        break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+#ifdef TCITY_ACCESSOR_SSE2
+        if (view.stride == 2) {
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 8 <= view.count; i += 8) {
+                __m128i shorts = _mm_loadu_si128(reinterpret_cast<const __m128i *>(view.data + i * 2));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_unpacklo_epi16(shorts, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 4), _mm_unpackhi_epi16(shorts, zero));
+            }
+        }
+#endif
+        for (; i < view.count; ++i) {
+            out[i] = LoadComponent<uint16_t>(view.data + i * view.stride);
+        }
+        break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+        if (view.stride == 4) {
+            std::memcpy(out, view.data, view.count * 4);
+            break;
+        }
+        for (; i < view.count; ++i) {
+            out[i] = LoadComponent<uint32_t>(view.data + i * view.stride);
+        }
+        break;
+    default:
+        std::cerr << "Unsupported index component type " << view.componentType << ".\n";
+        std::fill(out, out + view.count, 0u);
+        break;
+    }
+}
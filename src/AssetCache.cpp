@@ -0,0 +1,37 @@
+#include "AssetCache.h"
+#include <sys/stat.h>
+
+static std::time_t GetLastWriteTime(const std::string &path) {
+    struct stat fileInfo;
+    if (stat(path.c_str(), &fileInfo) == 0) {
+        return fileInfo.st_mtime;
+    }
+    return 0;
+}
+
+ModelHandle AssetCache::get(const std::string &path, GLTFLoadMode mode, GeometryRetention retention) {
+    std::time_t lastWriteTime = GetLastWriteTime(path);
+
+    auto it = entries.find(path);
+    if (it != entries.end() && it->second.lastWriteTime == lastWriteTime && it->second.retention >= retention) {
+        if (auto load = it->second.load.lock()) {
+            if (load->state != LoadState::Failed) {
+                return ModelHandle(std::move(load));
+            }
+        }
+    }
+
+    ModelHandle handle = loader.load(path, mode, retention);
+    entries[path] = {lastWriteTime, retention, handle.weak()};
+    return handle;
+}
+
+void AssetCache::prune() {
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.load.expired()) {
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,174 @@
+#include "AsyncLoader.h"
+#include <chrono>
+#include <iostream>
+
+LoadedModel::~LoadedModel() {
+    for (auto &mesh : meshes) {
+        ReleaseMesh(mesh);
+    }
+}
+
+AsyncLoader::AsyncLoader(unsigned workerCount) {
+    if (workerCount == 0) {
+        unsigned hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+    for (unsigned i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&AsyncLoader::workerLoop, this);
+    }
+}
+
+AsyncLoader::~AsyncLoader() {
+    stopWorkers();
+}
+
+void AsyncLoader::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void AsyncLoader::shutdown() {
+    stopWorkers();
+    std::deque<std::shared_ptr<ModelLoad>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        dropped.swap(jobs);
+    }
+    {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        dropped.insert(dropped.end(), uploads.begin(), uploads.end());
+        uploads.clear();
+    }
+    // Handles may outlive the loader, so the GL objects go now rather than
+    // with the last handle.
+    for (auto &request : dropped) {
+        for (auto &mesh : request->model.meshes) {
+            ReleaseMesh(mesh);
+        }
+        request->model.meshes.clear();
+        request->data = ModelData();
+        request->state = LoadState::Failed;
+    }
+}
+
+ModelHandle AsyncLoader::load(const std::string &path, GLTFLoadMode mode, GeometryRetention retention) {
+    auto request = std::make_shared<ModelLoad>();
+    request->path = path;
+    request->mode = mode;
+    request->retention = retention;
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (stopping) {
+            request->state = LoadState::Failed;
+            return ModelHandle(request);
+        }
+        jobs.push_back(request);
+    }
+    jobAvailable.notify_one();
+    return ModelHandle(request);
+}
+
+void AsyncLoader::workerLoop() {
+    for (;;) {
+        std::shared_ptr<ModelLoad> request;
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            request = std::move(jobs.front());
+            jobs.pop_front();
+            ++activeJobs;
+        }
+
+        request->state = LoadState::Decoding;
+        if (LoadModelData(request->data, request->path, request->mode)) {
+            request->state = LoadState::Uploading;
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            uploads.push_back(request);
+        } else {
+            std::cerr << "Async load failed: " << request->path << std::endl;
+            request->state = LoadState::Failed;
+        }
+
+        std::lock_guard<std::mutex> lock(jobMutex);
+        --activeJobs;
+    }
+}
+
+size_t AsyncLoader::processUploads(double budgetSeconds) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    size_t uploaded = 0;
+
+    for (;;) {
+        std::shared_ptr<ModelLoad> request;
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            if (uploads.empty()) {
+                break;
+            }
+            request = uploads.front();
+        }
+
+        ModelData &data = request->data;
+        while (request->nextMesh < data.meshes.size()) {
+            if (uploaded > 0 && std::chrono::duration<double>(Clock::now() - start).count() >= budgetSeconds) {
+                return uploaded;
+            }
+            request->model.meshes.push_back(UploadMesh(std::move(data.meshes[request->nextMesh++]), request->retention, geometryPool));
+            ++uploaded;
+        }
+
+        LoadedModel &model = request->model;
+        for (size_t i = 0; i < model.meshes.size(); ++i) {
+            model.boundsMin = i ? glm::min(model.boundsMin, model.meshes[i].boundsMin) : model.meshes[i].boundsMin;
+            model.boundsMax = i ? glm::max(model.boundsMax, model.meshes[i].boundsMax) : model.meshes[i].boundsMax;
+        }
+        request->model.animations = std::move(data.animations);
+        request->model.materials = std::move(data.materials);
+        request->model.lights = std::move(data.lights);
+        if (importReports) {
+            printReport(*request);
+        }
+        // Releases the parsed glTF and, for mapped loads, the file mapping.
+        request->data = ModelData();
+        request->state = LoadState::Ready;
+
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        uploads.pop_front();
+    }
+    return uploaded;
+}
+
+void AsyncLoader::printReport(const ModelLoad &load) const {
+    const ImportReport &report = load.data.report;
+    size_t pooled = 0;
+    for (const Mesh &mesh : load.model.meshes) {
+        pooled += mesh.slot != nullptr;
+    }
+    std::cout << "Imported " << load.path << (report.fromCache ? " from its mesh cache" : "") << ": " << load.model.meshes.size()
+              << " meshes (" << pooled << " pooled), " << report.triangles << " triangles";
+    if (report.lodMeshes > 0) {
+        std::cout << ", LODs on " << report.lodMeshes << " meshes down to " << report.lodTriangles << " triangles";
+    }
+    if (!report.fromCache) {
+        std::cout << ", ACMR " << report.before.acmr << " -> " << report.after.acmr << ", overdraw " << report.before.overdraw << " -> "
+                  << report.after.overdraw << (report.cacheWritten ? ", cache written" : "");
+    }
+    std::cout << std::endl;
+}
+
+bool AsyncLoader::idle() {
+    std::lock_guard<std::mutex> jobLock(jobMutex);
+    std::lock_guard<std::mutex> uploadLock(uploadMutex);
+    return jobs.empty() && activeJobs == 0 && uploads.empty();
+}
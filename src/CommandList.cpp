@@ -0,0 +1,135 @@
+#include "CommandList.h"
+#include <algorithm>
+#include <cstring>
+
+void CommandList::reset() {
+    for (size_t i = 0; i < activeBatches; ++i) {
+        batches[i].instances.clear();
+    }
+    activeBatches = 0;
+    batchIndex.clear();
+}
+
+void CommandList::drawModel(const LoadedModel &model, const glm::mat4 &modelMatrix, const glm::vec4 &color, const LodSelector &lods,
+                            const Frustum *frustum) {
+    bool cullMeshes = frustum && model.meshes.size() > 1;
+    for (size_t mesh = 0; mesh < model.meshes.size(); ++mesh) {
+        if (cullMeshes) {
+            glm::vec3 worldMin, worldMax;
+            TransformBounds(modelMatrix, model.meshes[mesh].boundsMin, model.meshes[mesh].boundsMax, worldMin, worldMax);
+            if (!frustum->intersects(worldMin, worldMax)) {
+                continue;
+            }
+        }
+        InstanceBatchKey key = {&model, mesh, lods.select(model.meshes[mesh], modelMatrix)};
+        auto inserted = batchIndex.emplace(key, activeBatches);
+        if (inserted.second) {
+            if (activeBatches == batches.size()) {
+                batches.emplace_back();
+            }
+            batches[activeBatches++].key = key;
+        }
+        Batch &batch = batches[inserted.first->second];
+        float depth = glm::length(glm::vec3(modelMatrix[3]) - lods.cameraPosition);
+        batch.nearestDepth = inserted.second ? depth : std::min(batch.nearestDepth, depth);
+        batch.instances.push_back({modelMatrix, color});
+    }
+}
+
+bool SharesInstance(const InstanceBatchKey &a, const std::vector<InstanceData> &aInstances, const InstanceBatchKey &b,
+                    const std::vector<InstanceData> &bInstances) {
+    return a.model == b.model && aInstances.size() == 1 && bInstances.size() == 1 &&
+           std::memcmp(&aInstances[0], &bInstances[0], sizeof(InstanceData)) == 0;
+}
+
+CommandRecorder::CommandRecorder(unsigned workerCount) {
+    if (workerCount == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        workerCount = hardware > 1 ? hardware - 1 : 0u;
+    }
+    for (unsigned i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&CommandRecorder::workerLoop, this);
+    }
+}
+
+CommandRecorder::~CommandRecorder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startWork.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+// A few chunks per thread, so one slow chunk doesn't hold up the rest.
+size_t CommandRecorder::chunkCount(size_t count, size_t minChunk) const {
+    size_t byThreads = (workers.size() + 1) * 4;
+    size_t bySize = (count + std::max<size_t>(minChunk, 1) - 1) / std::max<size_t>(minChunk, 1);
+    return std::max<size_t>(1, std::min(byThreads, bySize));
+}
+
+void CommandRecorder::record(size_t count, size_t minChunk, const RecordFunction &recordChunk) {
+    size_t chunks = chunkCount(count, minChunk);
+    if (commandLists.size() < chunks) {
+        commandLists.resize(chunks);
+    }
+    for (size_t i = 0; i < activeLists; ++i) {
+        commandLists[i].reset();
+    }
+    activeLists = chunks;
+    run(count, chunks, [&](size_t chunk, size_t begin, size_t end) { recordChunk(commandLists[chunk], begin, end); });
+}
+
+void CommandRecorder::parallelFor(size_t count, size_t minChunk, const ChunkFunction &function) {
+    run(count, chunkCount(count, minChunk), [&](size_t, size_t begin, size_t end) { function(begin, end); });
+}
+
+void CommandRecorder::run(size_t count, size_t chunks, const Job &function) {
+    if (count == 0) {
+        return;
+    }
+    job = &function;
+    jobCount = count;
+    jobChunks = chunks;
+    nextChunk.store(0);
+    if (chunks == 1 || workers.empty()) {
+        runChunks();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+        pending = static_cast<unsigned>(workers.size());
+    }
+    startWork.notify_all();
+    runChunks();
+    std::unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this] { return pending == 0; });
+}
+
+void CommandRecorder::runChunks() {
+    for (size_t chunk = nextChunk++; chunk < jobChunks; chunk = nextChunk++) {
+        (*job)(chunk, chunk * jobCount / jobChunks, (chunk + 1) * jobCount / jobChunks);
+    }
+}
+
+void CommandRecorder::workerLoop() {
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startWork.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        runChunks();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+            workDone.notify_one();
+        }
+    }
+}
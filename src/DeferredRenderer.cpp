@@ -0,0 +1,292 @@
+#include "DeferredRenderer.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <utility>
+#include "GLStateCache.h"
+
+namespace {
+
+const GLuint VolumePositionLocation = 0;
+const GLuint VolumePositionRangeLocation = 1;
+const GLuint VolumeColorIntensityLocation = 2;
+
+// Icosahedron subdivided once (42 vertices, 80 triangles), scaled out so its
+// flat faces still enclose the unit sphere.
+void BuildVolumeSphere(std::vector<glm::vec3> &vertices, std::vector<uint16_t> &indices) {
+    const float t = 1.618034f;
+    vertices = {{-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0}, {0, -1, t}, {0, 1, t},
+                {0, -1, -t}, {0, 1, -t}, {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+    indices = {0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+               3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1};
+    for (glm::vec3 &vertex : vertices) {
+        vertex = glm::normalize(vertex);
+    }
+
+    std::map<std::pair<uint16_t, uint16_t>, uint16_t> midpoints;
+    auto midpoint = [&](uint16_t a, uint16_t b) {
+        auto key = std::make_pair(std::min(a, b), std::max(a, b));
+        auto found = midpoints.find(key);
+        if (found != midpoints.end()) {
+            return found->second;
+        }
+        vertices.push_back(glm::normalize(vertices[a] + vertices[b]));
+        uint16_t index = static_cast<uint16_t>(vertices.size() - 1);
+        midpoints.emplace(key, index);
+        return index;
+    };
+    std::vector<uint16_t> subdivided;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        uint16_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        uint16_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+        subdivided.insert(subdivided.end(), {a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+    }
+    indices.swap(subdivided);
+
+    float inradius = 1.0f;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        const glm::vec3 &a = vertices[indices[i]], &b = vertices[indices[i + 1]], &c = vertices[indices[i + 2]];
+        inradius = std::min(inradius, std::abs(glm::dot(glm::normalize(glm::cross(b - a, c - a)), a)));
+    }
+    for (glm::vec3 &vertex : vertices) {
+        vertex /= inradius;
+    }
+}
+
+GLuint CreateTarget(GLuint unit, GLenum internalFormat, GLenum format, GLenum type, int width, int height) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    GLStateCache::get().bindTexture(unit, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+bool FramebufferComplete(const char *name) {
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "ERROR::DEFERRED::" << name << "_INCOMPLETE: 0x" << std::hex << status << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+DeferredRenderer::DeferredRenderer(const std::string &shaderDirectory)
+    : gbufferShader((shaderDirectory + "vertex_shader.glsl").c_str(), (shaderDirectory + "gbuffer_fragment.glsl").c_str()),
+      lightsShader((shaderDirectory + "fullscreen_vertex.glsl").c_str(), (shaderDirectory + "deferred_lights_fragment.glsl").c_str()),
+      volumeShader((shaderDirectory + "light_volume_vertex.glsl").c_str(), (shaderDirectory + "light_volume_fragment.glsl").c_str()) {
+    backgroundUniform = lightsShader.uniform<glm::vec3>("background");
+}
+
+DeferredRenderer::~DeferredRenderer() {
+    release();
+}
+
+bool DeferredRenderer::resize(int newWidth, int newHeight) {
+    // A size the driver rejected is not retried until it changes.
+    if (newWidth == width && newHeight == height) {
+        return gbuffer != 0;
+    }
+    releaseTargets();
+    width = newWidth;
+    height = newHeight;
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    albedoTexture = CreateTarget(GBufferAlbedoUnit, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+    normalTexture = CreateTarget(GBufferNormalUnit, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, width, height);
+    depthTexture = CreateTarget(GBufferDepthUnit, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+    lightTexture = CreateTarget(GBufferAlbedoUnit, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, width, height);
+    GLStateCache::get().bindTexture(GBufferAlbedoUnit, GL_TEXTURE_2D, albedoTexture);
+
+    glGenFramebuffers(1, &gbuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    const GLenum attachments[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, attachments);
+    bool complete = FramebufferComplete("GBUFFER");
+
+    // The light pass samples the G-buffer depth while testing against it, so
+    // it tests a copy instead: a texture can't be read and attached at once.
+    glGenRenderbuffers(1, &lightDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, lightDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glGenFramebuffers(1, &lightBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, lightBuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, lightDepth);
+    complete = FramebufferComplete("LIGHT_BUFFER") && complete;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!complete) {
+        releaseTargets();
+    }
+    return complete;
+}
+
+void DeferredRenderer::createVolumeMesh() {
+    std::vector<glm::vec3> vertices;
+    std::vector<uint16_t> indices;
+    BuildVolumeSphere(vertices, indices);
+    volumeIndexCount = static_cast<GLsizei>(indices.size());
+
+    glGenVertexArrays(1, &emptyVao);
+    glGenVertexArrays(1, &volumeVao);
+    glGenBuffers(1, &volumeVertices);
+    glGenBuffers(1, &volumeIndices);
+
+    GLStateCache &state = GLStateCache::get();
+    state.bindVertexArray(volumeVao);
+    state.bindBuffer(GL_ARRAY_BUFFER, volumeVertices);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(VolumePositionLocation, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(VolumePositionLocation);
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, volumeIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+
+    // The instance attributes point into the stream buffer, per frame.
+    glVertexAttribDivisor(VolumePositionRangeLocation, 1);
+    glVertexAttribDivisor(VolumeColorIntensityLocation, 1);
+    glEnableVertexAttribArray(VolumePositionRangeLocation);
+    glEnableVertexAttribArray(VolumeColorIntensityLocation);
+}
+
+void DeferredRenderer::beginGeometry() {
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer);
+    GLStateCache::get().depthMask(GL_TRUE);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredRenderer::light(StreamBuffer &stream, const std::vector<Light> &unbounded, const std::vector<Light> &ranged, const Frustum &frustum,
+                             const glm::vec3 &background) {
+    if (!volumeVao) {
+        createVolumeMesh();
+    }
+    GLStateCache &state = GLStateCache::get();
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, lightBuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, lightBuffer);
+
+    state.bindTexture(GBufferAlbedoUnit, GL_TEXTURE_2D, albedoTexture);
+    state.bindTexture(GBufferNormalUnit, GL_TEXTURE_2D, normalTexture);
+    state.bindTexture(GBufferDepthUnit, GL_TEXTURE_2D, depthTexture);
+
+    // Writes every pixel, so the light buffer needs no clear.
+    LightBlockUniforms block = PackLightBlock(unbounded);
+    lightBlock.upload(&block, sizeof(block));
+    lightBlock.bind(LightBlockBinding, 0, sizeof(block));
+    state.setCapability(GL_DEPTH_TEST, false);
+    lightsShader.use();
+    lightsShader.set(backgroundUniform, background);
+    state.bindVertexArray(emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    drawLightVolumes(stream, ranged, frustum);
+    state.setCapability(GL_DEPTH_TEST, true);
+}
+
+// Back faces that lie behind the scene surface mark the pixels a volume can
+// reach, wherever the camera is; depth clamping keeps volumes that cross the
+// far plane.
+void DeferredRenderer::drawLightVolumes(StreamBuffer &stream, const std::vector<Light> &ranged, const Frustum &frustum) {
+    frameStats = DeferredStats();
+    volumeData.clear();
+    for (const Light &light : ranged) {
+        glm::vec3 extent(light.range);
+        if (!frustum.intersects(light.position - extent, light.position + extent)) {
+            ++frameStats.culledVolumes;
+            continue;
+        }
+        volumeData.push_back(glm::vec4(light.position, light.range));
+        volumeData.push_back(glm::vec4(light.color, light.intensity));
+    }
+    frameStats.lightVolumes = volumeData.size() / 2;
+    if (volumeData.empty()) {
+        return;
+    }
+
+    size_t bytes = volumeData.size() * sizeof(glm::vec4);
+    StreamAllocation allocation = stream.allocate(bytes, alignof(glm::vec4));
+    if (!allocation.data) {
+        return;
+    }
+    std::memcpy(allocation.data, volumeData.data(), bytes);
+    stream.flush();
+
+    GLStateCache &state = GLStateCache::get();
+    state.bindVertexArray(volumeVao);
+    state.bindBuffer(GL_ARRAY_BUFFER, allocation.buffer);
+    glVertexAttribPointer(VolumePositionRangeLocation, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)allocation.offset);
+    glVertexAttribPointer(VolumeColorIntensityLocation, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4),
+                          (void*)(allocation.offset + sizeof(glm::vec4)));
+
+    state.setCapability(GL_DEPTH_TEST, true);
+    state.depthFunc(GL_GEQUAL);
+    state.depthMask(GL_FALSE);
+    state.setCapability(GL_CULL_FACE, true);
+    state.cullFace(GL_FRONT);
+    state.setCapability(GL_BLEND, true);
+    state.blendFunc(GL_ONE, GL_ONE);
+    state.setCapability(GL_DEPTH_CLAMP, true);
+
+    volumeShader.use();
+    state.bindVertexArray(volumeVao);
+    glDrawElementsInstanced(GL_TRIANGLES, volumeIndexCount, GL_UNSIGNED_SHORT, nullptr, static_cast<GLsizei>(frameStats.lightVolumes));
+
+    state.setCapability(GL_DEPTH_CLAMP, false);
+    state.setCapability(GL_BLEND, false);
+    state.cullFace(GL_BACK);
+    state.setCapability(GL_CULL_FACE, false);
+    state.depthMask(GL_TRUE);
+    state.depthFunc(GL_LESS);
+}
+
+void DeferredRenderer::present() {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, lightBuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DeferredRenderer::reloadShadersIfModified() {
+    gbufferShader.reloadIfModified();
+    lightsShader.reloadIfModified();
+    volumeShader.reloadIfModified();
+}
+
+void DeferredRenderer::releaseTargets() {
+    if (gbuffer) {
+        glDeleteFramebuffers(1, &gbuffer);
+        glDeleteFramebuffers(1, &lightBuffer);
+        glDeleteRenderbuffers(1, &lightDepth);
+        GLuint textures[4] = {albedoTexture, normalTexture, depthTexture, lightTexture};
+        GLStateCache::get().deleteTextures(4, textures);
+        gbuffer = lightBuffer = lightDepth = 0;
+        albedoTexture = normalTexture = depthTexture = lightTexture = 0;
+    }
+}
+
+void DeferredRenderer::release() {
+    releaseTargets();
+    width = height = 0;
+    if (volumeVao) {
+        GLuint vaos[2] = {emptyVao, volumeVao};
+        GLuint buffers[2] = {volumeVertices, volumeIndices};
+        GLStateCache::get().deleteVertexArrays(2, vaos);
+        GLStateCache::get().deleteBuffers(2, buffers);
+        emptyVao = volumeVao = volumeVertices = volumeIndices = 0;
+    }
+    lightBlock.release();
+}
@@ -0,0 +1,151 @@
+#include "FrustumCuller.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TCITY_CULL_SSE2 1
+#endif
+
+Frustum Frustum::FromMatrix(const glm::mat4 &viewProjection) {
+    // glm is column-major: row i is (m[0][i], m[1][i], m[2][i], m[3][i]).
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0]; // left
+    frustum.planes[1] = rows[3] - rows[0]; // right
+    frustum.planes[2] = rows[3] + rows[1]; // bottom
+    frustum.planes[3] = rows[3] - rows[1]; // top
+    frustum.planes[4] = rows[3] + rows[2]; // near (GL clip space, -w <= z)
+    frustum.planes[5] = rows[3] - rows[2]; // far
+    for (glm::vec4 &plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+bool Frustum::intersects(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const {
+    glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+    glm::vec3 extent = 0.5f * (boundsMax - boundsMin);
+    for (const glm::vec4 &plane : planes) {
+        glm::vec3 normal(plane);
+        if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extent) < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Arvo: the new half extents are the old ones through the absolute rotation/scale.
+void TransformBounds(const glm::mat4 &modelMatrix, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+                     glm::vec3 &worldMin, glm::vec3 &worldMax) {
+    glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(0.5f * (boundsMin + boundsMax), 1.0f));
+    glm::vec3 extent = 0.5f * (boundsMax - boundsMin);
+    glm::vec3 worldExtent = glm::abs(glm::vec3(modelMatrix[0])) * extent.x +
+                            glm::abs(glm::vec3(modelMatrix[1])) * extent.y +
+                            glm::abs(glm::vec3(modelMatrix[2])) * extent.z;
+    worldMin = center - worldExtent;
+    worldMax = center + worldExtent;
+}
+
+void FrustumCuller::clear() {
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+    ids.clear();
+    count = 0;
+}
+
+void FrustumCuller::add(const glm::vec3 &worldMin, const glm::vec3 &worldMax, uint32_t id) {
+    glm::vec3 center = 0.5f * (worldMin + worldMax);
+    glm::vec3 extent = 0.5f * (worldMax - worldMin);
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    extentX.push_back(extent.x);
+    extentY.push_back(extent.y);
+    extentZ.push_back(extent.z);
+    ids.push_back(id);
+    ++count;
+}
+
+void FrustumCuller::cull(const Frustum &frustum, std::vector<uint32_t> &visible) {
+    size_t padded = (count + 3) & ~size_t(3);
+    for (std::vector<float> *column : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ}) {
+        column->resize(padded, 0.0f);
+    }
+    ids.resize(padded, 0);
+
+    // Written unconditionally and advanced only for visible boxes, so the
+    // compaction has no data-dependent branches.
+    size_t first = visible.size();
+    visible.resize(first + padded);
+    uint32_t *out = visible.data() + first;
+    size_t visibleCount = 0;
+
+#ifdef TCITY_CULL_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+    for (int p = 0; p < 6; ++p) {
+        planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+        absX[p] = _mm_and_ps(planeX[p], absMask);
+        absY[p] = _mm_and_ps(planeY[p], absMask);
+        absZ[p] = _mm_and_ps(planeZ[p], absMask);
+    }
+
+    for (size_t i = 0; i < padded; i += 4) {
+        __m128 cx = _mm_loadu_ps(&centerX[i]);
+        __m128 cy = _mm_loadu_ps(&centerY[i]);
+        __m128 cz = _mm_loadu_ps(&centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]);
+        __m128 ey = _mm_loadu_ps(&extentY[i]);
+        __m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+        // Signed distance of the center plus the box's projected radius.
+        int mask = 0xF;
+        for (int p = 0; p < 6 && mask; ++p) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], cx), _mm_mul_ps(planeY[p], cy)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], cz), planeW[p]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+            mask &= _mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        for (size_t lane = 0; lane < 4; ++lane) {
+            out[visibleCount] = ids[i + lane];
+            visibleCount += ((mask >> lane) & 1) & (i + lane < count);
+        }
+    }
+#else
+    for (size_t i = 0; i < count; ++i) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; ++p) {
+            const glm::vec4 &plane = frustum.planes[p];
+            float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+            float radius = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+            inside = distance + radius >= 0.0f;
+        }
+        out[visibleCount] = ids[i];
+        visibleCount += inside;
+    }
+#endif
+
+    // Drop the padding so later add() calls stay in step with count; the
+    // capacity stays, so the next cull() pads without reallocating.
+    for (std::vector<float> *column : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ}) {
+        column->resize(count);
+    }
+    ids.resize(count);
+
+    visible.resize(first + visibleCount);
+    lastStats.tested = count;
+    lastStats.visible = visibleCount;
+}
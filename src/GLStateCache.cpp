@@ -0,0 +1,261 @@
+#include "GLStateCache.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const GLenum CachedBufferTargets[] = {GL_ARRAY_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GL_UNIFORM_BUFFER,
+                                      GL_TEXTURE_BUFFER, GL_DRAW_INDIRECT_BUFFER, GL_SHADER_STORAGE_BUFFER, GL_PIXEL_UNPACK_BUFFER};
+
+// Records a skip and returns false when nothing changes.
+bool Changed(bool changed, GLStateCounter &counter) {
+    if (changed) {
+        ++counter.issued;
+    } else {
+        ++counter.skipped;
+    }
+    return changed;
+}
+
+} // namespace
+
+size_t GLStateStats::issued() const {
+    return programs.issued + vertexArrays.issued + buffers.issued + textures.issued + fixedFunction.issued + uniforms.issued;
+}
+
+size_t GLStateStats::skipped() const {
+    return programs.skipped + vertexArrays.skipped + buffers.skipped + textures.skipped + fixedFunction.skipped + uniforms.skipped;
+}
+
+GLStateCache &GLStateCache::get() {
+    static GLStateCache cache;
+    return cache;
+}
+
+void GLStateCache::invalidate() {
+    program = Unknown;
+    vertexArray = Unknown;
+    std::fill(buffers, buffers + BufferTargets, Unknown);
+    std::fill(uniformRanges, uniformRanges + UniformBindings, BufferRange{Unknown, 0, 0});
+    activeUnit = Unknown;
+    std::fill(textures, textures + TextureUnits, Unknown);
+    std::fill(textureTargets, textureTargets + TextureUnits, GLenum(Unknown));
+    capabilities.clear();
+    blendSource = blendDestination = Unknown;
+    depthFunction = Unknown;
+    depthWrite = -1;
+    culledFace = Unknown;
+    uniforms.clear();
+}
+
+void GLStateCache::useProgram(GLuint id) {
+    if (Changed(program != id, counters.programs)) {
+        glUseProgram(id);
+        program = id;
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vao) {
+    if (Changed(vertexArray != vao, counters.vertexArrays)) {
+        glBindVertexArray(vao);
+        vertexArray = vao;
+    }
+}
+
+int GLStateCache::bufferSlot(GLenum target) const {
+    for (GLuint i = 0; i < BufferTargets; ++i) {
+        if (CachedBufferTargets[i] == target) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer) {
+    int slot = bufferSlot(target);
+    if (slot < 0) {
+        ++counters.buffers.issued;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (Changed(buffers[slot] != buffer, counters.buffers)) {
+        glBindBuffer(target, buffer);
+        buffers[slot] = buffer;
+    }
+}
+
+void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    int slot = bufferSlot(target);
+    if (target != GL_UNIFORM_BUFFER || index >= UniformBindings) {
+        ++counters.buffers.issued;
+        glBindBufferRange(target, index, buffer, offset, size);
+        if (slot >= 0) {
+            buffers[slot] = buffer;
+        }
+        return;
+    }
+    BufferRange &bound = uniformRanges[index];
+    if (Changed(bound.buffer != buffer || bound.offset != offset || bound.size != size, counters.buffers)) {
+        glBindBufferRange(target, index, buffer, offset, size);
+        bound = {buffer, offset, size};
+        buffers[slot] = buffer;
+    }
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+    if (unit >= TextureUnits) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        activeUnit = unit;
+        ++counters.textures.issued;
+        return;
+    }
+    if (Changed(textures[unit] != texture || textureTargets[unit] != target, counters.textures)) {
+        if (activeUnit != unit) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        glBindTexture(target, texture);
+        textures[unit] = texture;
+        textureTargets[unit] = target;
+    }
+}
+
+void GLStateCache::setCapability(GLenum capability, bool enabled) {
+    auto it = capabilities.find(capability);
+    if (Changed(it == capabilities.end() || it->second != enabled, counters.fixedFunction)) {
+        if (enabled) {
+            glEnable(capability);
+        } else {
+            glDisable(capability);
+        }
+        capabilities[capability] = enabled;
+    }
+}
+
+void GLStateCache::blendFunc(GLenum source, GLenum destination) {
+    if (Changed(blendSource != source || blendDestination != destination, counters.fixedFunction)) {
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+    }
+}
+
+void GLStateCache::depthFunc(GLenum function) {
+    if (Changed(depthFunction != function, counters.fixedFunction)) {
+        glDepthFunc(function);
+        depthFunction = function;
+    }
+}
+
+void GLStateCache::depthMask(GLboolean enabled) {
+    if (Changed(depthWrite != int(enabled), counters.fixedFunction)) {
+        glDepthMask(enabled);
+        depthWrite = enabled;
+    }
+}
+
+void GLStateCache::cullFace(GLenum face) {
+    if (Changed(culledFace != face, counters.fixedFunction)) {
+        glCullFace(face);
+        culledFace = face;
+    }
+}
+
+bool GLStateCache::uniformChanged(GLuint id, GLint location, const float *value, uint8_t count) {
+    if (location < 0) {
+        ++counters.uniforms.skipped;
+        return false;
+    }
+    uint64_t key = (uint64_t(id) << 32) | uint32_t(location);
+    UniformValue &cached = uniforms[key];
+    bool changed = cached.count != count || std::memcmp(cached.data, value, count * sizeof(float)) != 0;
+    if (Changed(changed, counters.uniforms)) {
+        std::memcpy(cached.data, value, count * sizeof(float));
+        cached.count = count;
+        useProgram(id);
+    }
+    return changed;
+}
+
+void GLStateCache::uniform1i(GLuint id, GLint location, int value) {
+    float bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (uniformChanged(id, location, &bits, 1)) {
+        glUniform1i(location, value);
+    }
+}
+
+void GLStateCache::uniform1f(GLuint id, GLint location, float value) {
+    if (uniformChanged(id, location, &value, 1)) {
+        glUniform1f(location, value);
+    }
+}
+
+void GLStateCache::uniform3fv(GLuint id, GLint location, const float *value) {
+    if (uniformChanged(id, location, value, 3)) {
+        glUniform3fv(location, 1, value);
+    }
+}
+
+void GLStateCache::uniform4fv(GLuint id, GLint location, const float *value) {
+    if (uniformChanged(id, location, value, 4)) {
+        glUniform4fv(location, 1, value);
+    }
+}
+
+void GLStateCache::uniformMatrix4fv(GLuint id, GLint location, const float *value) {
+    if (uniformChanged(id, location, value, 16)) {
+        glUniformMatrix4fv(location, 1, GL_FALSE, value);
+    }
+}
+
+void GLStateCache::deleteProgram(GLuint id) {
+    if (program == id) {
+        program = Unknown;
+    }
+    for (auto it = uniforms.begin(); it != uniforms.end();) {
+        if ((it->first >> 32) == id) {
+            it = uniforms.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    glDeleteProgram(id);
+}
+
+void GLStateCache::deleteVertexArrays(GLsizei count, const GLuint *vaos) {
+    for (GLsizei i = 0; i < count; ++i) {
+        if (vaos[i] == vertexArray) {
+            vertexArray = Unknown;
+        }
+    }
+    glDeleteVertexArrays(count, vaos);
+}
+
+void GLStateCache::deleteBuffers(GLsizei count, const GLuint *ids) {
+    for (GLsizei i = 0; i < count; ++i) {
+        for (GLuint &bound : buffers) {
+            if (bound == ids[i]) {
+                bound = Unknown;
+            }
+        }
+        for (BufferRange &bound : uniformRanges) {
+            if (bound.buffer == ids[i]) {
+                bound.buffer = Unknown;
+            }
+        }
+    }
+    glDeleteBuffers(count, ids);
+}
+
+void GLStateCache::deleteTextures(GLsizei count, const GLuint *ids) {
+    for (GLsizei i = 0; i < count; ++i) {
+        for (GLuint &bound : textures) {
+            if (bound == ids[i]) {
+                bound = Unknown;
+            }
+        }
+    }
+    glDeleteTextures(count, ids);
+}
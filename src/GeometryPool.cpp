@@ -0,0 +1,270 @@
+#include "GeometryPool.h"
+#include "GLStateCache.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+const uint32_t InitialArenaVertices = 1u << 16;
+const uint32_t InitialArenaIndices = 1u << 18;
+
+// A layout can be pooled when every attribute sits inside one shared stride.
+bool InterleavedStride(const MeshData &data, GLsizei &stride) {
+    if (data.attributes.empty()) {
+        return false;
+    }
+    stride = 0;
+    for (const auto &attribute : data.attributes) {
+        GLsizei elementSize = attribute.size * tinygltf::GetComponentSizeInBytes(attribute.type);
+        GLsizei attributeStride = attribute.stride ? attribute.stride : elementSize;
+        if (stride == 0) {
+            stride = attributeStride;
+        }
+        if (attributeStride != stride || attribute.offset + elementSize > static_cast<size_t>(stride)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SameLayout(const GeometryArena &arena, const MeshData &data, GLsizei stride) {
+    if (arena.stride != stride || arena.attributes.size() != data.attributes.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < data.attributes.size(); ++i) {
+        const VertexAttribute &a = arena.attributes[i];
+        const VertexAttribute &b = data.attributes[i];
+        if (a.location != b.location || a.size != b.size || a.type != b.type || a.normalized != b.normalized || a.offset != b.offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+GLuint CreateBuffer(GLenum target, size_t bytes) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    GLStateCache::get().bindBuffer(target, buffer);
+    glBufferData(target, bytes, nullptr, GL_STATIC_DRAW);
+    return buffer;
+}
+
+} // namespace
+
+GeometryPool::~GeometryPool() {
+    release();
+}
+
+void GeometryPool::release() {
+    for (auto &arena : arenas) {
+        GLStateCache::get().deleteVertexArrays(1, &arena->VAO);
+        GLStateCache::get().deleteBuffers(1, &arena->VBO);
+        GLStateCache::get().deleteBuffers(1, &arena->EBO);
+    }
+    arenas.clear();
+}
+
+void GeometryPool::bindArenaLayout(GeometryArena &arena) {
+    GLStateCache::get().bindVertexArray(arena.VAO);
+    GLStateCache::get().bindBuffer(GL_ARRAY_BUFFER, arena.VBO);
+    for (const auto &attribute : arena.attributes) {
+        glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, arena.stride, (void*)attribute.offset);
+        glEnableVertexAttribArray(attribute.location);
+    }
+    GLStateCache::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.EBO);
+    GLStateCache::get().bindVertexArray(0);
+}
+
+GeometryArena *GeometryPool::findArena(const MeshData &data, GLenum indexType) {
+    GLsizei stride = 0;
+    InterleavedStride(data, stride);
+    for (auto &arena : arenas) {
+        if (arena->indexType == indexType && SameLayout(*arena, data, stride)) {
+            return arena.get();
+        }
+    }
+
+    auto arena = std::make_unique<GeometryArena>();
+    arena->attributes = data.attributes;
+    arena->stride = stride;
+    arena->indexType = indexType;
+    uint32_t vertexCapacity = std::max(InitialArenaVertices, static_cast<uint32_t>(data.vertexCount));
+    uint32_t indexCapacity = std::max(InitialArenaIndices, static_cast<uint32_t>(data.indexCount));
+    arena->vertexSpace.reset(vertexCapacity);
+    arena->indexSpace.reset(indexCapacity);
+    glGenVertexArrays(1, &arena->VAO);
+    arena->VBO = CreateBuffer(GL_ARRAY_BUFFER, static_cast<size_t>(vertexCapacity) * stride);
+    arena->EBO = CreateBuffer(GL_COPY_WRITE_BUFFER, static_cast<size_t>(indexCapacity) * IndexTypeSize(indexType));
+    bindArenaLayout(*arena);
+    arenas.push_back(std::move(arena));
+    return arenas.back().get();
+}
+
+// Grows a buffer to newBytes, keeping its first oldBytes.
+static GLuint GrowBuffer(GLuint buffer, size_t oldBytes, size_t newBytes) {
+    GLuint grown = CreateBuffer(GL_COPY_WRITE_BUFFER, newBytes);
+    GLStateCache::get().bindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+    GLStateCache::get().deleteBuffers(1, &buffer);
+    return grown;
+}
+
+bool GeometryPool::reserve(GeometryArena &arena, uint32_t vertexCount, uint32_t indexCount) {
+    bool grown = false;
+    if (arena.vertexSpace.largestFreeRegion() < vertexCount) {
+        uint32_t oldSize = arena.vertexSpace.size();
+        uint32_t newSize = std::max(oldSize * 2, oldSize + vertexCount * 2);
+        arena.VBO = GrowBuffer(arena.VBO, static_cast<size_t>(oldSize) * arena.stride, static_cast<size_t>(newSize) * arena.stride);
+        arena.vertexSpace.grow(newSize);
+        grown = true;
+    }
+    if (arena.indexSpace.largestFreeRegion() < indexCount) {
+        uint32_t oldSize = arena.indexSpace.size();
+        uint32_t newSize = std::max(oldSize * 2, oldSize + indexCount * 2);
+        size_t indexSize = IndexTypeSize(arena.indexType);
+        arena.EBO = GrowBuffer(arena.EBO, oldSize * indexSize, newSize * indexSize);
+        arena.indexSpace.grow(newSize);
+        grown = true;
+    }
+    if (grown) {
+        bindArenaLayout(arena);
+    }
+    return arena.vertexSpace.largestFreeRegion() >= vertexCount && arena.indexSpace.largestFreeRegion() >= indexCount;
+}
+
+GeometrySlot *GeometryPool::upload(const MeshData &data) {
+    GLsizei stride = 0;
+    if (!InterleavedStride(data, stride) || data.vertexCount == 0 || data.indexCount <= 0) {
+        return nullptr;
+    }
+    GLenum indexType = data.indexType == GL_UNSIGNED_BYTE ? GL_UNSIGNED_SHORT : data.indexType;
+    GeometryArena *arena = findArena(data, indexType);
+
+    uint32_t vertexCount = static_cast<uint32_t>(data.vertexCount);
+    uint32_t indexCount = static_cast<uint32_t>(data.indexCount);
+    if (!reserve(*arena, vertexCount, indexCount)) {
+        return nullptr;
+    }
+
+    auto slot = std::make_unique<GeometrySlot>();
+    slot->pool = this;
+    slot->arena = arena;
+    slot->vertices = arena->vertexSpace.allocate(vertexCount);
+    slot->indices = arena->indexSpace.allocate(indexCount);
+    slot->vertexCount = vertexCount;
+    slot->indexCount = indexCount;
+    slot->slotIndex = arena->slots.size();
+
+    // Mapped sources may end right after the last vertex's final attribute.
+    size_t vertexBytes = std::min(data.vertexSourceSize(), static_cast<size_t>(vertexCount) * stride);
+    GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, arena->VBO);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(slot->vertices.offset) * stride, vertexBytes, data.vertexSource());
+
+    GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, arena->EBO);
+    size_t indexOffset = static_cast<size_t>(slot->indices.offset) * IndexTypeSize(indexType);
+    if (indexType != data.indexType) {
+        const uint8_t *narrow = static_cast<const uint8_t*>(data.indexSource());
+        std::vector<uint16_t> widened(narrow, narrow + indexCount);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, widened.size() * sizeof(uint16_t), widened.data());
+    } else {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexCount * IndexTypeSize(indexType), data.indexSource());
+    }
+
+    arena->slots.push_back(std::move(slot));
+    return arena->slots.back().get();
+}
+
+void GeometryPool::free(GeometrySlot *slot) {
+    GeometryArena &arena = *slot->arena;
+    arena.vertexSpace.free(slot->vertices);
+    arena.indexSpace.free(slot->indices);
+    size_t index = slot->slotIndex;
+    if (index + 1 != arena.slots.size()) {
+        arena.slots[index] = std::move(arena.slots.back());
+        arena.slots[index]->slotIndex = index;
+    }
+    arena.slots.pop_back();
+}
+
+// Copies every live range to the front of fresh buffers, in offset order,
+// and rebuilds the allocators to match.
+void GeometryPool::compact(GeometryArena &arena) {
+    std::vector<GeometrySlot*> order;
+    for (auto &slot : arena.slots) {
+        order.push_back(slot.get());
+    }
+
+    size_t vertexCapacity = static_cast<size_t>(arena.vertexSpace.size()) * arena.stride;
+    GLuint packedVertices = CreateBuffer(GL_COPY_WRITE_BUFFER, vertexCapacity);
+    GLStateCache::get().bindBuffer(GL_COPY_READ_BUFFER, arena.VBO);
+    std::sort(order.begin(), order.end(), [](const GeometrySlot *a, const GeometrySlot *b) { return a->vertices.offset < b->vertices.offset; });
+    arena.vertexSpace.reset(arena.vertexSpace.size());
+    for (GeometrySlot *slot : order) {
+        OffsetAllocator::Allocation moved = arena.vertexSpace.allocate(slot->vertexCount);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, static_cast<size_t>(slot->vertices.offset) * arena.stride,
+                            static_cast<size_t>(moved.offset) * arena.stride, static_cast<size_t>(slot->vertexCount) * arena.stride);
+        slot->vertices = moved;
+    }
+    GLStateCache::get().deleteBuffers(1, &arena.VBO);
+    arena.VBO = packedVertices;
+
+    size_t indexSize = IndexTypeSize(arena.indexType);
+    GLuint packedIndices = CreateBuffer(GL_COPY_WRITE_BUFFER, arena.indexSpace.size() * indexSize);
+    GLStateCache::get().bindBuffer(GL_COPY_READ_BUFFER, arena.EBO);
+    std::sort(order.begin(), order.end(), [](const GeometrySlot *a, const GeometrySlot *b) { return a->indices.offset < b->indices.offset; });
+    arena.indexSpace.reset(arena.indexSpace.size());
+    for (GeometrySlot *slot : order) {
+        OffsetAllocator::Allocation moved = arena.indexSpace.allocate(slot->indexCount);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, slot->indices.offset * indexSize, moved.offset * indexSize, slot->indexCount * indexSize);
+        slot->indices = moved;
+    }
+    GLStateCache::get().deleteBuffers(1, &arena.EBO);
+    arena.EBO = packedIndices;
+
+    bindArenaLayout(arena);
+}
+
+size_t GeometryPool::defragment(float fragmentationThreshold) {
+    size_t compacted = 0;
+    for (auto &arena : arenas) {
+        float vertexFragmentation = float(arena->vertexSpace.freeSpace() - arena->vertexSpace.largestFreeRegion()) / float(arena->vertexSpace.size());
+        float indexFragmentation = float(arena->indexSpace.freeSpace() - arena->indexSpace.largestFreeRegion()) / float(arena->indexSpace.size());
+        if (std::max(vertexFragmentation, indexFragmentation) > fragmentationThreshold) {
+            compact(*arena);
+            ++compacted;
+        }
+    }
+    if (compacted) {
+        std::cout << "Defragmented " << compacted << " geometry arena(s).\n";
+    }
+    return compacted;
+}
+
+void MultiDrawList::add(const Mesh &mesh, size_t lod) {
+    add(GetDrawRange(mesh, lod));
+}
+
+void MultiDrawList::add(const DrawRange &range) {
+    for (Run &run : runs) {
+        if (run.VAO == range.VAO && run.indexType == range.indexType) {
+            run.counts.push_back(range.indexCount);
+            run.offsets.push_back(range.indexOffset);
+            run.baseVertices.push_back(range.baseVertex);
+            return;
+        }
+    }
+    runs.push_back({range.VAO, range.indexType, {range.indexCount}, {range.indexOffset}, {range.baseVertex}});
+}
+
+size_t MultiDrawList::submit() {
+    for (const Run &run : runs) {
+        GLStateCache::get().bindVertexArray(run.VAO);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, run.counts.data(), run.indexType, run.offsets.data(),
+                                      static_cast<GLsizei>(run.counts.size()), const_cast<GLint*>(run.baseVertices.data()));
+    }
+    return runs.size();
+}
+
+void MultiDrawList::clear() {
+    runs.clear();
+}
@@ -0,0 +1,247 @@
+#include "GpuScene.h"
+#include <algorithm>
+#include "CommandList.h"
+#include "GLStateCache.h"
+#include "InstanceRenderer.h"
+
+namespace {
+
+const GLuint InstanceStorageBinding = 0;
+const GLuint MeshStorageBinding = 1;
+const GLuint CommandStorageBinding = 2;
+const GLuint VisibleStorageBinding = 3;
+const GLuint CullGroupSize = 64; // local_size_x of the compute shader
+
+// Storage buffer bindings need a non-empty range.
+void BindStorage(GLuint binding, GLuint buffer, size_t bytes) {
+    GLStateCache::get().bindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, 0, GLsizeiptr(std::max<size_t>(bytes, 16)));
+}
+
+} // namespace
+
+bool GpuScene::supported() {
+    return GLAD_GL_VERSION_4_3 && glDispatchCompute && glMultiDrawElementsIndirect;
+}
+
+GpuScene::GpuScene(const std::string &shaderDirectory) : cullShader((shaderDirectory + "gpu_cull_compute.glsl").c_str()) {
+    static const char *planeNames[6] = {"frustumPlanes[0]", "frustumPlanes[1]", "frustumPlanes[2]",
+                                        "frustumPlanes[3]", "frustumPlanes[4]", "frustumPlanes[5]"};
+    for (int i = 0; i < 6; ++i) {
+        planeUniforms[i] = cullShader.uniform<glm::vec4>(planeNames[i]);
+    }
+    cameraUniform = cullShader.uniform<glm::vec3>("cameraPosition");
+    pixelScaleUniform = cullShader.uniform<float>("pixelScale");
+    maxErrorUniform = cullShader.uniform<float>("maxPixelError");
+    countUniform = cullShader.uniform<int>("instanceCount");
+}
+
+GpuScene::~GpuScene() {
+    release();
+}
+
+GpuScene::Handle GpuScene::add(const LoadedModel &model, const glm::mat4 &modelMatrix, const glm::vec4 &color) {
+    Handle handle = static_cast<Handle>(objects.size());
+    uint32_t first = static_cast<uint32_t>(instances.size());
+    for (size_t mesh = 0; mesh < model.meshes.size(); ++mesh) {
+        auto inserted = meshIds.emplace(std::make_pair(&model, mesh), static_cast<uint32_t>(meshes.size()));
+        if (inserted.second) {
+            meshes.push_back({&model, mesh, 0});
+        }
+        ++meshes[inserted.first->second].instanceCount;
+        InstanceRecord record = {};
+        record.model = modelMatrix;
+        record.color = color;
+        record.mesh = inserted.first->second;
+        instances.push_back(record);
+    }
+    objects.push_back({first, static_cast<uint32_t>(instances.size()) - first});
+    dirtyBegin = std::min<size_t>(dirtyBegin, first);
+    dirtyEnd = instances.size();
+    return handle;
+}
+
+void GpuScene::update(Handle handle, const glm::mat4 &modelMatrix) {
+    const ObjectEntry &object = objects[handle];
+    for (uint32_t i = 0; i < object.instanceCount; ++i) {
+        instances[object.firstInstance + i].model = modelMatrix;
+    }
+    if (dirtyBegin >= dirtyEnd) {
+        dirtyBegin = object.firstInstance;
+        dirtyEnd = object.firstInstance + object.instanceCount;
+    } else {
+        dirtyBegin = std::min<size_t>(dirtyBegin, object.firstInstance);
+        dirtyEnd = std::max<size_t>(dirtyEnd, object.firstInstance + object.instanceCount);
+    }
+}
+
+// Rebuilt every frame from the mesh table: pooled geometry moves when an
+// arena grows or is defragmented, and the commands must follow it. Commands
+// are laid out group by group, so each group is one contiguous range, and a
+// mesh's LODs are consecutive with room for all its instances in each.
+void GpuScene::buildCommands() {
+    groups.clear();
+    groupIds.clear();
+    for (uint32_t m = 0; m < meshes.size(); ++m) {
+        const LoadedModel &model = *meshes[m].model;
+        DrawRange range = GetDrawRange(model.meshes[meshes[m].mesh], 0);
+        const Material *material = model.materials.empty() ? nullptr : &model.materials[0];
+        auto inserted = groupIds.emplace(std::make_tuple(range.VAO, range.indexType, material), groups.size());
+        if (inserted.second) {
+            groups.push_back({range.VAO, range.indexType, material, 0, {}, 0, 0});
+        }
+        groups[inserted.first->second].meshes.push_back(m);
+    }
+
+    size_t stride = (sizeof(MaterialUniforms) + UniformBufferAlignment() - 1) / UniformBufferAlignment() * UniformBufferAlignment();
+    meshRecords.resize(meshes.size());
+    commands.clear();
+    materialRecords.clear();
+    visibleCapacity = 0;
+    for (DrawGroup &group : groups) {
+        group.firstCommand = commands.size();
+        if (group.material) {
+            group.materialOffset = materialRecords.size();
+            MaterialUniforms block = PackMaterialBlock(*group.material);
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&block);
+            materialRecords.insert(materialRecords.end(), bytes, bytes + sizeof(block));
+            materialRecords.resize(group.materialOffset + stride);
+        }
+        for (uint32_t m : group.meshes) {
+            const Mesh &mesh = meshes[m].model->meshes[meshes[m].mesh];
+            size_t lodCount = std::min<size_t>(mesh.lods.size(), GpuSceneMaxLods);
+            MeshRecord &record = meshRecords[m];
+            record = MeshRecord();
+            record.boundsMin = glm::vec4(mesh.boundsMin, float(lodCount));
+            record.boundsMax = glm::vec4(mesh.boundsMax, 0.0f);
+            record.firstCommand = static_cast<uint32_t>(commands.size());
+            for (size_t lod = 0; lod < lodCount; ++lod) {
+                record.lodErrors[int(lod)] = mesh.lods[lod].error;
+                DrawRange range = GetDrawRange(mesh, lod);
+                IndirectCommand command;
+                command.count = static_cast<uint32_t>(range.indexCount);
+                command.instanceCount = 0;
+                command.firstIndex = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(range.indexOffset) / IndexTypeSize(range.indexType));
+                command.baseVertex = range.baseVertex;
+                command.baseInstance = static_cast<uint32_t>(visibleCapacity);
+                commands.push_back(command);
+                visibleCapacity += meshes[m].instanceCount;
+            }
+        }
+        group.commandCount = commands.size() - group.firstCommand;
+    }
+}
+
+// Only the instances touched since the last frame go up, unless the buffer
+// has to grow.
+void GpuScene::uploadInstances() {
+    GLStateCache::get().bindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+    if (instances.size() > instanceBufferCapacity) {
+        instanceBufferCapacity = instances.size() + instances.size() / 2;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instanceBufferCapacity * sizeof(InstanceRecord), nullptr, GL_DYNAMIC_DRAW);
+        dirtyBegin = 0;
+        dirtyEnd = instances.size();
+    }
+    if (dirtyBegin < dirtyEnd) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, dirtyBegin * sizeof(InstanceRecord), (dirtyEnd - dirtyBegin) * sizeof(InstanceRecord),
+                        instances.data() + dirtyBegin);
+    }
+    dirtyBegin = instances.size();
+    dirtyEnd = 0;
+}
+
+void GpuScene::prepare(const Frustum &frustum, const LodSelector &lods, const std::vector<Light> &lights) {
+    frameStats = GpuSceneStats();
+    frameStats.objects = objects.size();
+    frameStats.instances = instances.size();
+    frameStats.meshes = meshes.size();
+    if (instances.empty()) {
+        return;
+    }
+    if (!instanceBuffer) {
+        GLuint buffers[4];
+        glGenBuffers(4, buffers);
+        instanceBuffer = buffers[0];
+        meshBuffer = buffers[1];
+        commandBuffer = buffers[2];
+        visibleBuffer = buffers[3];
+    }
+    GLStateCache &state = GLStateCache::get();
+
+    buildCommands();
+    frameStats.commands = commands.size();
+    uploadInstances();
+    state.bindBuffer(GL_SHADER_STORAGE_BUFFER, meshBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, meshRecords.size() * sizeof(MeshRecord), meshRecords.data(), GL_STREAM_DRAW);
+    // Zeroes every instanceCount for the shader to count up.
+    state.bindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(IndirectCommand), commands.data(), GL_STREAM_DRAW);
+    if (visibleCapacity > visibleBufferCapacity) {
+        visibleBufferCapacity = visibleCapacity + visibleCapacity / 2;
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, visibleBufferCapacity * sizeof(InstanceData), nullptr, GL_DYNAMIC_COPY);
+    }
+    if (!materialRecords.empty()) {
+        materialBlock.upload(materialRecords.data(), materialRecords.size());
+    }
+    LightBlockUniforms lightUniforms = PackLightBlock(lights);
+    lightBlock.upload(&lightUniforms, sizeof(lightUniforms));
+
+    BindStorage(InstanceStorageBinding, instanceBuffer, instances.size() * sizeof(InstanceRecord));
+    BindStorage(MeshStorageBinding, meshBuffer, meshRecords.size() * sizeof(MeshRecord));
+    BindStorage(CommandStorageBinding, commandBuffer, commands.size() * sizeof(IndirectCommand));
+    BindStorage(VisibleStorageBinding, visibleBuffer, visibleBufferCapacity * sizeof(InstanceData));
+
+    cullShader.use();
+    for (int i = 0; i < 6; ++i) {
+        cullShader.set(planeUniforms[i], frustum.planes[i]);
+    }
+    cullShader.set(cameraUniform, lods.cameraPosition);
+    cullShader.set(pixelScaleUniform, lods.pixelScale);
+    cullShader.set(maxErrorUniform, lods.maxPixelError);
+    cullShader.set(countUniform, static_cast<int>(instances.size()));
+    glDispatchCompute(GLuint((instances.size() + CullGroupSize - 1) / CullGroupSize), 1, 1);
+    // The draws read the commands and the visible instances written above.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void GpuScene::draw(Shader &shader, RenderPass pass) {
+    if (instances.empty()) {
+        return;
+    }
+    GLStateCache &state = GLStateCache::get();
+    shader.use();
+    UniformHandle<int> instancedUniform = shader.uniform<int>("instanced");
+    shader.set(instancedUniform, 1);
+    lightBlock.bind(LightBlockBinding, 0, sizeof(LightBlockUniforms));
+    state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+    for (const DrawGroup &group : groups) {
+        bool transparent = group.material && group.material->baseColor.a < 1.0f;
+        if (transparent != (pass == RenderPass::Transparent)) {
+            continue;
+        }
+        if (group.material) {
+            materialBlock.bind(MaterialBlockBinding, group.materialOffset, sizeof(MaterialUniforms));
+        }
+        state.bindVertexArray(group.vao);
+        BindInstanceAttributes(visibleBuffer, 0);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, group.indexType, (void*)(group.firstCommand * sizeof(IndirectCommand)),
+                                    static_cast<GLsizei>(group.commandCount), 0);
+        DisableInstanceAttributes();
+        ++frameStats.multiDraws;
+    }
+    shader.set(instancedUniform, 0);
+}
+
+void GpuScene::release() {
+    if (instanceBuffer) {
+        GLuint buffers[4] = {instanceBuffer, meshBuffer, commandBuffer, visibleBuffer};
+        GLStateCache::get().deleteBuffers(4, buffers);
+        instanceBuffer = meshBuffer = commandBuffer = visibleBuffer = 0;
+        instanceBufferCapacity = visibleBufferCapacity = 0;
+        dirtyBegin = 0;
+        dirtyEnd = instances.size();
+    }
+    materialBlock.release();
+    lightBlock.release();
+}
@@ -0,0 +1,49 @@
+#include "GpuTimer.h"
+
+GpuTimer::~GpuTimer() {
+    release();
+}
+
+// Oldest first, so the newest finished query wins.
+void GpuTimer::collect() {
+    for (unsigned i = 0; i < QueryCount; ++i) {
+        unsigned slot = (next + i) % QueryCount;
+        if (!pending[slot]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &nanoseconds);
+        lastMilliseconds = double(nanoseconds) * 1e-6;
+        pending[slot] = false;
+    }
+}
+
+// A slot still pending after a full lap is reused; its result is lost.
+void GpuTimer::begin() {
+    if (!queries[0]) {
+        glGenQueries(QueryCount, queries);
+    }
+    collect();
+    glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+
+void GpuTimer::end() {
+    glEndQuery(GL_TIME_ELAPSED);
+    pending[next] = true;
+    next = (next + 1) % QueryCount;
+}
+
+void GpuTimer::release() {
+    if (queries[0]) {
+        glDeleteQueries(QueryCount, queries);
+        for (unsigned i = 0; i < QueryCount; ++i) {
+            queries[i] = 0;
+            pending[i] = false;
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#include "InstanceRenderer.h"
+#include <algorithm>
+#include "GLStateCache.h"
+
+// GL 3.3 has no base instance, so the offset goes into the attribute
+// pointers instead.
+void BindInstanceAttributes(GLuint buffer, size_t byteOffset) {
+    GLStateCache::get().bindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        GLuint location = InstanceModelLocation + column;
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void*)(byteOffset + offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
+    glVertexAttribPointer(InstanceColorLocation, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(byteOffset + offsetof(InstanceData, color)));
+    glVertexAttribDivisor(InstanceColorLocation, 1);
+    glEnableVertexAttribArray(InstanceColorLocation);
+}
+
+void DisableInstanceAttributes() {
+    for (GLuint location = InstanceModelLocation; location <= InstanceColorLocation; ++location) {
+        glDisableVertexAttribArray(location);
+    }
+}
+
+// Merges batches with the same key across lists, in list order, so the
+// result does not depend on how the items were split into lists.
+void InstanceRenderer::flush(Shader &shader, RenderQueue &queue, const CommandList *lists, size_t listCount, Shader *transparentShader) {
+    mergedBatches.clear();
+    mergedIndex.clear();
+    parts.clear();
+    size_t instanceCount = 0;
+    for (size_t l = 0; l < listCount; ++l) {
+        for (size_t b = 0; b < lists[l].batchCount(); ++b) {
+            const CommandList::Batch &batch = lists[l].batch(b);
+            auto inserted = mergedIndex.emplace(batch.key, mergedBatches.size());
+            if (inserted.second) {
+                mergedBatches.push_back({batch.key, batch.nearestDepth, 0, NoPart});
+            }
+            MergedBatch &merged = mergedBatches[inserted.first->second];
+            merged.nearestDepth = std::min(merged.nearestDepth, batch.nearestDepth);
+            merged.instanceCount += batch.instances.size();
+            parts.push_back({&batch.instances, NoPart});
+            size_t part = parts.size() - 1;
+            if (merged.lastPart != NoPart) {
+                parts[merged.lastPart].next = part;
+            } else {
+                merged.firstPart = part;
+            }
+            merged.lastPart = part;
+            instanceCount += batch.instances.size();
+        }
+    }
+    activeBatches = mergedBatches.size();
+    if (activeBatches == 0) {
+        return;
+    }
+
+    // Written straight into mapped memory; no staging copy.
+    StreamAllocation allocation = queue.streamBuffer().allocate(instanceCount * sizeof(InstanceData), alignof(InstanceData));
+    if (!allocation.data) {
+        return;
+    }
+    InstanceData *instances = static_cast<InstanceData *>(allocation.data);
+
+    size_t first = 0;
+    const MergedBatch *previous = nullptr;
+    size_t previousFirst = 0;
+    for (const MergedBatch &batch : mergedBatches) {
+        // The meshes of a lone object point at one copy of its instance, so
+        // the queue can merge their draws.
+        bool shared = previous && SharesInstance(previous->key, *parts[previous->firstPart].instances, batch.key,
+                                                 *parts[batch.firstPart].instances);
+        size_t offset = shared ? previousFirst : first;
+        if (!shared) {
+            size_t written = first;
+            for (size_t part = batch.firstPart; part != NoPart; part = parts[part].next) {
+                std::copy(parts[part].instances->begin(), parts[part].instances->end(), instances + written);
+                written += parts[part].instances->size();
+            }
+            first += batch.instanceCount;
+        }
+        previous = &batch;
+        previousFirst = offset;
+
+        const LoadedModel &model = *batch.key.model;
+        DrawItem item;
+        item.material = model.materials.empty() ? nullptr : &model.materials[0];
+        item.pass = item.material && item.material->baseColor.a < 1.0f ? RenderPass::Transparent : RenderPass::Opaque;
+        item.shader = item.pass == RenderPass::Transparent && transparentShader ? transparentShader : &shader;
+        item.draw = GetDrawRange(model.meshes[batch.key.mesh], batch.key.lod);
+        item.instanceBuffer = allocation.buffer;
+        item.instanceOffset = allocation.offset + offset * sizeof(InstanceData);
+        item.instanceCount = static_cast<GLsizei>(batch.instanceCount);
+        item.depth = batch.nearestDepth;
+        queue.submit(item);
+    }
+}
@@ -0,0 +1,254 @@
+#include "LightClusters.h"
+#include <algorithm>
+#include <cmath>
+#include "GLStateCache.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TCITY_CLUSTER_SSE2 1
+#endif
+
+static_assert(LightClusters::GridX % 4 == 0, "cluster rows are tested four at a time");
+
+namespace {
+
+const GLenum TexelFormats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+const GLuint TexelUnits[3] = {ClusterLightsUnit, ClusterRangesUnit, ClusterIndicesUnit};
+
+// Orphans and refills in one call; buffer textures can't be empty.
+void UploadTexels(GLuint buffer, const void *data, size_t bytes) {
+    GLStateCache::get().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (bytes == 0) {
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+    } else {
+        glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(bytes), data, GL_STREAM_DRAW);
+    }
+}
+
+} // namespace
+
+LightClusters::~LightClusters() {
+    release();
+}
+
+// The boxes only change with the projection, so they are rebuilt on resize.
+void LightClusters::buildClusterBounds(const glm::mat4 &projection, float nearPlane, float farPlane) {
+    boundsProjection = projection;
+    this->nearPlane = nearPlane;
+    this->farPlane = farPlane;
+    float logRatio = std::log(farPlane / nearPlane);
+    sliceScale = GridZ / logRatio;
+    sliceBias = -GridZ * std::log(nearPlane) / logRatio;
+
+    minX.resize(ClusterCount);
+    maxX.resize(ClusterCount);
+    minY.resize(ClusterCount);
+    maxY.resize(ClusterCount);
+    minZ.resize(ClusterCount);
+    maxZ.resize(ClusterCount);
+    rowMinY.assign(GridY * GridZ, 0.0f);
+    rowMaxY.assign(GridY * GridZ, 0.0f);
+    rowMinZ.assign(GridY * GridZ, 0.0f);
+    rowMaxZ.assign(GridY * GridZ, 0.0f);
+
+    // Tile corners on the near plane; scaling one by depth / -z slides it
+    // along its view ray.
+    glm::mat4 inverse = glm::inverse(projection);
+    auto nearPoint = [&](float x, float y) {
+        glm::vec4 point = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+        return glm::vec3(point) / point.w;
+    };
+
+    for (int k = 0; k < GridZ; ++k) {
+        float depths[2] = {nearPlane * std::pow(farPlane / nearPlane, float(k) / GridZ),
+                           nearPlane * std::pow(farPlane / nearPlane, float(k + 1) / GridZ)};
+        for (int y = 0; y < GridY; ++y) {
+            int row = k * GridY + y;
+            for (int x = 0; x < GridX; ++x) {
+                glm::vec3 lo(1e30f), hi(-1e30f);
+                for (int corner = 0; corner < 4; ++corner) {
+                    float ndcX = -1.0f + 2.0f * float(x + (corner & 1)) / GridX;
+                    float ndcY = -1.0f + 2.0f * float(y + (corner >> 1)) / GridY;
+                    glm::vec3 point = nearPoint(ndcX, ndcY);
+                    for (float depth : depths) {
+                        glm::vec3 scaled = point * (depth / -point.z);
+                        lo = glm::min(lo, scaled);
+                        hi = glm::max(hi, scaled);
+                    }
+                }
+                int cluster = row * GridX + x;
+                minX[cluster] = lo.x;
+                maxX[cluster] = hi.x;
+                minY[cluster] = lo.y;
+                maxY[cluster] = hi.y;
+                minZ[cluster] = lo.z;
+                maxZ[cluster] = hi.z;
+                rowMinY[row] = x ? std::min(rowMinY[row], lo.y) : lo.y;
+                rowMaxY[row] = x ? std::max(rowMaxY[row], hi.y) : hi.y;
+                rowMinZ[row] = x ? std::min(rowMinZ[row], lo.z) : lo.z;
+                rowMaxZ[row] = x ? std::max(rowMaxZ[row], hi.z) : hi.z;
+            }
+        }
+    }
+}
+
+int LightClusters::sliceOf(float depth) const {
+    int slice = int(std::floor(std::log(depth) * sliceScale + sliceBias));
+    return std::min(std::max(slice, 0), GridZ - 1);
+}
+
+// Sphere against box: the squared distance from the center to the box.
+void LightClusters::binLight(const glm::vec3 &center, float radius, uint32_t light) {
+    float nearDepth = -center.z - radius;
+    float farDepth = -center.z + radius;
+    if (farDepth < nearPlane || nearDepth > farPlane) {
+        return;
+    }
+    int firstSlice = sliceOf(std::max(nearDepth, nearPlane));
+    int lastSlice = sliceOf(std::min(farDepth, farPlane));
+    float radiusSq = radius * radius;
+
+#ifdef TCITY_CLUSTER_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 centerX = _mm_set1_ps(center.x);
+    __m128 centerY = _mm_set1_ps(center.y);
+    __m128 centerZ = _mm_set1_ps(center.z);
+    __m128 limit = _mm_set1_ps(radiusSq);
+#endif
+
+    for (int k = firstSlice; k <= lastSlice; ++k) {
+        for (int y = 0; y < GridY; ++y) {
+            int row = k * GridY + y;
+            float dy = std::max(std::max(rowMinY[row] - center.y, center.y - rowMaxY[row]), 0.0f);
+            float dz = std::max(std::max(rowMinZ[row] - center.z, center.z - rowMaxZ[row]), 0.0f);
+            if (dy * dy + dz * dz > radiusSq) {
+                continue;
+            }
+            int base = row * GridX;
+            for (int x = 0; x < GridX; x += 4) {
+                int first = base + x;
+#ifdef TCITY_CLUSTER_SSE2
+                __m128 distX = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[first]), centerX),
+                                                     _mm_sub_ps(centerX, _mm_loadu_ps(&maxX[first]))), zero);
+                __m128 distY = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[first]), centerY),
+                                                     _mm_sub_ps(centerY, _mm_loadu_ps(&maxY[first]))), zero);
+                __m128 distZ = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[first]), centerZ),
+                                                     _mm_sub_ps(centerZ, _mm_loadu_ps(&maxZ[first]))), zero);
+                __m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(distX, distX), _mm_mul_ps(distY, distY)), _mm_mul_ps(distZ, distZ));
+                int mask = _mm_movemask_ps(_mm_cmple_ps(distSq, limit));
+                for (int lane = 0; lane < 4; ++lane) {
+                    if (mask & (1 << lane)) {
+                        references.push_back({uint32_t(first + lane), light});
+                    }
+                }
+#else
+                for (int lane = 0; lane < 4; ++lane) {
+                    int cluster = first + lane;
+                    float distX = std::max(std::max(minX[cluster] - center.x, center.x - maxX[cluster]), 0.0f);
+                    float distY = std::max(std::max(minY[cluster] - center.y, center.y - maxY[cluster]), 0.0f);
+                    float distZ = std::max(std::max(minZ[cluster] - center.z, center.z - maxZ[cluster]), 0.0f);
+                    if (distX * distX + distY * distY + distZ * distZ <= radiusSq) {
+                        references.push_back({uint32_t(cluster), light});
+                    }
+                }
+#endif
+            }
+        }
+    }
+}
+
+void LightClusters::build(const std::vector<Light> &lights, const glm::mat4 &view, const glm::mat4 &projection, float nearPlane,
+                          float farPlane) {
+    if (projection != boundsProjection || nearPlane != this->nearPlane || farPlane != this->farPlane) {
+        buildClusterBounds(projection, nearPlane, farPlane);
+    }
+    if (!maxTexels) {
+        GLint value = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &value);
+        maxTexels = value > 0 ? size_t(value) : 65536;
+    }
+
+    frameStats = LightClusterStats();
+    references.clear();
+    lightTexels.clear();
+    // Lights that touch no cluster are never uploaded.
+    for (const Light &light : lights) {
+        if (light.range <= 0.0f) {
+            continue;
+        }
+        if (lightTexels.size() + 2 > maxTexels) {
+            ++frameStats.dropped;
+            continue;
+        }
+        size_t before = references.size();
+        uint32_t index = uint32_t(lightTexels.size() / 2);
+        binLight(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.range, index);
+        if (references.size() > maxTexels) {
+            references.resize(before);
+            ++frameStats.dropped;
+            continue;
+        }
+        if (references.size() > before) {
+            lightTexels.push_back(glm::vec4(light.position, light.range));
+            lightTexels.push_back(glm::vec4(light.color, light.intensity));
+        }
+    }
+
+    // Counting sort by cluster; lights stay in order within a cluster.
+    clusterRanges.assign(size_t(ClusterCount) * 2, 0);
+    for (const Reference &reference : references) {
+        ++clusterRanges[reference.cluster * 2 + 1];
+    }
+    uint32_t offset = 0;
+    for (int cluster = 0; cluster < ClusterCount; ++cluster) {
+        uint32_t count = clusterRanges[cluster * 2 + 1];
+        clusterRanges[cluster * 2] = offset;
+        offset += count;
+        frameStats.maxPerCluster = std::max<size_t>(frameStats.maxPerCluster, count);
+    }
+    lightIndices.resize(references.size());
+    scratchCursor.resize(ClusterCount);
+    for (int cluster = 0; cluster < ClusterCount; ++cluster) {
+        scratchCursor[cluster] = clusterRanges[cluster * 2];
+    }
+    for (const Reference &reference : references) {
+        lightIndices[scratchCursor[reference.cluster]++] = reference.light;
+    }
+
+    frameStats.lights = lightTexels.size() / 2;
+    frameStats.references = references.size();
+}
+
+void LightClusters::upload() {
+    if (!buffers[0]) {
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (int i = 0; i < 3; ++i) {
+            UploadTexels(buffers[i], nullptr, 0);
+            GLStateCache::get().bindTexture(TexelUnits[i], GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, TexelFormats[i], buffers[i]);
+        }
+    }
+    UploadTexels(buffers[0], lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+    UploadTexels(buffers[1], clusterRanges.data(), clusterRanges.size() * sizeof(uint32_t));
+    UploadTexels(buffers[2], lightIndices.data(), lightIndices.size() * sizeof(uint32_t));
+    for (int i = 0; i < 3; ++i) {
+        GLStateCache::get().bindTexture(TexelUnits[i], GL_TEXTURE_BUFFER, textures[i]);
+    }
+
+    ClusterUniforms block;
+    block.grid = glm::uvec4(GridX, GridY, GridZ, uint32_t(lightTexels.size() / 2));
+    block.depth = glm::vec4(sliceScale, sliceBias, nearPlane, farPlane);
+    clusterBlock.upload(&block, sizeof(block));
+    clusterBlock.bind(ClusterBlockBinding, 0, sizeof(block));
+}
+
+void LightClusters::release() {
+    if (buffers[0]) {
+        GLStateCache::get().deleteTextures(3, textures);
+        GLStateCache::get().deleteBuffers(3, buffers);
+        std::fill(textures, textures + 3, 0u);
+        std::fill(buffers, buffers + 3, 0u);
+    }
+    clusterBlock.release();
+}
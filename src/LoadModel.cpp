@@ -1,14 +1,9 @@
 #include <iostream>
+#include <cstring>
 #include "tiny_gltf.h"
+#include "LoadModel.h"
 
-bool LoadGLTFModel(tinygltf::Model &model, const std::string &filename) {
-    tinygltf::TinyGLTF loader;
-    std::string err;
-    std::string warn;
-
-    std::cout << "Loading GLTF file: " << filename << std::endl;
-    
-    bool res = loader.LoadBinaryFromFile(&model, &err, &warn, filename);
+static bool ReportLoadResult(bool res, const std::string &err, const std::string &warn, const std::string &filename) {
     if (!warn.empty()) {
         std::cout << "Warn: " << warn << std::endl;
     }
@@ -25,3 +20,94 @@ bool LoadGLTFModel(tinygltf::Model &model, const std::string &filename) {
 
     return res;
 }
+
+bool LoadGLTFModel(tinygltf::Model &model, const std::string &filename) {
+    tinygltf::TinyGLTF loader;
+    std::string err;
+    std::string warn;
+
+    std::cout << "Loading GLTF file: " << filename << std::endl;
+    
+    bool res = loader.LoadBinaryFromFile(&model, &err, &warn, filename);
+    return ReportLoadResult(res, err, warn, filename);
+}
+
+const unsigned char *GLTFAsset::bufferData(int buffer) const {
+    if (buffer < 0 || static_cast<size_t>(buffer) >= model.buffers.size()) {
+        return nullptr;
+    }
+    const tinygltf::Buffer &gltfBuffer = model.buffers[buffer];
+    if (!gltfBuffer.data.empty()) {
+        return gltfBuffer.data.data();
+    }
+    // The embedded GLB buffer has no uri; in Mapped mode it lives in the file mapping.
+    if (gltfBuffer.uri.empty()) {
+        return binChunk;
+    }
+    return nullptr;
+}
+
+size_t GLTFAsset::bufferSize(int buffer) const {
+    if (buffer < 0 || static_cast<size_t>(buffer) >= model.buffers.size()) {
+        return 0;
+    }
+    const tinygltf::Buffer &gltfBuffer = model.buffers[buffer];
+    if (!gltfBuffer.data.empty()) {
+        return gltfBuffer.data.size();
+    }
+    return gltfBuffer.uri.empty() ? binChunkSize : 0;
+}
+
+static bool LoadMappedGLB(GLTFAsset &asset, const std::string &filename) {
+    if (!asset.file.open(filename)) {
+        return false;
+    }
+
+    const unsigned char *bytes = asset.file.data();
+    size_t size = asset.file.size();
+    if (size > 0xFFFFFFFFu) {
+        std::cerr << "GLB too large to map: " << filename << std::endl;
+        return false;
+    }
+
+    size_t slash = filename.find_last_of("/\\");
+    std::string baseDir = slash == std::string::npos ? "" : filename.substr(0, slash);
+
+    tinygltf::TinyGLTF loader;
+    loader.SetBinaryChunkAsView(true);
+    std::string err;
+    std::string warn;
+    bool res = loader.LoadBinaryFromMemory(&asset.model, &err, &warn, bytes, static_cast<unsigned int>(size), baseDir);
+    if (!ReportLoadResult(res, err, warn, filename)) {
+        return false;
+    }
+
+    // tinygltf has validated the header and chunk layout; locate the BIN chunk
+    // (12-byte header, 8-byte JSON chunk header, JSON, 8-byte BIN chunk header).
+    uint32_t jsonLength;
+    std::memcpy(&jsonLength, bytes + 12, 4);
+    size_t binHeader = 20 + static_cast<size_t>(jsonLength);
+    if (binHeader + 8 <= size) {
+        uint32_t binLength;
+        std::memcpy(&binLength, bytes + binHeader, 4);
+        if (binLength > 0) {
+            asset.binChunk = bytes + binHeader + 8;
+            asset.binChunkSize = binLength;
+        }
+    }
+    return true;
+}
+
+bool LoadGLTFAsset(GLTFAsset &asset, const std::string &filename, GLTFLoadMode mode) {
+    std::cout << "Loading GLTF file: " << filename << (mode == GLTFLoadMode::Mapped ? " (mapped)" : "") << std::endl;
+
+    if (mode == GLTFLoadMode::Mapped) {
+        return LoadMappedGLB(asset, filename);
+    }
+
+    tinygltf::TinyGLTF loader;
+    std::string err;
+    std::string warn;
+    bool res = loader.LoadBinaryFromFile(&asset.model, &err, &warn, filename);
+    return ReportLoadResult(res, err, warn, filename);
+}
@@ -0,0 +1,60 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <utility>
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : bytes(std::exchange(other.bytes, nullptr)), length(std::exchange(other.length, 0)) {}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        bytes = std::exchange(other.bytes, nullptr);
+        length = std::exchange(other.length, 0);
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::string &path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open file for mapping: " << path << std::endl;
+        return false;
+    }
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0 || fileInfo.st_size <= 0) {
+        std::cerr << "Cannot map empty or unreadable file: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, static_cast<std::size_t>(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "mmap failed for: " << path << std::endl;
+        return false;
+    }
+
+    bytes = static_cast<const unsigned char *>(mapping);
+    length = static_cast<std::size_t>(fileInfo.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) {
+        munmap(const_cast<unsigned char *>(bytes), length);
+        bytes = nullptr;
+        length = 0;
+    }
+}
@@ -0,0 +1,416 @@
+#include "MeshCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <functional>
+#include <thread>
+
+namespace {
+
+const char CacheMagic[4] = {'T', 'C', 'M', 'S'};
+const uint32_t MaxCachedAttributes = 4;
+const uint32_t MaxCachedLods = 4;
+const size_t BlobAlignment = 16;
+const uint32_t CacheMeshOccluder = 1;
+const uint32_t MaxVertexLocation = 2; // locations from 3 on are per-instance
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t meshCount;
+    uint32_t materialCount;
+    uint32_t lightCount;
+    uint32_t animationCount;
+    uint64_t fileSize;
+};
+
+struct CacheAttribute {
+    uint32_t location;
+    uint32_t size;
+    uint32_t type;
+    uint32_t normalized;
+    uint32_t stride;
+    uint32_t offset;
+};
+
+struct CacheLod {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+};
+
+struct CacheMesh {
+    uint64_t vertexOffset;
+    uint64_t vertexSize;
+    uint64_t indexOffset;
+    uint64_t indexSize;
+    uint32_t indexCount;
+    uint32_t indexType;
+    uint32_t attributeCount;
+    uint32_t vertexCount;
+    CacheAttribute attributes[MaxCachedAttributes];
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t lodCount;
+    CacheLod lods[MaxCachedLods];
+    uint32_t flags;
+};
+
+struct CacheMaterial {
+    float baseColor[4];
+    float metallic;
+    float roughness;
+};
+
+struct CacheLight {
+    float position[3];
+    float color[3];
+    float intensity;
+    float range;
+};
+
+struct CacheAnimation {
+    uint64_t timesOffset;
+    uint64_t translationsOffset;
+    uint64_t scalesOffset;
+    uint32_t timeCount;
+    uint32_t translationCount;
+    uint32_t scaleCount;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(CacheHeader) == 40, "tcmesh header layout changed");
+static_assert(sizeof(CacheMesh) == 224, "tcmesh mesh record layout changed");
+static_assert(sizeof(CacheAnimation) == 40, "tcmesh animation record layout changed");
+
+size_t AlignUp(size_t value) {
+    return (value + BlobAlignment - 1) & ~(BlobAlignment - 1);
+}
+
+// Appends raw bytes at the next aligned offset and returns that offset.
+uint64_t AppendBlob(std::vector<unsigned char> &out, const void *bytes, size_t size) {
+    out.resize(AlignUp(out.size()));
+    uint64_t offset = out.size();
+    out.insert(out.end(), static_cast<const unsigned char *>(bytes), static_cast<const unsigned char *>(bytes) + size);
+    return offset;
+}
+
+template <typename T>
+bool ReadRecord(const MappedFile &file, size_t &cursor, T &record) {
+    if (cursor + sizeof(T) > file.size()) {
+        return false;
+    }
+    std::memcpy(&record, file.data() + cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+bool InFile(const MappedFile &file, uint64_t offset, uint64_t size) {
+    return offset <= file.size() && size <= file.size() - offset;
+}
+
+template <typename T>
+bool ReadArray(const MappedFile &file, uint64_t offset, uint32_t count, std::vector<T> &out) {
+    if (!InFile(file, offset, uint64_t(count) * sizeof(T))) {
+        return false;
+    }
+    out.resize(count);
+    std::memcpy(out.data(), file.data() + offset, count * sizeof(T));
+    return true;
+}
+
+uint64_t IndexBytes(uint32_t indexType) {
+    switch (indexType) {
+    case GL_UNSIGNED_BYTE: return 1;
+    case GL_UNSIGNED_SHORT: return 2;
+    case GL_UNSIGNED_INT: return 4;
+    default: return 0;
+    }
+}
+
+uint64_t ComponentBytes(uint32_t type) {
+    switch (type) {
+    case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+    case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return 2;
+    case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+    default: return 0;
+    }
+}
+
+// Everything GL will read through a record must lie inside its blobs: a
+// corrupt or truncated cache would otherwise make draws read past the
+// uploaded buffers.
+bool ValidMeshRecord(const MappedFile &file, const CacheMesh &record) {
+    if (record.attributeCount > MaxCachedAttributes || record.lodCount > MaxCachedLods ||
+        !InFile(file, record.vertexOffset, record.vertexSize) || !InFile(file, record.indexOffset, record.indexSize)) {
+        return false;
+    }
+    uint64_t indexBytes = IndexBytes(record.indexType);
+    if (indexBytes == 0 || uint64_t(record.indexCount) * indexBytes > record.indexSize) {
+        return false;
+    }
+    for (uint32_t i = 0; i < record.attributeCount; ++i) {
+        const CacheAttribute &attribute = record.attributes[i];
+        uint64_t elementBytes = ComponentBytes(attribute.type) * attribute.size;
+        uint64_t stride = attribute.stride ? attribute.stride : elementBytes;
+        if (elementBytes == 0 || attribute.size > 4 || attribute.location > MaxVertexLocation) {
+            return false;
+        }
+        if (record.vertexCount > 0 && attribute.offset + (record.vertexCount - 1) * stride + elementBytes > record.vertexSize) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < record.lodCount; ++i) {
+        if (uint64_t(record.lods[i].indexOffset) + record.lods[i].indexCount > record.indexCount) {
+            return false;
+        }
+    }
+    // Indices past the vertex count would fetch outside the vertex blob too.
+    const unsigned char *indices = file.data() + record.indexOffset;
+    for (uint32_t i = 0; i < record.indexCount; ++i) {
+        uint32_t index = 0;
+        std::memcpy(&index, indices + i * indexBytes, indexBytes);
+        if (index >= record.vertexCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::string MeshCachePath(const std::string &sourcePath) {
+    size_t dot = sourcePath.find_last_of('.');
+    size_t slash = sourcePath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return sourcePath + ".tcmesh";
+    }
+    return sourcePath.substr(0, dot) + ".tcmesh";
+}
+
+// 64-bit FNV-1a, consuming eight bytes per step.
+bool HashSourceFile(const std::string &path, uint64_t &hash) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    const uint64_t prime = 0x100000001b3ull;
+    hash = 0xcbf29ce484222325ull ^ file.size();
+    const unsigned char *bytes = file.data();
+    size_t words = file.size() / 8;
+    for (size_t i = 0; i < words; ++i) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i * 8, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (size_t i = words * 8; i < file.size(); ++i) {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return true;
+}
+
+bool LoadMeshCache(ModelData &data, const std::string &sourcePath, uint64_t sourceHash) {
+    std::string cachePath = MeshCachePath(sourcePath);
+    FILE *probe = fopen(cachePath.c_str(), "rb");
+    if (!probe) {
+        return false;
+    }
+    fclose(probe);
+
+    MappedFile &file = data.cacheFile;
+    if (!file.open(cachePath)) {
+        return false;
+    }
+
+    size_t cursor = 0;
+    CacheHeader header;
+    if (!ReadRecord(file, cursor, header) || std::memcmp(header.magic, CacheMagic, 4) != 0 ||
+        header.version != MeshCacheVersion || header.sourceHash != sourceHash || header.fileSize != file.size()) {
+        std::cout << "Mesh cache is stale: " << cachePath << std::endl;
+        file.close();
+        return false;
+    }
+
+    std::vector<MeshData> meshes(header.meshCount);
+    for (MeshData &mesh : meshes) {
+        CacheMesh record;
+        if (!ReadRecord(file, cursor, record) || !ValidMeshRecord(file, record)) {
+            std::cerr << "Malformed mesh cache: " << cachePath << std::endl;
+            file.close();
+            return false;
+        }
+        mesh.vertexBytes = file.data() + record.vertexOffset;
+        mesh.vertexByteSize = record.vertexSize;
+        mesh.indexBytes = file.data() + record.indexOffset;
+        mesh.indexByteSize = record.indexSize;
+        mesh.vertexCount = record.vertexCount;
+        mesh.indexCount = static_cast<GLsizei>(record.indexCount);
+        mesh.indexType = record.indexType;
+        for (uint32_t i = 0; i < record.attributeCount; ++i) {
+            const CacheAttribute &attribute = record.attributes[i];
+            mesh.attributes.push_back({attribute.location, static_cast<GLint>(attribute.size), attribute.type,
+                                       static_cast<GLboolean>(attribute.normalized), static_cast<GLsizei>(attribute.stride), attribute.offset});
+        }
+        mesh.boundsMin = glm::vec3(record.boundsMin[0], record.boundsMin[1], record.boundsMin[2]);
+        mesh.boundsMax = glm::vec3(record.boundsMax[0], record.boundsMax[1], record.boundsMax[2]);
+        mesh.occluder = (record.flags & CacheMeshOccluder) != 0;
+        for (uint32_t i = 0; i < record.lodCount; ++i) {
+            mesh.lods.push_back({static_cast<GLsizei>(record.lods[i].indexOffset), static_cast<GLsizei>(record.lods[i].indexCount), record.lods[i].error});
+        }
+    }
+
+    std::vector<Material> materials(header.materialCount);
+    for (Material &material : materials) {
+        CacheMaterial record;
+        if (!ReadRecord(file, cursor, record)) {
+            file.close();
+            return false;
+        }
+        material.baseColor = glm::vec4(record.baseColor[0], record.baseColor[1], record.baseColor[2], record.baseColor[3]);
+        material.metallic = record.metallic;
+        material.roughness = record.roughness;
+    }
+
+    std::vector<Light> lights(header.lightCount);
+    for (Light &light : lights) {
+        CacheLight record;
+        if (!ReadRecord(file, cursor, record)) {
+            file.close();
+            return false;
+        }
+        light.position = glm::vec3(record.position[0], record.position[1], record.position[2]);
+        light.color = glm::vec3(record.color[0], record.color[1], record.color[2]);
+        light.intensity = record.intensity;
+        light.range = record.range;
+    }
+
+    std::vector<AnimationData> animations(header.animationCount);
+    for (AnimationData &animation : animations) {
+        CacheAnimation record;
+        if (!ReadRecord(file, cursor, record) || !ReadArray(file, record.timesOffset, record.timeCount, animation.times) ||
+            !ReadArray(file, record.translationsOffset, record.translationCount, animation.translations) ||
+            !ReadArray(file, record.scalesOffset, record.scaleCount, animation.scales)) {
+            std::cerr << "Malformed mesh cache: " << cachePath << std::endl;
+            file.close();
+            return false;
+        }
+    }
+
+    data.meshes = std::move(meshes);
+    data.materials = std::move(materials);
+    data.lights = std::move(lights);
+    data.animations = std::move(animations);
+    return true;
+}
+
+bool WriteMeshCache(const ModelData &data, const std::string &sourcePath, uint64_t sourceHash) {
+    for (const MeshData &mesh : data.meshes) {
+        if (mesh.attributes.size() > MaxCachedAttributes) {
+            std::cerr << "Mesh has too many attributes for the mesh cache." << std::endl;
+            return false;
+        }
+        // Truncating the chain would make warm starts draw differently.
+        if (mesh.lods.size() > MaxCachedLods) {
+            std::cerr << "Mesh has " << mesh.lods.size() << " LODs; the mesh cache holds " << MaxCachedLods
+                      << ". Not caching " << sourcePath << std::endl;
+            return false;
+        }
+    }
+
+    CacheHeader header = {};
+    std::memcpy(header.magic, CacheMagic, 4);
+    header.version = MeshCacheVersion;
+    header.sourceHash = sourceHash;
+    header.meshCount = static_cast<uint32_t>(data.meshes.size());
+    header.materialCount = static_cast<uint32_t>(data.materials.size());
+    header.lightCount = static_cast<uint32_t>(data.lights.size());
+    header.animationCount = static_cast<uint32_t>(data.animations.size());
+
+    size_t tableSize = sizeof(CacheHeader) + data.meshes.size() * sizeof(CacheMesh) +
+                       data.materials.size() * sizeof(CacheMaterial) + data.lights.size() * sizeof(CacheLight) +
+                       data.animations.size() * sizeof(CacheAnimation);
+    std::vector<unsigned char> out(tableSize);
+    size_t cursor = sizeof(CacheHeader);
+
+    for (const MeshData &mesh : data.meshes) {
+        const void *vertexBytes = mesh.vertexSource();
+        size_t vertexSize = mesh.vertexSourceSize();
+        const void *indexBytes = mesh.indexSource();
+        size_t indexSize = mesh.indexSourceSize();
+
+        CacheMesh record = {};
+        record.vertexSize = vertexSize;
+        record.vertexOffset = AppendBlob(out, vertexBytes, vertexSize);
+        record.indexSize = indexSize;
+        record.indexOffset = AppendBlob(out, indexBytes, indexSize);
+        record.vertexCount = static_cast<uint32_t>(mesh.vertexCount);
+        record.indexCount = static_cast<uint32_t>(mesh.indexCount);
+        record.indexType = mesh.indexType;
+        record.attributeCount = static_cast<uint32_t>(mesh.attributes.size());
+        for (size_t i = 0; i < mesh.attributes.size(); ++i) {
+            const VertexAttribute &attribute = mesh.attributes[i];
+            record.attributes[i] = {attribute.location, static_cast<uint32_t>(attribute.size), attribute.type,
+                                    attribute.normalized, static_cast<uint32_t>(attribute.stride), static_cast<uint32_t>(attribute.offset)};
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            record.boundsMin[axis] = mesh.boundsMin[axis];
+            record.boundsMax[axis] = mesh.boundsMax[axis];
+        }
+        record.flags = mesh.occluder ? CacheMeshOccluder : 0;
+        record.lodCount = static_cast<uint32_t>(mesh.lods.size());
+        for (uint32_t i = 0; i < record.lodCount; ++i) {
+            record.lods[i] = {static_cast<uint32_t>(mesh.lods[i].indexOffset), static_cast<uint32_t>(mesh.lods[i].indexCount), mesh.lods[i].error};
+        }
+        std::memcpy(out.data() + cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+    }
+
+    for (const Material &material : data.materials) {
+        CacheMaterial record = {{material.baseColor.r, material.baseColor.g, material.baseColor.b, material.baseColor.a},
+                                material.metallic, material.roughness};
+        std::memcpy(out.data() + cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+    }
+
+    for (const Light &light : data.lights) {
+        CacheLight record = {{light.position.x, light.position.y, light.position.z},
+                             {light.color.r, light.color.g, light.color.b}, light.intensity, light.range};
+        std::memcpy(out.data() + cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+    }
+
+    for (const AnimationData &animation : data.animations) {
+        CacheAnimation record = {};
+        record.timeCount = static_cast<uint32_t>(animation.times.size());
+        record.timesOffset = AppendBlob(out, animation.times.data(), animation.times.size() * sizeof(float));
+        record.translationCount = static_cast<uint32_t>(animation.translations.size());
+        record.translationsOffset = AppendBlob(out, animation.translations.data(), animation.translations.size() * sizeof(glm::vec3));
+        record.scaleCount = static_cast<uint32_t>(animation.scales.size());
+        record.scalesOffset = AppendBlob(out, animation.scales.data(), animation.scales.size() * sizeof(glm::vec3));
+        std::memcpy(out.data() + cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+    }
+
+    header.fileSize = out.size();
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    // Write to a per-thread temporary and rename, so concurrent loads of the
+    // same model never observe a half-written cache.
+    std::string cachePath = MeshCachePath(sourcePath);
+    std::string tempPath = cachePath + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to write mesh cache: " << cachePath << std::endl;
+        return false;
+    }
+    size_t written = fwrite(out.data(), 1, out.size(), file);
+    fclose(file);
+    if (written != out.size() || std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+        std::cerr << "Failed to write mesh cache: " << cachePath << std::endl;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
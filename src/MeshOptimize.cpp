@@ -0,0 +1,429 @@
+#include "MeshOptimize.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const size_t ForsythCacheSize = 32;
+const size_t AnalysisCacheSize = 16;
+const int OverdrawResolution = 256;
+
+// Forsyth scoring: vertices just used by the last triangle get a fixed score,
+// older cache entries decay, and vertices with few remaining triangles are
+// boosted so they get finished off instead of leaving isolated triangles.
+float VertexScore(int cachePosition, unsigned int remainingValence) {
+    if (remainingValence == 0) {
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            float scaler = 1.0f / (ForsythCacheSize - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, 1.5f);
+        }
+    }
+    return score + 2.0f / std::sqrt(static_cast<float>(remainingValence));
+}
+
+// FIFO cache simulation; returns the number of vertices that missed.
+class FifoCache {
+public:
+    FifoCache(size_t vertexCount, size_t cacheSize) : timestamps(vertexCount, 0), size(cacheSize), time(cacheSize + 1) {}
+
+    unsigned int access(const unsigned int *triangle) {
+        unsigned int misses = 0;
+        for (int corner = 0; corner < 3; ++corner) {
+            unsigned int v = triangle[corner];
+            if (time - timestamps[v] >= size) {
+                timestamps[v] = time++;
+                ++misses;
+            }
+        }
+        return misses;
+    }
+
+    // Forgets every cached vertex.
+    void reset() { time += size + 1; }
+
+private:
+    std::vector<size_t> timestamps;
+    size_t size;
+    size_t time;
+};
+
+struct Cluster {
+    size_t begin;
+    size_t end;
+    glm::vec3 centroid;
+    glm::vec3 normal;
+    float sortKey;
+};
+
+size_t VertexCountOf(const unsigned int *indices, size_t indexCount) {
+    unsigned int maxIndex = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        maxIndex = std::max(maxIndex, indices[i]);
+    }
+    return indexCount ? static_cast<size_t>(maxIndex) + 1 : 0;
+}
+
+} // namespace
+
+void AnalyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount, size_t cacheSize, MeshStats &stats) {
+    std::vector<bool> referenced(vertexCount, false);
+    FifoCache cache(vertexCount, cacheSize);
+    size_t misses = 0;
+    size_t unique = 0;
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+        misses += cache.access(indices + i);
+        for (int corner = 0; corner < 3; ++corner) {
+            if (!referenced[indices[i + corner]]) {
+                referenced[indices[i + corner]] = true;
+                ++unique;
+            }
+        }
+    }
+    stats.acmr = indexCount ? float(misses) / float(indexCount / 3) : 0.0f;
+    stats.atvr = unique ? float(misses) / float(unique) : 0.0f;
+}
+
+void AnalyzeOverdraw(const unsigned int *indices, size_t indexCount, const std::vector<glm::vec3> &positions, MeshStats &stats) {
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < indexCount; ++i) {
+        boundsMin = glm::min(boundsMin, positions[indices[i]]);
+        boundsMax = glm::max(boundsMax, positions[indices[i]]);
+    }
+    glm::vec3 extent = boundsMax - boundsMin;
+    float scale = std::max(extent.x, std::max(extent.y, extent.z));
+    if (indexCount == 0 || scale <= 0.0f) {
+        stats.overdraw = 0.0f;
+        return;
+    }
+    scale = (OverdrawResolution - 1) / scale;
+
+    const float farDepth = std::numeric_limits<float>::max();
+    std::vector<float> depth(OverdrawResolution * OverdrawResolution);
+    size_t shaded = 0;
+    size_t covered = 0;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        for (float direction : {1.0f, -1.0f}) {
+            std::fill(depth.begin(), depth.end(), farDepth);
+            for (size_t i = 0; i + 2 < indexCount; i += 3) {
+                glm::vec3 p[3];
+                for (int corner = 0; corner < 3; ++corner) {
+                    p[corner] = (positions[indices[i + corner]] - boundsMin) * scale;
+                }
+                // The viewer looks along +direction on this axis; skip back faces.
+                glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                if (normal[axis] * direction >= 0.0f) {
+                    continue;
+                }
+
+                float u[3], v[3], z[3];
+                for (int corner = 0; corner < 3; ++corner) {
+                    u[corner] = p[corner][(axis + 1) % 3];
+                    v[corner] = p[corner][(axis + 2) % 3];
+                    z[corner] = p[corner][axis] * direction;
+                }
+                float area = (u[1] - u[0]) * (v[2] - v[0]) - (u[2] - u[0]) * (v[1] - v[0]);
+                if (area == 0.0f) {
+                    continue;
+                }
+                int minX = std::max(0, static_cast<int>(std::floor(std::min(u[0], std::min(u[1], u[2])))));
+                int maxX = std::min(OverdrawResolution - 1, static_cast<int>(std::ceil(std::max(u[0], std::max(u[1], u[2])))));
+                int minY = std::max(0, static_cast<int>(std::floor(std::min(v[0], std::min(v[1], v[2])))));
+                int maxY = std::min(OverdrawResolution - 1, static_cast<int>(std::ceil(std::max(v[0], std::max(v[1], v[2])))));
+                for (int y = minY; y <= maxY; ++y) {
+                    for (int x = minX; x <= maxX; ++x) {
+                        float px = x + 0.5f;
+                        float py = y + 0.5f;
+                        float w0 = ((u[2] - u[1]) * (py - v[1]) - (v[2] - v[1]) * (px - u[1])) / area;
+                        float w1 = ((u[0] - u[2]) * (py - v[2]) - (v[0] - v[2]) * (px - u[2])) / area;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                            continue;
+                        }
+                        float d = w0 * z[0] + w1 * z[1] + w2 * z[2];
+                        float &stored = depth[y * OverdrawResolution + x];
+                        if (d < stored) {
+                            stored = d;
+                            ++shaded;
+                        }
+                    }
+                }
+            }
+            covered += std::count_if(depth.begin(), depth.end(), [farDepth](float d) { return d != farDepth; });
+        }
+    }
+    stats.overdraw = covered ? float(shaded) / float(covered) : 0.0f;
+}
+
+void OptimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Triangles around each vertex; the live part of a vertex's list shrinks
+    // as its triangles are emitted.
+    std::vector<unsigned int> valence(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        ++valence[indices[i]];
+    }
+    std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+    std::partial_sum(valence.begin(), valence.end(), adjacencyStart.begin() + 1);
+    std::vector<unsigned int> adjacency(triangleCount * 3);
+    std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScore[v] = VertexScore(-1, valence[v]);
+    }
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(triangleCount * 3);
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> nextCache;
+    cache.reserve(ForsythCacheSize + 3);
+    nextCache.reserve(ForsythCacheSize + 3);
+
+    size_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+    size_t inputCursor = 0;
+    while (output.size() < triangleCount * 3) {
+        if (best == triangleCount) {
+            // Nothing adjacent to the cache is left; continue in input order.
+            while (emitted[inputCursor]) {
+                ++inputCursor;
+            }
+            best = inputCursor;
+        }
+
+        const unsigned int *triangle = indices + best * 3;
+        emitted[best] = true;
+        nextCache.clear();
+        for (int corner = 0; corner < 3; ++corner) {
+            unsigned int v = triangle[corner];
+            output.push_back(v);
+            nextCache.push_back(v);
+
+            unsigned int *begin = adjacency.data() + adjacencyStart[v];
+            unsigned int *end = begin + valence[v];
+            *std::find(begin, end, static_cast<unsigned int>(best)) = *(end - 1);
+            --valence[v];
+        }
+        for (unsigned int v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                nextCache.push_back(v);
+            }
+        }
+
+        // Rescore everything that entered, moved in or fell out of the cache,
+        // and pick the best triangle around the cached vertices.
+        best = triangleCount;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < nextCache.size(); ++i) {
+            unsigned int v = nextCache[i];
+            int position = i < ForsythCacheSize ? static_cast<int>(i) : -1;
+            float score = VertexScore(position, valence[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + valence[v]; ++a) {
+                unsigned int t = adjacency[a];
+                triangleScore[t] += delta;
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (nextCache.size() > ForsythCacheSize) {
+            nextCache.resize(ForsythCacheSize);
+        }
+        std::swap(cache, nextCache);
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeOverdraw(unsigned int *indices, size_t indexCount, const std::vector<glm::vec3> &positions, float threshold) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2) {
+        return;
+    }
+    size_t vertexCount = VertexCountOf(indices, triangleCount * 3);
+
+    // Hard boundaries: triangles whose three vertices all miss the cache, so
+    // moving the cluster elsewhere costs nothing extra.
+    std::vector<size_t> hardBoundaries;
+    FifoCache cache(vertexCount, AnalysisCacheSize);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        if (cache.access(indices + t * 3) == 3) {
+            hardBoundaries.push_back(t);
+        }
+    }
+    hardBoundaries.push_back(triangleCount);
+
+    // Soft boundaries split each hard cluster wherever the running ACMR
+    // since the last split is within threshold of the whole cluster's.
+    std::vector<size_t> boundaries;
+    for (size_t c = 0; c + 1 < hardBoundaries.size(); ++c) {
+        size_t begin = hardBoundaries[c];
+        size_t end = hardBoundaries[c + 1];
+
+        cache.reset();
+        size_t clusterMisses = 0;
+        for (size_t t = begin; t < end; ++t) {
+            clusterMisses += cache.access(indices + t * 3);
+        }
+        float clusterAcmr = float(clusterMisses) / float(end - begin);
+
+        cache.reset();
+        boundaries.push_back(begin);
+        size_t misses = 0;
+        size_t start = begin;
+        for (size_t t = begin; t < end; ++t) {
+            misses += cache.access(indices + t * 3);
+            if (t + 1 < end && float(misses) / float(t + 1 - start) <= clusterAcmr * threshold) {
+                boundaries.push_back(t + 1);
+                cache.reset();
+                misses = 0;
+                start = t + 1;
+            }
+        }
+    }
+    boundaries.push_back(triangleCount);
+
+    // Clusters facing away from the mesh centre are drawn first, so they tend
+    // to occlude the rest.
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    std::vector<Cluster> clusters;
+    clusters.reserve(boundaries.size() - 1);
+    for (size_t c = 0; c + 1 < boundaries.size(); ++c) {
+        Cluster cluster = {boundaries[c], boundaries[c + 1], glm::vec3(0.0f), glm::vec3(0.0f), 0.0f};
+        float area = 0.0f;
+        for (size_t t = cluster.begin; t < cluster.end; ++t) {
+            const glm::vec3 &p0 = positions[indices[t * 3]];
+            const glm::vec3 &p1 = positions[indices[t * 3 + 1]];
+            const glm::vec3 &p2 = positions[indices[t * 3 + 2]];
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            cluster.centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            cluster.normal += n;
+            area += triangleArea;
+        }
+        meshCentroid += cluster.centroid;
+        meshArea += area;
+        if (area > 0.0f) {
+            cluster.centroid /= area;
+        }
+        float normalLength = glm::length(cluster.normal);
+        if (normalLength > 0.0f) {
+            cluster.normal /= normalLength;
+        }
+        clusters.push_back(cluster);
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
+    }
+    for (Cluster &cluster : clusters) {
+        cluster.sortKey = glm::dot(cluster.centroid - meshCentroid, cluster.normal);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(triangleCount * 3);
+    for (const Cluster &cluster : clusters) {
+        sorted.insert(sorted.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+    }
+    std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+// Renumbers decoded vertices in the order the index buffer first uses them.
+static void OptimizeVertexFetch(MeshData &data, std::vector<unsigned int> &indices, std::vector<glm::vec3> &positions) {
+    const unsigned int unused = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> remap(data.vertexCount, unused);
+    unsigned int next = 0;
+    for (unsigned int &index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    for (unsigned int &target : remap) {
+        if (target == unused) {
+            target = next++;
+        }
+    }
+
+    std::vector<glm::vec3> remappedPositions(positions.size());
+    for (size_t v = 0; v < positions.size(); ++v) {
+        remappedPositions[remap[v]] = positions[v];
+    }
+    positions = std::move(remappedPositions);
+
+    std::vector<Vertex> remapped(data.vertices.size());
+    for (size_t v = 0; v < data.vertices.size(); ++v) {
+        remapped[remap[v]] = data.vertices[v];
+    }
+    data.vertices = std::move(remapped);
+}
+
+void OptimizeMesh(MeshData &data, MeshStats &before, MeshStats &after) {
+    if (data.indexCount < 3 || data.vertexCount == 0) {
+        return;
+    }
+
+    std::vector<unsigned int> indices;
+    ReadMeshIndices(data, indices, static_cast<size_t>(data.indexCount));
+    std::vector<glm::vec3> positions(data.vertexCount);
+    {
+        std::vector<Vertex> vertices;
+        ReadMeshVertices(data, vertices);
+        for (size_t v = 0; v < vertices.size(); ++v) {
+            positions[v] = vertices[v].Position;
+        }
+    }
+
+    std::vector<MeshLod> lods = data.lods;
+    if (lods.empty()) {
+        lods.push_back({0, data.indexCount, 0.0f});
+    }
+    size_t fullCount = static_cast<size_t>(lods[0].indexCount);
+
+    AnalyzeVertexCache(indices.data(), fullCount, data.vertexCount, AnalysisCacheSize, before);
+    AnalyzeOverdraw(indices.data(), fullCount, positions, before);
+
+    for (const MeshLod &lod : lods) {
+        unsigned int *range = indices.data() + lod.indexOffset;
+        OptimizeVertexCache(range, static_cast<size_t>(lod.indexCount), data.vertexCount);
+        OptimizeOverdraw(range, static_cast<size_t>(lod.indexCount), positions);
+    }
+    // Mapped primitives keep their stored vertex order, so their vertex
+    // bytes still go to GL straight from the file mapping.
+    if (!data.vertices.empty()) {
+        OptimizeVertexFetch(data, indices, positions);
+    }
+
+    AnalyzeVertexCache(indices.data(), fullCount, data.vertexCount, AnalysisCacheSize, after);
+    AnalyzeOverdraw(indices.data(), fullCount, positions, after);
+
+    data.indices = std::move(indices);
+    data.packedIndices.clear();
+    data.indexBytes = nullptr;
+    data.indexByteSize = 0;
+}
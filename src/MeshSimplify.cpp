@@ -0,0 +1,369 @@
+#include "MeshSimplify.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+const size_t MaxLodLevels = 4;
+const size_t MinLodTriangles = 32;
+const float MinLodReduction = 0.9f;   // a level must drop at least 10% of the triangles
+const float AttributeWeight = 0.5f;
+
+// Symmetric 4x4 error quadric of the plane equations accumulated on a vertex.
+struct Quadric {
+    double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+
+    void addPlane(const glm::dvec3 &n, double d) {
+        a2 += n.x * n.x; b2 += n.y * n.y; c2 += n.z * n.z;
+        ab += n.x * n.y; ac += n.x * n.z; bc += n.y * n.z;
+        ad += n.x * d; bd += n.y * d; cd += n.z * d; d2 += d * d;
+    }
+
+    void add(const Quadric &q) {
+        a2 += q.a2; b2 += q.b2; c2 += q.c2; ab += q.ab; ac += q.ac;
+        bc += q.bc; ad += q.ad; bd += q.bd; cd += q.cd; d2 += q.d2;
+    }
+
+    double error(const glm::vec3 &p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a2 * x * x + b2 * y * y + c2 * z * z + 2 * (ab * x * y + ac * x * z + bc * y * z) +
+                   2 * (ad * x + bd * y + cd * z) + d2;
+        return std::max(e, 0.0);
+    }
+};
+
+struct Collapse {
+    unsigned int from;
+    unsigned int to;
+    double cost;
+    double geometricError;
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const {
+        const uint32_t *bits = reinterpret_cast<const uint32_t *>(&p);
+        return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+    }
+};
+
+unsigned int Resolve(std::vector<unsigned int> &remap, unsigned int v) {
+    while (remap[v] != v) {
+        remap[v] = remap[remap[v]];
+        v = remap[v];
+    }
+    return v;
+}
+
+glm::vec3 TriangleNormal(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+    return glm::cross(b - a, c - a);
+}
+
+// Vertices that share a position (the wedges of a UV or normal seam) are
+// welded into one position id and always move together. Positions on an open
+// border of the welded mesh are locked.
+struct WeldedPositions {
+    std::vector<unsigned int> id;         // per vertex
+    std::vector<unsigned int> wedgeStart; // per position, into wedges
+    std::vector<unsigned int> wedges;
+    std::vector<bool> border;             // per position
+};
+
+WeldedPositions WeldPositions(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices) {
+    WeldedPositions welded;
+    welded.id.resize(vertices.size());
+    std::unordered_map<glm::vec3, unsigned int, PositionHash> ids;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        auto inserted = ids.emplace(vertices[i].Position, static_cast<unsigned int>(ids.size()));
+        welded.id[i] = inserted.first->second;
+    }
+    welded.wedgeStart.assign(ids.size() + 1, 0);
+    for (unsigned int id : welded.id) {
+        ++welded.wedgeStart[id + 1];
+    }
+    std::partial_sum(welded.wedgeStart.begin(), welded.wedgeStart.end(), welded.wedgeStart.begin());
+    welded.wedges.resize(vertices.size());
+    std::vector<unsigned int> fill(welded.wedgeStart.begin(), welded.wedgeStart.end() - 1);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        welded.wedges[fill[welded.id[i]]++] = static_cast<unsigned int>(i);
+    }
+
+    // An edge of the welded mesh is a border when its two directions don't pair up.
+    std::unordered_map<uint64_t, int> edgeBalance;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        for (int e = 0; e < 3; ++e) {
+            uint64_t a = welded.id[indices[t + e]];
+            uint64_t b = welded.id[indices[t + (e + 1) % 3]];
+            if (a < b) {
+                ++edgeBalance[(a << 32) | b];
+            } else {
+                --edgeBalance[(b << 32) | a];
+            }
+        }
+    }
+    welded.border.assign(ids.size(), false);
+    for (const auto &edge : edgeBalance) {
+        if (edge.second != 0) {
+            welded.border[edge.first >> 32] = true;
+            welded.border[edge.first & 0xFFFFFFFFu] = true;
+        }
+    }
+    return welded;
+}
+
+// Triangles around each vertex of the current index list.
+struct VertexTriangles {
+    std::vector<unsigned int> start;
+    std::vector<unsigned int> triangles;
+
+    void build(const std::vector<unsigned int> &indices, size_t vertexCount) {
+        start.assign(vertexCount + 1, 0);
+        for (unsigned int index : indices) {
+            ++start[index + 1];
+        }
+        std::partial_sum(start.begin(), start.end(), start.begin());
+        triangles.resize(indices.size());
+        std::vector<unsigned int> fill(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            triangles[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+        }
+    }
+};
+
+// Moving position from onto position to takes every live wedge of from to
+// the one vertex at to that its own triangles reach, so a seam slides along
+// itself and each side keeps its attributes. A wedge that reaches none (the
+// collapse would cross the seam) or several rejects the collapse.
+bool MapWedges(const WeldedPositions &welded, const VertexTriangles &adjacency, const std::vector<unsigned int> &indices,
+               unsigned int from, unsigned int to, std::vector<std::pair<unsigned int, unsigned int>> &moves) {
+    const unsigned int none = ~0u;
+    moves.clear();
+    for (unsigned int w = welded.wedgeStart[from]; w < welded.wedgeStart[from + 1]; ++w) {
+        unsigned int wedge = welded.wedges[w];
+        if (adjacency.start[wedge] == adjacency.start[wedge + 1]) {
+            continue; // collapsed away or unused
+        }
+        unsigned int target = none;
+        for (unsigned int i = adjacency.start[wedge]; i < adjacency.start[wedge + 1]; ++i) {
+            unsigned int t = adjacency.triangles[i] * 3;
+            for (int c = 0; c < 3; ++c) {
+                unsigned int corner = indices[t + c];
+                if (welded.id[corner] != to) {
+                    continue;
+                }
+                if (target != none && target != corner) {
+                    return false;
+                }
+                target = corner;
+            }
+        }
+        if (target == none) {
+            return false;
+        }
+        moves.push_back({wedge, target});
+    }
+    return !moves.empty();
+}
+
+} // namespace
+
+std::vector<unsigned int> SimplifyMesh(const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices,
+                                       size_t targetIndexCount, float maxError, float &resultError) {
+    resultError = 0.0f;
+    std::vector<unsigned int> result = indices;
+    if (indices.size() <= targetIndexCount || vertices.empty()) {
+        return result;
+    }
+
+    const WeldedPositions welded = WeldPositions(vertices, indices);
+    const size_t positionCount = welded.border.size();
+
+    // One quadric per position, so the wedges of a seam share their error.
+    std::vector<Quadric> quadrics(positionCount);
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        glm::dvec3 a = vertices[indices[t]].Position;
+        glm::dvec3 b = vertices[indices[t + 1]].Position;
+        glm::dvec3 c = vertices[indices[t + 2]].Position;
+        glm::dvec3 n = glm::cross(b - a, c - a);
+        double length = glm::length(n);
+        if (length == 0.0) {
+            continue;
+        }
+        n /= length;
+        double d = -glm::dot(n, a);
+        for (int corner = 0; corner < 3; ++corner) {
+            quadrics[welded.id[indices[t + corner]]].addPlane(n, d);
+        }
+    }
+
+    std::vector<unsigned int> remap(vertices.size());
+    std::iota(remap.begin(), remap.end(), 0u);
+    const double maxErrorSquared = double(maxError) * double(maxError);
+    double largestError = 0.0;
+    VertexTriangles adjacency;
+    std::vector<std::pair<unsigned int, unsigned int>> moves;
+
+    // Quadric error of the position plus the normal/UV change of every wedge.
+    auto evaluate = [&](unsigned int from, unsigned int to, Collapse &collapse) {
+        if (welded.border[from] || !MapWedges(welded, adjacency, result, from, to, moves)) {
+            return false;
+        }
+        const glm::vec3 &target = vertices[moves[0].second].Position;
+        glm::vec3 delta = vertices[moves[0].first].Position - target;
+        double edgeLength2 = glm::dot(delta, delta);
+        double attributeCost = 0.0;
+        for (const auto &move : moves) {
+            glm::vec3 normalDelta = vertices[move.first].Normal - vertices[move.second].Normal;
+            glm::vec2 uvDelta = vertices[move.first].TexCoords - vertices[move.second].TexCoords;
+            attributeCost += AttributeWeight * edgeLength2 * (glm::dot(normalDelta, normalDelta) + glm::dot(uvDelta, uvDelta));
+        }
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        double error = q.error(target);
+        collapse = {from, to, error + attributeCost, error};
+        return true;
+    };
+
+    while (result.size() > targetIndexCount) {
+        adjacency.build(result, vertices.size());
+
+        // Candidate collapses along every edge, cheapest direction first.
+        std::vector<Collapse> collapses;
+        collapses.reserve(result.size());
+        for (size_t t = 0; t < result.size(); t += 3) {
+            for (int e = 0; e < 3; ++e) {
+                unsigned int u = welded.id[result[t + e]];
+                unsigned int v = welded.id[result[t + (e + 1) % 3]];
+                if (u >= v) {
+                    continue; // each shared edge appears once in each direction
+                }
+                Collapse best = {0, 0, -1.0, 0.0};
+                Collapse candidate;
+                if (evaluate(u, v, candidate)) {
+                    best = candidate;
+                }
+                if (evaluate(v, u, candidate) && (best.cost < 0.0 || candidate.cost < best.cost)) {
+                    best = candidate;
+                }
+                if (best.cost >= 0.0 && best.geometricError <= maxErrorSquared) {
+                    collapses.push_back(best);
+                }
+            }
+        }
+        if (collapses.empty()) {
+            break;
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+        // Each collapse removes about two triangles; stop a pass once that is
+        // enough to reach the target, and touch every position at most once.
+        size_t collapseBudget = std::max<size_t>(1, (result.size() - targetIndexCount) / 6);
+        std::vector<bool> touched(positionCount, false);
+        size_t performed = 0;
+        for (const Collapse &collapse : collapses) {
+            if (performed >= collapseBudget) {
+                break;
+            }
+            if (touched[collapse.from] || touched[collapse.to] || !MapWedges(welded, adjacency, result, collapse.from, collapse.to, moves)) {
+                continue;
+            }
+
+            bool flips = false;
+            const glm::vec3 &target = vertices[moves[0].second].Position;
+            for (const auto &move : moves) {
+                for (unsigned int i = adjacency.start[move.first]; i < adjacency.start[move.first + 1] && !flips; ++i) {
+                    unsigned int t = adjacency.triangles[i] * 3;
+                    const unsigned int corners[3] = {Resolve(remap, result[t]), Resolve(remap, result[t + 1]), Resolve(remap, result[t + 2])};
+                    if (welded.id[corners[0]] == collapse.to || welded.id[corners[1]] == collapse.to || welded.id[corners[2]] == collapse.to) {
+                        continue; // becomes degenerate and disappears
+                    }
+                    glm::vec3 before = TriangleNormal(vertices[corners[0]].Position, vertices[corners[1]].Position, vertices[corners[2]].Position);
+                    glm::vec3 moved[3];
+                    for (int c = 0; c < 3; ++c) {
+                        moved[c] = corners[c] == move.first ? target : vertices[corners[c]].Position;
+                    }
+                    glm::vec3 after = TriangleNormal(moved[0], moved[1], moved[2]);
+                    // Reject flips and sharp folds, not just sign changes.
+                    flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+                }
+            }
+            if (flips) {
+                continue;
+            }
+
+            for (const auto &move : moves) {
+                remap[move.first] = move.second;
+            }
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            touched[collapse.from] = touched[collapse.to] = true;
+            largestError = std::max(largestError, collapse.geometricError);
+            ++performed;
+        }
+        if (performed == 0) {
+            break;
+        }
+
+        // Apply the collapses and drop triangles that became degenerate.
+        size_t write = 0;
+        for (size_t t = 0; t < result.size(); t += 3) {
+            unsigned int a = Resolve(remap, result[t]);
+            unsigned int b = Resolve(remap, result[t + 1]);
+            unsigned int c = Resolve(remap, result[t + 2]);
+            if (a != b && b != c && a != c) {
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+        }
+        result.resize(write);
+    }
+
+    resultError = static_cast<float>(std::sqrt(largestError));
+    return result;
+}
+
+void GenerateLods(MeshData &data) {
+    data.lods.clear();
+    if (data.indexCount / 3 < 2 * static_cast<GLsizei>(MinLodTriangles)) {
+        return;
+    }
+
+    // Mapped primitives only reference their stored bytes; simplify a decoded
+    // copy and keep the original vertex bytes, which all LODs index into.
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> current;
+    ReadMeshVertices(data, vertices);
+    ReadMeshIndices(data, current, static_cast<size_t>(data.indexCount));
+
+    glm::vec3 extent = data.boundsMax - data.boundsMin;
+    float maxError = 0.25f * std::max(extent.x, std::max(extent.y, extent.z));
+
+    std::vector<MeshLod> lods = {{0, static_cast<GLsizei>(current.size()), 0.0f}};
+    std::vector<unsigned int> chain = current;
+    float accumulatedError = 0.0f;
+    while (lods.size() < MaxLodLevels && current.size() / 3 >= 2 * MinLodTriangles) {
+        size_t target = (current.size() / 6) * 3;
+        float error = 0.0f;
+        std::vector<unsigned int> simplified = SimplifyMesh(vertices, current, target, maxError, error);
+        if (simplified.size() > current.size() * MinLodReduction) {
+            break;
+        }
+        // Each level is simplified from the previous one, so errors add up.
+        accumulatedError += error;
+        lods.push_back({static_cast<GLsizei>(chain.size()), static_cast<GLsizei>(simplified.size()), accumulatedError});
+        chain.insert(chain.end(), simplified.begin(), simplified.end());
+        current = std::move(simplified);
+    }
+    if (lods.size() < 2) {
+        return;
+    }
+
+    data.lods = std::move(lods);
+    data.indices = std::move(chain);
+    data.indexCount = static_cast<GLsizei>(data.indices.size());
+    data.packedIndices.clear();
+    data.indexBytes = nullptr;
+    data.indexByteSize = 0;
+}
@@ -0,0 +1,161 @@
+#include "ModelData.h"
+#include "MeshCache.h"
+#include "MeshOptimize.h"
+#include "MeshSimplify.h"
+#include "OcclusionBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+void LoadAnimationData(const GLTFAsset &asset, std::vector<AnimationData> &animations) {
+    const tinygltf::Model &model = asset.model;
+    for (const auto &animation : model.animations) {
+        AnimationData animData;
+        for (const auto &sampler : animation.samplers) {
+            const auto &inputAccessor = model.accessors[sampler.input];
+            const auto &outputAccessor = model.accessors[sampler.output];
+            const auto &inputBufferView = model.bufferViews[inputAccessor.bufferView];
+            const unsigned char *inputBuffer = asset.bufferData(inputBufferView.buffer);
+            const auto &outputBufferView = model.bufferViews[outputAccessor.bufferView];
+            const unsigned char *outputBuffer = asset.bufferData(outputBufferView.buffer);
+
+            std::vector<float> inputData(inputAccessor.count);
+            std::vector<glm::vec3> outputVec3Data(outputAccessor.count);
+
+            std::memcpy(inputData.data(), inputBuffer + inputBufferView.byteOffset + inputAccessor.byteOffset, inputAccessor.count * sizeof(float));
+            std::memcpy(outputVec3Data.data(), outputBuffer + outputBufferView.byteOffset + outputAccessor.byteOffset, outputAccessor.count * sizeof(glm::vec3));
+
+            animData.times = inputData;
+
+            for (const auto &channel : animation.channels) {
+                if (channel.sampler == &sampler - &animation.samplers[0]) {
+                    if (channel.target_path == "translation") {
+                        animData.translations = outputVec3Data;
+                    } else if (channel.target_path == "scale") {
+                        animData.scales = outputVec3Data;
+                    }
+                }
+            }
+        }
+        animations.push_back(animData);
+    }
+}
+
+void LoadMaterialData(const tinygltf::Model &model, std::vector<Material> &materials) {
+    for (const auto &gltfMaterial : model.materials) {
+        Material material;
+        auto baseColorFactor = gltfMaterial.values.find("baseColorFactor");
+        if (baseColorFactor != gltfMaterial.values.end()) {
+            const auto &color = baseColorFactor->second.number_array;
+            material.baseColor = glm::vec4(color[0], color[1], color[2], color[3]);
+        } else {
+            material.baseColor = glm::vec4(1.0f);
+        }
+
+        auto metallicFactor = gltfMaterial.values.find("metallicFactor");
+        if (metallicFactor != gltfMaterial.values.end()) {
+            material.metallic = static_cast<float>(metallicFactor->second.Factor());
+        } else {
+            material.metallic = 1.0f;
+        }
+
+        auto roughnessFactor = gltfMaterial.values.find("roughnessFactor");
+        if (roughnessFactor != gltfMaterial.values.end()) {
+            material.roughness = static_cast<float>(roughnessFactor->second.Factor());
+        } else {
+            material.roughness = 1.0f;
+        }
+
+        materials.push_back(material);
+    }
+}
+
+namespace {
+
+// Point and spot lights without a range reach until they are 1% as bright
+// as a unit light at one metre, so they can still be clustered.
+float LightCutoffRange(float intensity) {
+    return std::sqrt(std::max(intensity, 0.0f) / 0.01f);
+}
+
+} // namespace
+
+void LoadLightData(const tinygltf::Model &model, std::vector<Light> &lights) {
+    for (const auto &node : model.nodes) {
+        if (node.extensions.find("KHR_lights_punctual") != node.extensions.end()) {
+            const auto &lightIndex = node.extensions.at("KHR_lights_punctual").Get("light").Get<int>();
+            const tinygltf::Light &light = model.lights[lightIndex];
+
+            Light lightData;
+            lightData.position = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
+            lightData.color = glm::vec3(light.color[0], light.color[1], light.color[2]);
+            lightData.intensity = light.intensity;
+            if (light.type != "directional") {
+                lightData.range = light.range > 0.0 ? float(light.range) : LightCutoffRange(lightData.intensity);
+            }
+
+            lights.push_back(lightData);
+        }
+    }
+}
+
+static void CountMesh(ImportReport &report, const MeshData &mesh) {
+    size_t triangles = static_cast<size_t>(mesh.lods.empty() ? mesh.indexCount : mesh.lods[0].indexCount) / 3;
+    report.triangles += triangles;
+    report.lodMeshes += mesh.lods.size() > 1;
+    report.lodTriangles += mesh.lods.empty() ? triangles : static_cast<size_t>(mesh.lods.back().indexCount) / 3;
+}
+
+static void AddStats(MeshStats &sum, const MeshStats &stats, float weight) {
+    sum.acmr += stats.acmr * weight;
+    sum.atvr += stats.atvr * weight;
+    sum.overdraw += stats.overdraw * weight;
+}
+
+bool LoadModelData(ModelData &data, const std::string &path, GLTFLoadMode mode, bool useMeshCache) {
+    ImportReport &report = data.report;
+    uint64_t sourceHash = 0;
+    bool hashed = useMeshCache && HashSourceFile(path, sourceHash);
+    if (hashed && LoadMeshCache(data, path, sourceHash)) {
+        report.fromCache = true;
+        for (const MeshData &mesh : data.meshes) {
+            CountMesh(report, mesh);
+        }
+        return true;
+    }
+
+    if (!LoadGLTFAsset(data.asset, path, mode)) {
+        std::cerr << "Failed to load model." << std::endl;
+        return false;
+    }
+    LoadAnimationData(data.asset, data.animations);
+    LoadMaterialData(data.asset.model, data.materials);
+    LoadLightData(data.asset.model, data.lights);
+    for (const auto &gltfMesh : data.asset.model.meshes) {
+        DecodeMeshFromGLTF(data.asset, gltfMesh, data.meshes);
+    }
+    for (auto &mesh : data.meshes) {
+        DetectOccluder(mesh);
+        GenerateLods(mesh);
+        MeshStats before, after;
+        OptimizeMesh(mesh, before, after);
+        PackIndices(mesh);
+        CountMesh(report, mesh);
+        float triangles = float(mesh.lods.empty() ? mesh.indexCount : mesh.lods[0].indexCount) / 3.0f;
+        AddStats(report.before, before, triangles);
+        AddStats(report.after, after, triangles);
+    }
+    if (report.triangles > 0) {
+        float scale = 1.0f / float(report.triangles);
+        for (MeshStats *stats : {&report.before, &report.after}) {
+            stats->acmr *= scale;
+            stats->atvr *= scale;
+            stats->overdraw *= scale;
+        }
+    }
+    if (hashed) {
+        report.cacheWritten = WriteMeshCache(data, path, sourceHash);
+    }
+    return true;
+}
@@ -0,0 +1,335 @@
+#include "OcclusionBuffer.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TCITY_OCCLUSION_SSE2 1
+#endif
+
+namespace {
+
+const int CoverageGrid = 16;          // samples per side when judging occluders
+const float MinCoverage = 0.98f;
+const float MinOccluderArea = 8.0f;   // screen-space bounding rectangle, in pixels
+const float NearW = 1e-4f;
+const float DepthBias = 1.0001f;      // occludees must be this much farther (in 1/w)
+
+// Corners are numbered by bits (x, y, z). The rasterizer accepts either
+// winding, so the faces below (-z, +z, -y, +y, -x, +x) need no consistent one.
+const int BoxTriangles[12][3] = {
+    {0, 1, 3}, {0, 3, 2}, {4, 6, 7}, {4, 7, 5},
+    {0, 4, 5}, {0, 5, 1}, {2, 3, 7}, {2, 7, 6},
+    {0, 2, 6}, {0, 6, 4}, {1, 5, 7}, {1, 7, 3}};
+
+glm::vec3 Corner(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, int corner) {
+    return glm::vec3(corner & 1 ? boundsMax.x : boundsMin.x, corner & 2 ? boundsMax.y : boundsMin.y, corner & 4 ? boundsMax.z : boundsMin.z);
+}
+
+// Fraction of a CoverageGrid^2 sample grid over [0,1]^2 inside at least one
+// of the projected triangles.
+float Coverage(const std::vector<glm::vec2> &points, const std::vector<unsigned int> &indices) {
+    std::vector<bool> covered(CoverageGrid * CoverageGrid, false);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        glm::vec2 a = points[indices[i]], b = points[indices[i + 1]], c = points[indices[i + 2]];
+        float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        if (area == 0.0f) {
+            continue;
+        }
+        if (area < 0.0f) {
+            std::swap(b, c);
+        }
+        glm::vec2 lo = glm::min(a, glm::min(b, c)) * float(CoverageGrid);
+        glm::vec2 hi = glm::max(a, glm::max(b, c)) * float(CoverageGrid);
+        for (int y = std::max(int(lo.y), 0); y < std::min(int(std::ceil(hi.y)), CoverageGrid); ++y) {
+            for (int x = std::max(int(lo.x), 0); x < std::min(int(std::ceil(hi.x)), CoverageGrid); ++x) {
+                glm::vec2 p((x + 0.5f) / CoverageGrid, (y + 0.5f) / CoverageGrid);
+                if ((b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x) >= 0.0f &&
+                    (c.x - b.x) * (p.y - b.y) - (c.y - b.y) * (p.x - b.x) >= 0.0f &&
+                    (a.x - c.x) * (p.y - c.y) - (a.y - c.y) * (p.x - c.x) >= 0.0f) {
+                    covered[y * CoverageGrid + x] = true;
+                }
+            }
+        }
+    }
+    return float(std::count(covered.begin(), covered.end(), true)) / (CoverageGrid * CoverageGrid);
+}
+
+} // namespace
+
+void DetectOccluder(MeshData &data) {
+    data.occluder = false;
+    glm::vec3 size = data.boundsMax - data.boundsMin;
+    float epsilon = 1e-4f * std::max(size.x, std::max(size.y, size.z));
+    if (epsilon <= 0.0f) {
+        return;
+    }
+
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    ReadMeshVertices(data, vertices);
+    ReadMeshIndices(data, indices, data.lods.empty() ? data.indexCount : data.lods[0].indexCount);
+
+    // Seen along each axis the mesh must fill its box's face. A flat axis
+    // (a wall or a slab) makes the other two views degenerate; they are skipped.
+    std::vector<glm::vec2> points(vertices.size());
+    for (int axis = 0; axis < 3; ++axis) {
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        if (size[u] <= epsilon || size[v] <= epsilon) {
+            continue;
+        }
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            glm::vec3 p = (vertices[i].Position - data.boundsMin) / size;
+            points[i] = glm::vec2(p[u], p[v]);
+        }
+        if (Coverage(points, indices) < MinCoverage) {
+            return;
+        }
+    }
+    data.occluder = true;
+}
+
+OcclusionBuffer::OcclusionBuffer(int width, int height, unsigned workerCount)
+    : width((std::max(width, TileSize) + TileSize - 1) / TileSize * TileSize),
+      height((std::max(height, TileSize) + TileSize - 1) / TileSize * TileSize) {
+    tilesX = this->width / TileSize;
+    tilesY = this->height / TileSize;
+    depth.assign(size_t(this->width) * this->height, 0.0f);
+    tileDepth.assign(size_t(tilesX) * tilesY, 0.0f);
+
+    if (workerCount == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        workerCount = std::min(3u, hardware > 1 ? hardware - 1 : 0u);
+    }
+    workerCount = std::min(workerCount, unsigned(tilesY) - 1);
+    for (unsigned i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&OcclusionBuffer::workerLoop, this, i + 1);
+    }
+}
+
+OcclusionBuffer::~OcclusionBuffer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startWork.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void OcclusionBuffer::begin(const glm::mat4 &viewProjection) {
+    this->viewProjection = viewProjection;
+    triangles.clear();
+    frameStats = OcclusionStats();
+}
+
+void OcclusionBuffer::addOccluder(const glm::mat4 &modelMatrix, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+    glm::mat4 modelViewProjection = viewProjection * modelMatrix;
+    glm::vec3 screen[8];
+    glm::vec2 lo(static_cast<float>(width), static_cast<float>(height)), hi(0.0f);
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec4 clip = modelViewProjection * glm::vec4(Corner(boundsMin, boundsMax, corner), 1.0f);
+        if (clip.w <= NearW) {
+            return;
+        }
+        float invW = 1.0f / clip.w;
+        screen[corner] = glm::vec3((clip.x * invW * 0.5f + 0.5f) * width, (clip.y * invW * 0.5f + 0.5f) * height, invW);
+        lo = glm::min(lo, glm::vec2(screen[corner]));
+        hi = glm::max(hi, glm::vec2(screen[corner]));
+    }
+    lo = glm::max(lo, glm::vec2(0.0f));
+    hi = glm::min(hi, glm::vec2(float(width), float(height)));
+    if (hi.x <= lo.x || hi.y <= lo.y || (hi.x - lo.x) * (hi.y - lo.y) < MinOccluderArea) {
+        return;
+    }
+
+    ++frameStats.occluders;
+    for (const auto &corners : BoxTriangles) {
+        Triangle triangle;
+        float triLo[2] = {float(width), float(height)}, triHi[2] = {0.0f, 0.0f};
+        for (int i = 0; i < 3; ++i) {
+            const glm::vec3 &p = screen[corners[i]];
+            triangle.x[i] = p.x;
+            triangle.y[i] = p.y;
+            triangle.invW[i] = p.z;
+            triLo[0] = std::min(triLo[0], p.x);
+            triLo[1] = std::min(triLo[1], p.y);
+            triHi[0] = std::max(triHi[0], p.x);
+            triHi[1] = std::max(triHi[1], p.y);
+        }
+        // Pixels whose centers (x + 0.5) can fall inside.
+        triangle.minX = std::max(int(std::floor(triLo[0] - 0.5f)), 0) & ~3;
+        triangle.maxX = std::min(int(std::ceil(triHi[0] - 0.5f)), width - 1);
+        triangle.minY = std::max(int(std::floor(triLo[1] - 0.5f)), 0);
+        triangle.maxY = std::min(int(std::ceil(triHi[1] - 0.5f)), height - 1);
+        if (triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY) {
+            triangles.push_back(triangle);
+        }
+    }
+}
+
+void OcclusionBuffer::rasterize() {
+    frameStats.triangles = triangles.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+        pending = static_cast<unsigned>(workers.size());
+    }
+    startWork.notify_all();
+    rasterizeBand(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this] { return pending == 0; });
+}
+
+void OcclusionBuffer::workerLoop(unsigned band) {
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startWork.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        rasterizeBand(band);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+            workDone.notify_one();
+        }
+    }
+}
+
+// Clears, rasterizes and reduces one band of whole tile rows, so bands never
+// share pixels or tiles.
+void OcclusionBuffer::rasterizeBand(unsigned band) {
+    unsigned bandCount = static_cast<unsigned>(workers.size()) + 1;
+    int firstTileRow = int(band * tilesY / bandCount);
+    int lastTileRow = int((band + 1) * tilesY / bandCount);
+    int rowBegin = firstTileRow * TileSize;
+    int rowEnd = lastTileRow * TileSize;
+    std::fill(depth.begin() + size_t(rowBegin) * width, depth.begin() + size_t(rowEnd) * width, 0.0f);
+
+    for (const Triangle &triangle : triangles) {
+        int y0 = std::max(triangle.minY, rowBegin);
+        int y1 = std::min(triangle.maxY, rowEnd - 1);
+        if (y0 > y1) {
+            continue;
+        }
+
+        // Edge i runs from vertex i to i + 1 and is positive inside; the
+        // barycentric weight of the opposite vertex is its value / area.
+        float a[3], b[3], c[3];
+        for (int i = 0; i < 3; ++i) {
+            int j = (i + 1) % 3;
+            a[i] = triangle.y[i] - triangle.y[j];
+            b[i] = triangle.x[j] - triangle.x[i];
+            c[i] = triangle.x[i] * triangle.y[j] - triangle.x[j] * triangle.y[i];
+        }
+        float area = c[0] + c[1] + c[2];
+        if (area == 0.0f) {
+            continue;
+        }
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        float depthA = 0.0f, depthB = 0.0f, depthC = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            a[i] *= sign;
+            b[i] *= sign;
+            c[i] *= sign;
+            float weight = triangle.invW[(i + 2) % 3] / std::fabs(area);
+            depthA += a[i] * weight;
+            depthB += b[i] * weight;
+            depthC += c[i] * weight;
+        }
+
+        for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            float *row = &depth[size_t(y) * width];
+#ifdef TCITY_OCCLUSION_SSE2
+            __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            __m128 zero = _mm_setzero_ps();
+            for (int x = triangle.minX; x <= triangle.maxX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), px), _mm_set1_ps(b[0] * py + c[0])), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[1]), px), _mm_set1_ps(b[1] * py + c[1])), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[2]), px), _mm_set1_ps(b[2] * py + c[2])), zero));
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthA), px), _mm_set1_ps(depthB * py + depthC));
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_max_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int x = triangle.minX; x <= triangle.maxX; ++x) {
+                float px = x + 0.5f;
+                if (a[0] * px + b[0] * py + c[0] >= 0.0f && a[1] * px + b[1] * py + c[1] >= 0.0f && a[2] * px + b[2] * py + c[2] >= 0.0f) {
+                    row[x] = std::max(row[x], depthA * px + depthB * py + depthC);
+                }
+            }
+#endif
+        }
+    }
+
+    for (int tileY = firstTileRow; tileY < lastTileRow; ++tileY) {
+        for (int tileX = 0; tileX < tilesX; ++tileX) {
+            float farthest = depth[size_t(tileY * TileSize) * width + tileX * TileSize];
+            for (int y = 0; y < TileSize; ++y) {
+                const float *row = &depth[size_t(tileY * TileSize + y) * width + tileX * TileSize];
+                for (int x = 0; x < TileSize; ++x) {
+                    farthest = std::min(farthest, row[x]);
+                }
+            }
+            tileDepth[size_t(tileY) * tilesX + tileX] = farthest;
+        }
+    }
+}
+
+bool OcclusionBuffer::isVisible(const glm::vec3 &worldMin, const glm::vec3 &worldMax) {
+    ++frameStats.tested;
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    float nearest = 0.0f;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec4 clip = viewProjection * glm::vec4(Corner(worldMin, worldMax, corner), 1.0f);
+        if (clip.w <= NearW) {
+            return true;
+        }
+        float invW = 1.0f / clip.w;
+        glm::vec2 screen((clip.x * invW * 0.5f + 0.5f) * width, (clip.y * invW * 0.5f + 0.5f) * height);
+        lo = glm::min(lo, screen);
+        hi = glm::max(hi, screen);
+        nearest = std::max(nearest, invW);
+    }
+    nearest *= DepthBias;
+
+    // One pixel of margin on each side keeps occluder edges, which are only
+    // sampled at pixel centers, from hiding boxes that peek out beside them.
+    int x0 = std::max(int(std::floor(lo.x)) - 1, 0);
+    int y0 = std::max(int(std::floor(lo.y)) - 1, 0);
+    int x1 = std::min(int(std::ceil(hi.x)) + 1, width - 1);
+    int y1 = std::min(int(std::ceil(hi.y)) + 1, height - 1);
+    if (x0 > x1 || y0 > y1) {
+        return true; // off screen; the frustum test owns that case
+    }
+
+    for (int tileY = y0 / TileSize; tileY <= y1 / TileSize; ++tileY) {
+        for (int tileX = x0 / TileSize; tileX <= x1 / TileSize; ++tileX) {
+            if (nearest < tileDepth[size_t(tileY) * tilesX + tileX]) {
+                continue;
+            }
+            int tileX1 = std::min(x1, tileX * TileSize + TileSize - 1);
+            int tileY1 = std::min(y1, tileY * TileSize + TileSize - 1);
+            for (int y = std::max(y0, tileY * TileSize); y <= tileY1; ++y) {
+                for (int x = std::max(x0, tileX * TileSize); x <= tileX1; ++x) {
+                    if (nearest >= depth[size_t(y) * width + x]) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    ++frameStats.occluded;
+    return false;
+}
@@ -0,0 +1,245 @@
+#include "OffsetAllocator.h"
+#include <algorithm>
+
+namespace {
+
+int HighestBit(uint32_t value) {
+    int bit = 31;
+    while (!(value & (1u << bit))) {
+        --bit;
+    }
+    return bit;
+}
+
+int LowestBit(uint32_t value) {
+    int bit = 0;
+    while (!(value & (1u << bit))) {
+        ++bit;
+    }
+    return bit;
+}
+
+// Size classes: exact below 8, then 8 classes per power of two using the
+// three bits below the leading one.
+const uint32_t MantissaBits = 3;
+
+uint32_t BinRoundDown(uint32_t size) {
+    if (size < (1u << MantissaBits)) {
+        return size;
+    }
+    int exponent = HighestBit(size);
+    uint32_t mantissa = (size >> (exponent - MantissaBits)) & ((1u << MantissaBits) - 1);
+    return ((exponent - MantissaBits + 1) << MantissaBits) + mantissa;
+}
+
+// Smallest class whose blocks are all at least size units.
+uint32_t BinRoundUp(uint32_t size) {
+    uint32_t bin = BinRoundDown(size);
+    if (size >= (1u << MantissaBits)) {
+        int exponent = HighestBit(size);
+        uint32_t lowMask = (1u << (exponent - MantissaBits)) - 1;
+        if (size & lowMask) {
+            ++bin;
+        }
+    }
+    return bin;
+}
+
+} // namespace
+
+OffsetAllocator::OffsetAllocator(uint32_t size) {
+    reset(size);
+}
+
+void OffsetAllocator::reset(uint32_t size) {
+    nodes.clear();
+    spareNodes.clear();
+    std::fill(binHeads, binHeads + BinCount, Unused);
+    std::fill(leafBins, leafBins + BinCount / LeafBins, 0);
+    topBins = 0;
+    lastNode = Unused;
+    totalSize = size;
+    freeUnits = 0;
+    if (size > 0) {
+        uint32_t node = newNode();
+        nodes[node].offset = 0;
+        nodes[node].size = size;
+        lastNode = node;
+        insertFree(node);
+    }
+}
+
+uint32_t OffsetAllocator::newNode() {
+    if (!spareNodes.empty()) {
+        uint32_t node = spareNodes.back();
+        spareNodes.pop_back();
+        nodes[node] = Node();
+        return node;
+    }
+    nodes.emplace_back();
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void OffsetAllocator::insertFree(uint32_t node) {
+    uint32_t bin = BinRoundDown(nodes[node].size);
+    nodes[node].used = false;
+    nodes[node].binPrev = Unused;
+    nodes[node].binNext = binHeads[bin];
+    if (binHeads[bin] != Unused) {
+        nodes[binHeads[bin]].binPrev = node;
+    }
+    binHeads[bin] = node;
+    leafBins[bin / LeafBins] |= static_cast<uint8_t>(1u << (bin % LeafBins));
+    topBins |= 1u << (bin / LeafBins);
+    freeUnits += nodes[node].size;
+}
+
+void OffsetAllocator::removeFree(uint32_t node) {
+    Node &n = nodes[node];
+    uint32_t bin = BinRoundDown(n.size);
+    if (n.binPrev != Unused) {
+        nodes[n.binPrev].binNext = n.binNext;
+    } else {
+        binHeads[bin] = n.binNext;
+        if (binHeads[bin] == Unused) {
+            leafBins[bin / LeafBins] &= static_cast<uint8_t>(~(1u << (bin % LeafBins)));
+            if (!leafBins[bin / LeafBins]) {
+                topBins &= ~(1u << (bin / LeafBins));
+            }
+        }
+    }
+    if (n.binNext != Unused) {
+        nodes[n.binNext].binPrev = n.binPrev;
+    }
+    n.binPrev = n.binNext = Unused;
+    freeUnits -= n.size;
+}
+
+uint32_t OffsetAllocator::findFreeBin(uint32_t minBin) const {
+    uint32_t top = minBin / LeafBins;
+    uint32_t leafMask = leafBins[top] & (0xFFu << (minBin % LeafBins)) & 0xFFu;
+    if (leafMask) {
+        return top * LeafBins + LowestBit(leafMask);
+    }
+    uint32_t topMask = top + 1 < 32 ? topBins & (0xFFFFFFFFu << (top + 1)) : 0;
+    if (!topMask) {
+        return Unused;
+    }
+    top = LowestBit(topMask);
+    return top * LeafBins + LowestBit(leafBins[top]);
+}
+
+OffsetAllocator::Allocation OffsetAllocator::allocate(uint32_t size) {
+    Allocation allocation;
+    if (size == 0 || size > freeUnits) {
+        return allocation;
+    }
+    uint32_t bin = findFreeBin(BinRoundUp(size));
+    if (bin == Unused) {
+        return allocation;
+    }
+
+    uint32_t node = binHeads[bin];
+    removeFree(node);
+    nodes[node].used = true;
+
+    // Return the tail beyond the request to the free lists.
+    uint32_t remainder = nodes[node].size - size;
+    if (remainder > 0) {
+        uint32_t tail = newNode();
+        Node &n = nodes[node];
+        nodes[tail].offset = n.offset + size;
+        nodes[tail].size = remainder;
+        nodes[tail].neighborPrev = node;
+        nodes[tail].neighborNext = n.neighborNext;
+        if (n.neighborNext != Unused) {
+            nodes[n.neighborNext].neighborPrev = tail;
+        } else {
+            lastNode = tail;
+        }
+        n.neighborNext = tail;
+        n.size = size;
+        insertFree(tail);
+    }
+
+    allocation.offset = nodes[node].offset;
+    allocation.node = node;
+    return allocation;
+}
+
+void OffsetAllocator::free(Allocation allocation) {
+    if (!allocation.valid()) {
+        return;
+    }
+    uint32_t node = allocation.node;
+    nodes[node].used = false;
+
+    uint32_t prev = nodes[node].neighborPrev;
+    if (prev != Unused && !nodes[prev].used) {
+        removeFree(prev);
+        nodes[prev].size += nodes[node].size;
+        nodes[prev].neighborNext = nodes[node].neighborNext;
+        if (nodes[node].neighborNext != Unused) {
+            nodes[nodes[node].neighborNext].neighborPrev = prev;
+        } else {
+            lastNode = prev;
+        }
+        spareNodes.push_back(node);
+        node = prev;
+    }
+
+    uint32_t next = nodes[node].neighborNext;
+    if (next != Unused && !nodes[next].used) {
+        removeFree(next);
+        nodes[node].size += nodes[next].size;
+        nodes[node].neighborNext = nodes[next].neighborNext;
+        if (nodes[next].neighborNext != Unused) {
+            nodes[nodes[next].neighborNext].neighborPrev = node;
+        } else {
+            lastNode = node;
+        }
+        spareNodes.push_back(next);
+    }
+
+    insertFree(node);
+}
+
+void OffsetAllocator::grow(uint32_t newSize) {
+    if (newSize <= totalSize) {
+        return;
+    }
+    uint32_t added = newSize - totalSize;
+    if (lastNode != Unused && !nodes[lastNode].used) {
+        removeFree(lastNode);
+        nodes[lastNode].size += added;
+        insertFree(lastNode);
+    } else {
+        uint32_t node = newNode();
+        nodes[node].offset = totalSize;
+        nodes[node].size = added;
+        nodes[node].neighborPrev = lastNode;
+        if (lastNode != Unused) {
+            nodes[lastNode].neighborNext = node;
+        }
+        lastNode = node;
+        insertFree(node);
+    }
+    totalSize = newSize;
+}
+
+uint32_t OffsetAllocator::largestFreeRegion() const {
+    if (!topBins) {
+        return 0;
+    }
+    uint32_t top = HighestBit(topBins);
+    uint32_t bin = top * LeafBins + HighestBit(leafBins[top]);
+    uint32_t largest = 0;
+    for (uint32_t node = binHeads[bin]; node != Unused; node = nodes[node].binNext) {
+        largest = std::max(largest, nodes[node].size);
+    }
+    return largest;
+}
+
+uint32_t OffsetAllocator::allocationSize(Allocation allocation) const {
+    return allocation.valid() ? nodes[allocation.node].size : 0;
+}
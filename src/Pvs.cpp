@@ -0,0 +1,371 @@
+#include "Pvs.h"
+#include "FrustumCuller.h"
+#include "MappedFile.h"
+#include "SpatialIndex.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace {
+
+const char PvsMagic[4] = {'T', 'P', 'V', 'S'};
+
+struct PvsHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t objectCount;
+    uint32_t cellsX;
+    uint32_t cellsZ;
+    float gridMin[2];
+    float cellSize;
+    float eyeMin;
+    float eyeMax;
+    uint64_t dataSize;
+};
+
+static_assert(sizeof(PvsHeader) == 48, "pvs header layout changed");
+
+// Zero bytes become a 0 followed by the run length (1-255); anything else is
+// stored as is. Visibility bitsets are mostly zeros, so this is enough.
+void CompressBits(const std::vector<uint8_t> &bits, std::vector<uint8_t> &out) {
+    for (size_t i = 0; i < bits.size();) {
+        if (bits[i] != 0) {
+            out.push_back(bits[i++]);
+            continue;
+        }
+        size_t run = 1;
+        while (i + run < bits.size() && bits[i + run] == 0 && run < 255) {
+            ++run;
+        }
+        out.push_back(0);
+        out.push_back(static_cast<uint8_t>(run));
+        i += run;
+    }
+}
+
+// Whether a cell's stream is well formed: every zero byte is followed by a
+// run length of 1-255, and the stream expands to exactly bitsetBytes bytes.
+bool CellStreamValid(const uint8_t *data, size_t size, size_t bitsetBytes) {
+    size_t expanded = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0) {
+            ++expanded;
+            continue;
+        }
+        if (++i == size || data[i] == 0) {
+            return false;
+        }
+        expanded += data[i];
+    }
+    return expanded == bitsetBytes;
+}
+
+// Whether the segment [0, distance] of the ray enters the oriented box.
+bool RayHitsBox(const glm::mat4 &inverseModel, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+                const glm::vec3 &origin, const glm::vec3 &direction, float distance) {
+    // Affine, so t keeps its meaning in object space.
+    glm::vec3 localOrigin = glm::vec3(inverseModel * glm::vec4(origin, 1.0f));
+    glm::vec3 localDirection = glm::vec3(inverseModel * glm::vec4(direction, 0.0f));
+    float enter = 0.0f, exit = distance;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (std::fabs(localDirection[axis]) < 1e-12f) {
+            if (localOrigin[axis] < boundsMin[axis] || localOrigin[axis] > boundsMax[axis]) {
+                return false;
+            }
+            continue;
+        }
+        float t0 = (boundsMin[axis] - localOrigin[axis]) / localDirection[axis];
+        float t1 = (boundsMax[axis] - localOrigin[axis]) / localDirection[axis];
+        enter = std::max(enter, std::min(t0, t1));
+        exit = std::min(exit, std::max(t0, t1));
+        if (enter > exit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+float DistanceBetweenBoxes(const glm::vec3 &aMin, const glm::vec3 &aMax, const glm::vec3 &bMin, const glm::vec3 &bMax) {
+    glm::vec3 gap = glm::max(glm::max(aMin - bMax, bMin - aMax), glm::vec3(0.0f));
+    return glm::length(gap);
+}
+
+} // namespace
+
+int PvsData::cellAt(const glm::vec3 &position) const {
+    if (!valid() || position.y < eyeMin || position.y > eyeMax) {
+        return -1;
+    }
+    int x = int(std::floor((position.x - gridMin.x) / cellSize));
+    int z = int(std::floor((position.z - gridMin.y) / cellSize));
+    if (x < 0 || z < 0 || x >= int(cellsX) || z >= int(cellsZ)) {
+        return -1;
+    }
+    return z * int(cellsX) + x;
+}
+
+const std::vector<uint32_t> &PvsData::visibleObjects(int cell) {
+    if (cell == decodedCell) {
+        return decoded;
+    }
+    decoded.clear();
+    decodedCell = cell;
+    if (cell < 0 || size_t(cell) >= cellCount()) {
+        return decoded;
+    }
+
+    uint32_t bit = 0;
+    for (uint32_t i = cellOffsets[cell]; i < cellOffsets[cell + 1] && bit < objects; ++i) {
+        uint8_t byte = compressed[i];
+        if (byte == 0) {
+            bit += 8u * compressed[++i];
+            continue;
+        }
+        for (int b = 0; b < 8; ++b) {
+            if (((byte >> b) & 1) && bit + b < objects) {
+                decoded.push_back(bit + b);
+            }
+        }
+        bit += 8;
+    }
+    return decoded;
+}
+
+bool BuildPvs(const std::vector<PvsObject> &objects, const std::vector<PvsOccluder> &occluders,
+              const PvsBuildSettings &settings, PvsData &pvs) {
+    auto start = std::chrono::steady_clock::now();
+
+    // The grid covers the static objects.
+    glm::vec2 gridMin(FLT_MAX), gridMax(-FLT_MAX);
+    for (const PvsObject &object : objects) {
+        if (!object.dynamic) {
+            gridMin = glm::min(gridMin, glm::vec2(object.boundsMin.x, object.boundsMin.z));
+            gridMax = glm::max(gridMax, glm::vec2(object.boundsMax.x, object.boundsMax.z));
+        }
+    }
+    if (gridMin.x > gridMax.x || settings.cellSize <= 0.0f || settings.eyeMax < settings.eyeMin) {
+        std::cerr << "Nothing to build a PVS for." << std::endl;
+        return false;
+    }
+
+    PvsData result;
+    result.gridMin = gridMin;
+    result.cellSize = settings.cellSize;
+    result.eyeMin = settings.eyeMin;
+    result.eyeMax = settings.eyeMax;
+    result.cellsX = std::max(1u, uint32_t(std::ceil((gridMax.x - gridMin.x) / settings.cellSize)));
+    result.cellsZ = std::max(1u, uint32_t(std::ceil((gridMax.y - gridMin.y) / settings.cellSize)));
+    result.objects = static_cast<uint32_t>(objects.size());
+    size_t cellCount = result.cellCount();
+    size_t bytesPerCell = (objects.size() + 7) / 8;
+
+    // Broad phase over the occluders' world-space boxes.
+    glm::vec2 indexMin = gridMin - glm::vec2(settings.maxDistance), indexMax = gridMax + glm::vec2(settings.maxDistance);
+    SpatialIndex occluderIndex(indexMin, indexMax);
+    std::vector<glm::mat4> inverseModels(occluders.size());
+    for (size_t i = 0; i < occluders.size(); ++i) {
+        glm::vec3 worldMin, worldMax;
+        TransformBounds(occluders[i].modelMatrix, occluders[i].boundsMin, occluders[i].boundsMax, worldMin, worldMax);
+        occluderIndex.insert(worldMin, worldMax, static_cast<uint32_t>(i));
+        inverseModels[i] = glm::inverse(occluders[i].modelMatrix);
+    }
+
+    std::vector<std::vector<uint8_t>> cellBits(cellCount);
+    std::atomic<size_t> nextCell{0};
+    auto worker = [&]() {
+        SpatialIndex index = occluderIndex; // queries keep per-index stats, so each thread has its own copy
+        std::vector<RayHit> hits;
+        std::vector<glm::vec3> eyes(settings.samplesPerCell);
+        for (size_t cell = nextCell++; cell < cellCount; cell = nextCell++) {
+            std::mt19937 rng(static_cast<uint32_t>(cell * 2654435761u + 1));
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+            glm::vec3 cellMin(gridMin.x + (cell % result.cellsX) * settings.cellSize, settings.eyeMin,
+                              gridMin.y + (cell / result.cellsX) * settings.cellSize);
+            glm::vec3 cellMax = cellMin + glm::vec3(settings.cellSize, settings.eyeMax - settings.eyeMin, settings.cellSize);
+            // Jittered over a grid in XZ so the eyes cover the whole cell.
+            int strata = std::max(1, int(std::ceil(std::sqrt(float(eyes.size())))));
+            for (size_t e = 0; e < eyes.size(); ++e) {
+                glm::vec3 jitter((int(e) % strata + unit(rng)) / strata, unit(rng), (int(e) / strata % strata + unit(rng)) / strata);
+                eyes[e] = cellMin + jitter * (cellMax - cellMin);
+            }
+
+            std::vector<uint8_t> bits(bytesPerCell, 0);
+            for (uint32_t id = 0; id < objects.size(); ++id) {
+                const PvsObject &object = objects[id];
+                bool visible = object.dynamic;
+                if (!visible && DistanceBetweenBoxes(cellMin, cellMax, object.boundsMin, object.boundsMax) > settings.maxDistance) {
+                    continue;
+                }
+                // Rays from one cell to one object are mostly stopped by the
+                // same building, so the last blocker is tried before the index.
+                int lastBlocker = -1;
+                for (size_t e = 0; e < eyes.size() && !visible; ++e) {
+                    for (int ray = 0; ray < settings.raysPerObject && !visible; ++ray) {
+                        glm::vec3 target = object.boundsMin + glm::vec3(unit(rng), unit(rng), unit(rng)) * (object.boundsMax - object.boundsMin);
+                        glm::vec3 direction = target - eyes[e];
+                        float distance = glm::length(direction);
+                        if (distance < 1e-4f) {
+                            visible = true;
+                            break;
+                        }
+                        direction /= distance;
+                        if (lastBlocker >= 0 && RayHitsBox(inverseModels[lastBlocker], occluders[lastBlocker].boundsMin,
+                                                           occluders[lastBlocker].boundsMax, eyes[e], direction, distance)) {
+                            continue;
+                        }
+                        hits.clear();
+                        index.queryRay(eyes[e], direction, distance, hits);
+                        bool blocked = false;
+                        for (const RayHit &hit : hits) {
+                            const PvsOccluder &occluder = occluders[hit.id];
+                            if (occluder.owner != id &&
+                                RayHitsBox(inverseModels[hit.id], occluder.boundsMin, occluder.boundsMax, eyes[e], direction, distance)) {
+                                blocked = true;
+                                lastBlocker = static_cast<int>(hit.id);
+                                break;
+                            }
+                        }
+                        visible = !blocked;
+                    }
+                }
+                if (visible) {
+                    bits[id >> 3] |= uint8_t(1u << (id & 7));
+                }
+            }
+            cellBits[cell] = std::move(bits);
+        }
+    };
+
+    unsigned threadCount = settings.threadCount ? settings.threadCount : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // Each cell also takes its neighbours' sets, which hides most of the
+    // objects the sampling missed near cell borders.
+    int dilate = std::max(settings.dilateCells, 0);
+    std::vector<uint8_t> bits(bytesPerCell);
+    size_t visibleTotal = 0;
+    result.cellOffsets.push_back(0);
+    for (size_t cell = 0; cell < cellCount; ++cell) {
+        int cellX = int(cell % result.cellsX), cellZ = int(cell / result.cellsX);
+        std::fill(bits.begin(), bits.end(), 0);
+        for (int z = std::max(cellZ - dilate, 0); z <= std::min(cellZ + dilate, int(result.cellsZ) - 1); ++z) {
+            for (int x = std::max(cellX - dilate, 0); x <= std::min(cellX + dilate, int(result.cellsX) - 1); ++x) {
+                const std::vector<uint8_t> &neighbour = cellBits[size_t(z) * result.cellsX + x];
+                for (size_t i = 0; i < bytesPerCell; ++i) {
+                    bits[i] |= neighbour[i];
+                }
+            }
+        }
+        for (uint8_t byte : bits) {
+            for (; byte; byte &= byte - 1) {
+                ++visibleTotal;
+            }
+        }
+        CompressBits(bits, result.compressed);
+        result.cellOffsets.push_back(static_cast<uint32_t>(result.compressed.size()));
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Built PVS: " << result.cellsX << "x" << result.cellsZ << " cells, " << objects.size() << " objects, "
+              << double(visibleTotal) / cellCount << " visible per cell on average, " << result.compressed.size() << " bytes ("
+              << bytesPerCell * cellCount << " uncompressed) in " << seconds << " s." << std::endl;
+    pvs = std::move(result);
+    return true;
+}
+
+bool LoadPvs(const std::string &path, size_t objectCount, PvsData &pvs) {
+    MappedFile file;
+    if (!file.open(path)) {
+        return false;
+    }
+    PvsHeader header;
+    if (file.size() < sizeof(header)) {
+        std::cerr << "Malformed PVS file: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, PvsMagic, 4) != 0 || header.version != PvsVersion) {
+        std::cout << "PVS file is stale: " << path << std::endl;
+        return false;
+    }
+    if (header.objectCount != objectCount) {
+        std::cout << "PVS file was built for " << header.objectCount << " objects, the scene has " << objectCount << ": " << path << std::endl;
+        return false;
+    }
+    size_t cellCount = size_t(header.cellsX) * header.cellsZ;
+    size_t tableSize = (cellCount + 1) * sizeof(uint32_t);
+    if (cellCount == 0 || file.size() != sizeof(header) + tableSize + header.dataSize) {
+        std::cerr << "Malformed PVS file: " << path << std::endl;
+        return false;
+    }
+
+    PvsData result;
+    result.gridMin = glm::vec2(header.gridMin[0], header.gridMin[1]);
+    result.cellSize = header.cellSize;
+    result.eyeMin = header.eyeMin;
+    result.eyeMax = header.eyeMax;
+    result.cellsX = header.cellsX;
+    result.cellsZ = header.cellsZ;
+    result.objects = header.objectCount;
+    result.cellOffsets.resize(cellCount + 1);
+    std::memcpy(result.cellOffsets.data(), file.data() + sizeof(header), tableSize);
+    result.compressed.assign(file.data() + sizeof(header) + tableSize, file.data() + file.size());
+    size_t bitsetBytes = (size_t(header.objectCount) + 7) / 8;
+    for (size_t i = 0; i < cellCount; ++i) {
+        uint32_t begin = result.cellOffsets[i], end = result.cellOffsets[i + 1];
+        if (begin > end || end > header.dataSize ||
+            !CellStreamValid(result.compressed.data() + begin, end - begin, bitsetBytes)) {
+            std::cerr << "Malformed PVS file: " << path << std::endl;
+            return false;
+        }
+    }
+    pvs = std::move(result);
+    std::cout << "Loaded PVS: " << path << std::endl;
+    return true;
+}
+
+bool WritePvs(const std::string &path, const PvsData &pvs) {
+    PvsHeader header = {};
+    std::memcpy(header.magic, PvsMagic, 4);
+    header.version = PvsVersion;
+    header.objectCount = pvs.objects;
+    header.cellsX = pvs.cellsX;
+    header.cellsZ = pvs.cellsZ;
+    header.gridMin[0] = pvs.gridMin.x;
+    header.gridMin[1] = pvs.gridMin.y;
+    header.cellSize = pvs.cellSize;
+    header.eyeMin = pvs.eyeMin;
+    header.eyeMax = pvs.eyeMax;
+    header.dataSize = pvs.compressed.size();
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to write PVS file: " << path << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(pvs.cellOffsets.data(), sizeof(uint32_t), pvs.cellOffsets.size(), file) == pvs.cellOffsets.size() &&
+              fwrite(pvs.compressed.data(), 1, pvs.compressed.size(), file) == pvs.compressed.size();
+    fclose(file);
+    if (!ok) {
+        std::cerr << "Failed to write PVS file: " << path << std::endl;
+        std::remove(path.c_str());
+        return false;
+    }
+    std::cout << "Wrote PVS file: " << path << std::endl;
+    return true;
+}
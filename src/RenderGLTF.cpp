@@ -1,77 +1,470 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include "RenderGLTF.h"
+#include "AccessorView.h"
+#include "GeometryPool.h"
+#include "GLStateCache.h"
 #include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
 #include <glm/glm.hpp>
 
-void CreateMeshFromGLTF(const tinygltf::Model &model, const tinygltf::Mesh &gltfMesh, std::vector<Mesh> &meshes) {
+// Byte range [begin, end) an accessor occupies inside its buffer.
+struct AccessorRange {
+    size_t begin;
+    size_t end;
+};
+
+static AccessorRange GetAccessorRange(const tinygltf::Model &model, const tinygltf::Accessor &accessor) {
+    const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+    size_t elementSize = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+    size_t stride = accessor.ByteStride(view);
+    size_t begin = view.byteOffset + accessor.byteOffset;
+    size_t end = accessor.count == 0 ? begin : begin + stride * (accessor.count - 1) + elementSize;
+    return {begin, end};
+}
+
+// Object-space bounds from the POSITION accessor's min/max (mandatory in
+// glTF 2.0), falling back to the decoded vertices when an exporter omits them.
+static void ComputeBounds(const tinygltf::Accessor &posAccessor, MeshData &data) {
+    if (posAccessor.minValues.size() == 3 && posAccessor.maxValues.size() == 3) {
+        data.boundsMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
+        data.boundsMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
+        return;
+    }
+    if (data.vertices.empty()) {
+        std::cerr << "POSITION accessor without min/max; bounds left empty.\n";
+        return;
+    }
+    data.boundsMin = data.boundsMax = data.vertices[0].Position;
+    for (const Vertex &vertex : data.vertices) {
+        data.boundsMin = glm::min(data.boundsMin, vertex.Position);
+        data.boundsMax = glm::max(data.boundsMax, vertex.Position);
+    }
+}
+
+// Only dense, in-bounds accessors stored in a buffer view can be handed to
+// GL in place. Those without a view (zero-filled) or with sparse
+// substitutions go through the decoding path.
+static bool AccessorIsMappable(const GLTFAsset &asset, int accessorIndex) {
+    AccessorView view;
+    if (!MakeAccessorView(asset, accessorIndex, view)) {
+        return false;
+    }
+    const tinygltf::Accessor &accessor = asset.model.accessors[accessorIndex];
+    return !accessor.sparse.isSparse && accessor.bufferView >= 0;
+}
+
+// The mapped vertex range runs from the first attribute view to the end of
+// the last, so it is only uploaded as-is when the views sit in one buffer
+// back to back (up to the 4-byte alignment padding glTF allows). Anything in
+// between would be another mesh's data or an image.
+static bool PrimitiveIsMappable(const GLTFAsset &asset, const tinygltf::Primitive &primitive) {
+    const tinygltf::Model &model = asset.model;
+    std::vector<std::pair<size_t, size_t>> views;
+    int buffer = -1;
+    for (const char *name : {"POSITION", "NORMAL", "TEXCOORD_0"}) {
+        auto it = primitive.attributes.find(name);
+        if (it == primitive.attributes.end()) {
+            continue;
+        }
+        if (!AccessorIsMappable(asset, it->second)) {
+            return false;
+        }
+        const tinygltf::BufferView &view = model.bufferViews[model.accessors[it->second].bufferView];
+        if (buffer >= 0 && view.buffer != buffer) {
+            return false;
+        }
+        buffer = view.buffer;
+        views.push_back({view.byteOffset, view.byteOffset + view.byteLength});
+    }
+    std::sort(views.begin(), views.end());
+    for (size_t i = 1; i < views.size(); ++i) {
+        if (views[i].first > views[i - 1].second + 3) {
+            return false;
+        }
+        views[i].second = std::max(views[i].second, views[i - 1].second);
+    }
+    return primitive.indices < 0 || AccessorIsMappable(asset, primitive.indices);
+}
+
+// Zero-copy path: the vertex range spans the primitive's attributes and the
+// index range covers the index accessor, both inside the mapped BIN chunk.
+// GL consumes the stored component types, strides and normalization as-is.
+static void DecodeMappedPrimitive(const GLTFAsset &asset, const tinygltf::Primitive &primitive, std::vector<MeshData> &meshData) {
+    static const std::pair<const char *, GLuint> attributeLocations[] = {
+        {"POSITION", 0}, {"NORMAL", 1}, {"TEXCOORD_0", 2}};
+
+    const tinygltf::Model &model = asset.model;
+    auto position = primitive.attributes.find("POSITION");
+    if (position == primitive.attributes.end() || primitive.indices < 0) {
+        std::cerr << "Skipping primitive without POSITION or indices.\n";
+        return;
+    }
+    int vertexBuffer = model.bufferViews[model.accessors[position->second].bufferView].buffer;
+
+    size_t begin = SIZE_MAX;
+    size_t end = 0;
+    for (const auto &attribute : attributeLocations) {
+        auto it = primitive.attributes.find(attribute.first);
+        if (it == primitive.attributes.end()) {
+            continue;
+        }
+        const tinygltf::Accessor &accessor = model.accessors[it->second];
+        if (model.bufferViews[accessor.bufferView].buffer != vertexBuffer) {
+            std::cerr << "Skipping primitive with attributes spread over several buffers.\n";
+            return;
+        }
+        AccessorRange range = GetAccessorRange(model, accessor);
+        begin = std::min(begin, range.begin);
+        end = std::max(end, range.end);
+    }
+
+    const tinygltf::Accessor &indexAccessor = model.accessors[primitive.indices];
+    int indexBuffer = model.bufferViews[indexAccessor.bufferView].buffer;
+    AccessorRange indexRange = GetAccessorRange(model, indexAccessor);
+
+    const unsigned char *vertexData = asset.bufferData(vertexBuffer);
+    const unsigned char *indexData = asset.bufferData(indexBuffer);
+    if (!vertexData || !indexData) {
+        std::cerr << "Skipping primitive with unresolved buffer data.\n";
+        return;
+    }
+
+    MeshData data;
+    data.vertexBytes = vertexData + begin;
+    data.vertexByteSize = end - begin;
+
+    // Index bytes are only referenced in place when the stored type is
+    // already the narrowest that fits; otherwise they are repacked.
+    AccessorView indexView;
+    if (!MakeAccessorView(asset, primitive.indices, indexView)) {
+        std::cerr << "Skipping primitive with unreadable indices.\n";
+        return;
+    }
+    data.indices.resize(indexView.count);
+    ReadAccessorIndices(indexView, data.indices.data());
+    unsigned int maxIndex = data.indices.empty() ? 0 : *std::max_element(data.indices.begin(), data.indices.end());
+    if (SmallestIndexType(maxIndex) == static_cast<GLenum>(indexAccessor.componentType) && indexView.stride == IndexTypeSize(indexAccessor.componentType)) {
+        data.indices.clear();
+        data.indexBytes = indexData + indexRange.begin;
+        data.indexByteSize = indexRange.end - indexRange.begin;
+        data.indexType = indexAccessor.componentType;
+    } else {
+        PackIndices(data);
+    }
+
+    for (const auto &attribute : attributeLocations) {
+        auto it = primitive.attributes.find(attribute.first);
+        if (it == primitive.attributes.end()) {
+            continue;
+        }
+        const tinygltf::Accessor &accessor = model.accessors[it->second];
+        const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+        data.attributes.push_back({attribute.second, tinygltf::GetNumComponentsInType(accessor.type), static_cast<GLenum>(accessor.componentType),
+                                   accessor.normalized ? GLboolean(GL_TRUE) : GLboolean(GL_FALSE), static_cast<GLsizei>(view.byteStride),
+                                   GetAccessorRange(model, accessor).begin - begin});
+    }
+
+    data.vertexCount = model.accessors[position->second].count;
+    data.indexCount = static_cast<GLsizei>(indexAccessor.count);
+    ComputeBounds(model.accessors[position->second], data);
+
+    meshData.push_back(std::move(data));
+}
+
+void DecodeMeshFromGLTF(const GLTFAsset &asset, const tinygltf::Mesh &gltfMesh, std::vector<MeshData> &meshData) {
+    const tinygltf::Model &model = asset.model;
     for (const auto &primitive : gltfMesh.primitives) {
-        Mesh mesh;
-        const tinygltf::Accessor &posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
-        const tinygltf::Accessor &normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
-        const tinygltf::Accessor &texAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-
-        const tinygltf::BufferView &posView = model.bufferViews[posAccessor.bufferView];
-        const tinygltf::BufferView &normView = model.bufferViews[normAccessor.bufferView];
-        const tinygltf::BufferView &texView = model.bufferViews[texAccessor.bufferView];
-
-        const tinygltf::Buffer &posBuffer = model.buffers[posView.buffer];
-        const tinygltf::Buffer &normBuffer = model.buffers[normView.buffer];
-        const tinygltf::Buffer &texBuffer = model.buffers[texView.buffer];
-
-        for (size_t i = 0; i < posAccessor.count; ++i) {
-            Vertex vertex;
-            const float* pos = reinterpret_cast<const float*>(&posBuffer.data[posView.byteOffset + posAccessor.byteOffset + i * sizeof(glm::vec3)]);
-            const float* norm = reinterpret_cast<const float*>(&normBuffer.data[normView.byteOffset + normAccessor.byteOffset + i * sizeof(glm::vec3)]);
-            const float* tex = reinterpret_cast<const float*>(&texBuffer.data[texView.byteOffset + texAccessor.byteOffset + i * sizeof(glm::vec2)]);
-
-            vertex.Position = glm::vec3(pos[0], pos[1], pos[2]);
-            vertex.Normal = glm::vec3(norm[0], norm[1], norm[2]);
-            vertex.TexCoords = glm::vec2(tex[0], tex[1]);
-
-            mesh.vertices.push_back(vertex);
+        if (asset.isMapped() && PrimitiveIsMappable(asset, primitive)) {
+            DecodeMappedPrimitive(asset, primitive, meshData);
+            continue;
+        }
+
+        auto position = primitive.attributes.find("POSITION");
+        if (position == primitive.attributes.end()) {
+            std::cerr << "Skipping primitive without POSITION.\n";
+            continue;
+        }
+        AccessorView posView;
+        if (!MakeAccessorView(asset, position->second, posView)) {
+            std::cerr << "Skipping primitive with unreadable POSITION.\n";
+            continue;
         }
 
-        const tinygltf::Accessor &indexAccessor = model.accessors[primitive.indices];
-        const tinygltf::BufferView &indexView = model.bufferViews[indexAccessor.bufferView];
-        const tinygltf::Buffer &indexBuffer = model.buffers[indexView.buffer];
+        MeshData mesh;
+        mesh.vertices.resize(posView.count);
+        Vertex *vertices = mesh.vertices.data();
+        ReadAccessorFloats(posView, &vertices->Position, sizeof(Vertex), 3);
+
+        // Optional attributes must match the vertex count; otherwise they stay zero.
+        static const std::pair<const char *, size_t> optionalAttributes[] = {
+            {"NORMAL", offsetof(Vertex, Normal)}, {"TEXCOORD_0", offsetof(Vertex, TexCoords)}};
+        for (const auto &attribute : optionalAttributes) {
+            auto it = primitive.attributes.find(attribute.first);
+            AccessorView view;
+            int components = attribute.second == offsetof(Vertex, TexCoords) ? 2 : 3;
+            unsigned char *target = reinterpret_cast<unsigned char *>(vertices) + attribute.second;
+            if (it != primitive.attributes.end() && MakeAccessorView(asset, it->second, view) && view.count == posView.count) {
+                ReadAccessorFloats(view, target, sizeof(Vertex), components);
+            } else {
+                for (size_t i = 0; i < posView.count; ++i) {
+                    std::memset(target + i * sizeof(Vertex), 0, components * sizeof(float));
+                }
+            }
+        }
 
-        for (size_t i = 0; i < indexAccessor.count; ++i) {
-            const unsigned short* index = reinterpret_cast<const unsigned short*>(&indexBuffer.data[indexView.byteOffset + indexAccessor.byteOffset + i * sizeof(unsigned short)]);
-            mesh.indices.push_back(*index);
+        AccessorView indexView;
+        if (primitive.indices >= 0 && MakeAccessorView(asset, primitive.indices, indexView)) {
+            mesh.indices.resize(indexView.count);
+            ReadAccessorIndices(indexView, mesh.indices.data());
+        } else {
+            // Non-indexed primitive: draw the vertices in order.
+            mesh.indices.resize(posView.count);
+            for (size_t i = 0; i < posView.count; ++i) {
+                mesh.indices[i] = static_cast<unsigned int>(i);
+            }
         }
 
+        mesh.attributes = {
+            {0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0},
+            {1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal)},
+            {2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoords)},
+        };
+        mesh.vertexCount = mesh.vertices.size();
+        mesh.indexCount = static_cast<GLsizei>(mesh.indices.size());
+        ComputeBounds(model.accessors[position->second], mesh);
+
+        meshData.push_back(std::move(mesh));
+    }
+}
+
+const void *MeshData::vertexSource() const {
+    return vertices.empty() ? static_cast<const void*>(vertexBytes) : vertices.data();
+}
+
+size_t MeshData::vertexSourceSize() const {
+    return vertices.empty() ? vertexByteSize : vertices.size() * sizeof(Vertex);
+}
+
+const void *MeshData::indexSource() const {
+    if (!packedIndices.empty()) {
+        return packedIndices.data();
+    }
+    return indices.empty() ? static_cast<const void*>(indexBytes) : indices.data();
+}
+
+size_t MeshData::indexSourceSize() const {
+    if (!packedIndices.empty()) {
+        return packedIndices.size();
+    }
+    return indices.empty() ? indexByteSize : indices.size() * sizeof(unsigned int);
+}
+
+GLenum SmallestIndexType(unsigned int maxIndex) {
+    if (maxIndex <= 0xFFu) {
+        return GL_UNSIGNED_BYTE;
+    }
+    if (maxIndex <= 0xFFFFu) {
+        return GL_UNSIGNED_SHORT;
+    }
+    return GL_UNSIGNED_INT;
+}
+
+size_t IndexTypeSize(GLenum indexType) {
+    switch (indexType) {
+    case GL_UNSIGNED_BYTE: return 1;
+    case GL_UNSIGNED_SHORT: return 2;
+    default: return 4;
+    }
+}
+
+template <typename T>
+static void NarrowIndices(const std::vector<unsigned int> &indices, unsigned char *out) {
+    T *narrowed = reinterpret_cast<T*>(out);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        narrowed[i] = static_cast<T>(indices[i]);
+    }
+}
+
+void PackIndices(MeshData &data) {
+    if (data.indices.empty()) {
+        return;
+    }
+    unsigned int maxIndex = *std::max_element(data.indices.begin(), data.indices.end());
+    data.indexType = SmallestIndexType(maxIndex);
+    data.indexCount = static_cast<GLsizei>(data.indices.size());
+    data.packedIndices.resize(data.indices.size() * IndexTypeSize(data.indexType));
+    switch (data.indexType) {
+    case GL_UNSIGNED_BYTE: NarrowIndices<uint8_t>(data.indices, data.packedIndices.data()); break;
+    case GL_UNSIGNED_SHORT: NarrowIndices<uint16_t>(data.indices, data.packedIndices.data()); break;
+    default: std::memcpy(data.packedIndices.data(), data.indices.data(), data.packedIndices.size()); break;
+    }
+    data.indices = std::vector<unsigned int>();
+}
+
+void ReadMeshVertices(const MeshData &data, std::vector<Vertex> &vertices) {
+    if (!data.vertices.empty()) {
+        vertices = data.vertices;
+        return;
+    }
+    vertices.assign(data.vertexCount, Vertex{glm::vec3(0.0f), glm::vec3(0.0f), glm::vec2(0.0f)});
+    static const size_t offsets[] = {offsetof(Vertex, Position), offsetof(Vertex, Normal), offsetof(Vertex, TexCoords)};
+    for (const auto &attribute : data.attributes) {
+        if (attribute.location > 2) {
+            continue;
+        }
+        AccessorView view;
+        view.data = static_cast<const unsigned char*>(data.vertexSource()) + attribute.offset;
+        view.count = data.vertexCount;
+        view.componentType = static_cast<int>(attribute.type);
+        view.components = attribute.size;
+        view.normalized = attribute.normalized == GL_TRUE;
+        view.stride = attribute.stride ? static_cast<size_t>(attribute.stride) : static_cast<size_t>(attribute.size) * tinygltf::GetComponentSizeInBytes(attribute.type);
+        ReadAccessorFloats(view, reinterpret_cast<unsigned char*>(vertices.data()) + offsets[attribute.location],
+                           sizeof(Vertex), attribute.location == 2 ? 2 : 3);
+    }
+}
+
+void ReadMeshIndices(const MeshData &data, std::vector<unsigned int> &indices, size_t count) {
+    if (!data.indices.empty()) {
+        indices.assign(data.indices.begin(), data.indices.begin() + std::min(count, data.indices.size()));
+        return;
+    }
+    AccessorView indexView;
+    indexView.data = static_cast<const unsigned char*>(data.indexSource());
+    indexView.count = std::min(count, static_cast<size_t>(data.indexCount));
+    indexView.componentType = static_cast<int>(data.indexType);
+    indexView.components = 1;
+    indexView.stride = IndexTypeSize(data.indexType);
+    indices.resize(indexView.count);
+    ReadAccessorIndices(indexView, indices.data());
+}
+
+// Reads the retained geometry back out of whatever representation the mesh
+// data is in. Only the full-detail LOD's indices are kept.
+static std::shared_ptr<const MeshGeometry> RetainGeometry(const MeshData &data, GeometryRetention retention) {
+    auto geometry = std::make_shared<MeshGeometry>();
+
+    std::vector<Vertex> vertices;
+    ReadMeshVertices(data, vertices);
+    geometry->positions.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        geometry->positions[i] = vertices[i].Position;
+    }
+    if (retention == GeometryRetention::Full) {
+        geometry->vertices = std::move(vertices);
+    }
+
+    ReadMeshIndices(data, geometry->indices, data.lods.empty() ? data.indexCount : data.lods[0].indexCount);
+    return geometry;
+}
+
+Mesh UploadMesh(MeshData &&data, GeometryRetention retention, GeometryPool *pool) {
+    Mesh mesh;
+    PackIndices(data);
+
+    mesh.slot = pool ? pool->upload(data) : nullptr;
+    if (!mesh.slot) {
         glGenVertexArrays(1, &mesh.VAO);
         glGenBuffers(1, &mesh.VBO);
         glGenBuffers(1, &mesh.EBO);
 
-        glBindVertexArray(mesh.VAO);
+        GLStateCache::get().bindVertexArray(mesh.VAO);
+
+        GLStateCache::get().bindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+        glBufferData(GL_ARRAY_BUFFER, data.vertexSourceSize(), data.vertexSource(), GL_STATIC_DRAW);
+
+        GLStateCache::get().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indexSourceSize(), data.indexSource(), GL_STATIC_DRAW);
+
+        for (const auto &attribute : data.attributes) {
+            glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, attribute.stride, (void*)attribute.offset);
+            glEnableVertexAttribArray(attribute.location);
+        }
+
+        GLStateCache::get().bindVertexArray(0);
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
-        glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(Vertex), &mesh.vertices[0], GL_STATIC_DRAW);
+    mesh.indexCount = data.indexCount;
+    mesh.indexType = mesh.slot ? mesh.slot->arena->indexType : data.indexType;
+    mesh.lods = data.lods;
+    if (mesh.lods.empty()) {
+        mesh.lods.push_back({0, data.indexCount, 0.0f});
+    }
+    mesh.boundsMin = data.boundsMin;
+    mesh.boundsMax = data.boundsMax;
+    mesh.occluder = data.occluder;
+    if (retention != GeometryRetention::Discard) {
+        mesh.geometry = RetainGeometry(data, retention);
+    }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), &mesh.indices[0], GL_STATIC_DRAW);
+    return mesh;
+}
 
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        glEnableVertexAttribArray(0);
+void CreateMeshFromGLTF(const GLTFAsset &asset, const tinygltf::Mesh &gltfMesh, std::vector<Mesh> &meshes) {
+    std::vector<MeshData> meshData;
+    DecodeMeshFromGLTF(asset, gltfMesh, meshData);
+    for (auto &data : meshData) {
+        meshes.push_back(UploadMesh(std::move(data)));
+    }
+}
 
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        glEnableVertexAttribArray(1);
+void ReleaseMesh(Mesh &mesh) {
+    if (mesh.slot) {
+        mesh.slot->pool->free(mesh.slot);
+        mesh.slot = nullptr;
+        return;
+    }
+    GLStateCache::get().deleteVertexArrays(1, &mesh.VAO);
+    GLStateCache::get().deleteBuffers(1, &mesh.VBO);
+    GLStateCache::get().deleteBuffers(1, &mesh.EBO);
+    mesh.VAO = mesh.VBO = mesh.EBO = 0;
+}
 
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        glEnableVertexAttribArray(2);
+size_t LodSelector::select(const Mesh &mesh, const glm::mat4 &modelMatrix) const {
+    if (mesh.lods.size() < 2 || maxPixelError <= 0.0f) {
+        return 0;
+    }
 
-        glBindVertexArray(0);
+    // Errors are in object space; scale them by the largest axis scale and
+    // measure distance to the nearest point of the world-space bounding sphere.
+    float scale = std::max(glm::length(glm::vec3(modelMatrix[0])),
+                           std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+    glm::vec3 center = glm::vec3(modelMatrix * glm::vec4(0.5f * (mesh.boundsMin + mesh.boundsMax), 1.0f));
+    float radius = 0.5f * glm::length(mesh.boundsMax - mesh.boundsMin) * scale;
+    float distance = glm::length(center - cameraPosition) - radius;
+    if (distance <= 0.0f) {
+        return 0;
+    }
 
-        std::cout << "Mesh created with VAO: " << mesh.VAO << " and " << mesh.indices.size() << " indices.\n";
+    size_t lod = 0;
+    for (size_t i = 1; i < mesh.lods.size(); ++i) {
+        if (mesh.lods[i].error * scale * pixelScale / distance > maxPixelError) {
+            break;
+        }
+        lod = i;
+    }
+    return lod;
+}
 
-        meshes.push_back(mesh);
+DrawRange GetDrawRange(const Mesh &mesh, size_t lod) {
+    const MeshLod &range = mesh.lods[std::min(lod, mesh.lods.size() - 1)];
+    size_t firstIndex = range.indexOffset;
+    DrawRange draw = {mesh.VAO, mesh.indexType, range.indexCount, nullptr, 0};
+    if (mesh.slot) {
+        draw.VAO = mesh.slot->arena->VAO;
+        draw.baseVertex = static_cast<GLint>(mesh.slot->vertices.offset);
+        firstIndex += mesh.slot->indices.offset;
     }
+    draw.indexOffset = (void*)(firstIndex * IndexTypeSize(mesh.indexType));
+    return draw;
 }
 
-void RenderMesh(const Mesh &mesh) {
-    glBindVertexArray(mesh.VAO);
-    glDrawElements(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+void RenderMesh(const Mesh &mesh, size_t lod) {
+    DrawRange draw = GetDrawRange(mesh, lod);
+    GLStateCache::get().bindVertexArray(draw.VAO);
+    glDrawElementsBaseVertex(GL_TRIANGLES, draw.indexCount, draw.indexType, draw.indexOffset, draw.baseVertex);
 }
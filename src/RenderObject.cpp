@@ -1,27 +1,28 @@
 #include "RenderObject.h"
+#include "GLStateCache.h"
 
 RenderObject::RenderObject(float vertices[], std::size_t vertexCount) {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
 
-    glBindVertexArray(VAO);
+    GLStateCache::get().bindVertexArray(VAO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLStateCache::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(float), vertices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    GLStateCache::get().bindBuffer(GL_ARRAY_BUFFER, 0);
+    GLStateCache::get().bindVertexArray(0);
 }
 
 RenderObject::~RenderObject() {
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    GLStateCache::get().deleteVertexArrays(1, &VAO);
+    GLStateCache::get().deleteBuffers(1, &VBO);
 }
 
 void RenderObject::draw() {
-    glBindVertexArray(VAO);
+    GLStateCache::get().bindVertexArray(VAO);
     glDrawArrays(GL_TRIANGLES, 0, 3);
 }
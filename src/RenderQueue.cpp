@@ -0,0 +1,257 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <cstring>
+#include "GLStateCache.h"
+#include "InstanceRenderer.h"
+
+namespace {
+
+// Positive floats order like their bit patterns; keep the top 22 bits.
+uint64_t DepthBits(float depth) {
+    depth = depth > 0.0f ? depth : 0.0f;
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return bits >> 10;
+}
+
+} // namespace
+
+void RenderQueue::clear() {
+    items.clear();
+    keys.clear();
+    materialIds.clear();
+    geometryIds.clear();
+    stream.beginFrame();
+}
+
+void RenderQueue::release() {
+    stream.release();
+    shaderUniforms.clear();
+}
+
+const std::vector<Light> *RenderQueue::resolveLights(const DrawItem &item) const {
+    return item.lights && !item.lights->empty() ? item.lights : sceneLights;
+}
+
+// One block per distinct material and light list, so execute() only binds.
+void RenderQueue::uploadUniforms() {
+    size_t alignment = UniformBufferAlignment();
+    materialBlocks.assign(materialIds.size(), StreamAllocation());
+    for (const auto &entry : materialIds) {
+        if (entry.first) {
+            StreamAllocation &block = materialBlocks[entry.second];
+            block = stream.allocate(sizeof(MaterialUniforms), alignment);
+            if (block.data) {
+                *static_cast<MaterialUniforms *>(block.data) = PackMaterialBlock(*static_cast<const Material *>(entry.first));
+            }
+        }
+    }
+
+    lightBlocks.clear();
+    for (const DrawItem &item : items) {
+        const std::vector<Light> *lights = resolveLights(item);
+        if (lights && lightBlocks.find(lights) == lightBlocks.end()) {
+            StreamAllocation block = stream.allocate(sizeof(LightBlockUniforms), alignment);
+            if (block.data) {
+                *static_cast<LightBlockUniforms *>(block.data) = PackLightBlock(*lights);
+            }
+            lightBlocks.emplace(lights, block);
+        }
+    }
+}
+
+uint64_t RenderQueue::makeKey(const DrawItem &item) {
+    // Ids are handed out in first-seen order each frame, so they only need
+    // to be distinct, not stable.
+    uint64_t material = materialIds.emplace(item.material, static_cast<uint32_t>(materialIds.size())).first->second & 0xFFFFu;
+    uint64_t geometry = geometryIds.emplace(item.draw.VAO, static_cast<uint32_t>(geometryIds.size())).first->second & 0xFFFFu;
+    uint64_t shader = (item.shader ? item.shader->ID : 0) & 0xFFu;
+    uint64_t pass = static_cast<uint64_t>(item.pass) & 0x3u;
+    uint64_t depth = DepthBits(item.depth);
+
+    if (item.pass == RenderPass::Transparent) {
+        uint64_t farFirst = ~depth & 0x3FFFFFu;
+        return (pass << 62) | (farFirst << 40) | (shader << 32) | (material << 16) | geometry;
+    }
+    return (pass << 62) | (shader << 54) | (material << 38) | (geometry << 22) | depth;
+}
+
+void RenderQueue::submit(const DrawItem &item) {
+    keys.push_back(makeKey(item));
+    items.push_back(item);
+}
+
+// LSD radix sort on 8-bit digits, skipping digits every key shares.
+void RenderQueue::sortKeys() {
+    size_t count = keys.size();
+    order.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+    scratchKeys.resize(count);
+    scratchOrder.resize(count);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t histogram[256] = {};
+        for (uint64_t key : keys) {
+            ++histogram[(key >> shift) & 0xFF];
+        }
+        if (histogram[(keys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+        size_t offset = 0;
+        for (size_t &bucket : histogram) {
+            size_t size = bucket;
+            bucket = offset;
+            offset += size;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            size_t target = histogram[(keys[i] >> shift) & 0xFF]++;
+            scratchKeys[target] = keys[i];
+            scratchOrder[target] = order[i];
+        }
+        keys.swap(scratchKeys);
+        order.swap(scratchOrder);
+    }
+}
+
+void RenderQueue::execute() {
+    prepare();
+    draw(RenderPass::Opaque);
+    draw(RenderPass::Transparent);
+    finish();
+}
+
+// Handles survive shader reloads, so each shader is resolved once.
+void RenderQueue::resolveShaderUniforms(Shader *shader) {
+    if (shaderUniforms.find(shader) == shaderUniforms.end()) {
+        shaderUniforms[shader] = {shader->uniform<glm::mat4>("model"), shader->uniform<int>("instanced")};
+    }
+}
+
+void RenderQueue::prepare() {
+    frameStats = RenderQueueStats();
+
+    // What the same draws would cost in submission order.
+    for (size_t i = 0; i < items.size(); ++i) {
+        const DrawItem *previous = i ? &items[i - 1] : nullptr;
+        bool programChange = !previous || previous->shader != items[i].shader;
+        frameStats.unsortedProgramChanges += programChange;
+        if (programChange && items[i].shader) {
+            resolveShaderUniforms(items[i].shader);
+        }
+        frameStats.unsortedVaoChanges += !previous || previous->draw.VAO != items[i].draw.VAO;
+        frameStats.unsortedMaterialChanges += items[i].material && (!previous || previous->material != items[i].material);
+    }
+
+    if (items.empty()) {
+        order.clear();
+    } else {
+        sortKeys();
+    }
+    uploadUniforms();
+    stream.flush();
+}
+
+size_t RenderQueue::passBegin(RenderPass pass) const {
+    uint64_t first = static_cast<uint64_t>(pass) << 62;
+    return std::lower_bound(keys.begin(), keys.end(), first) - keys.begin();
+}
+
+// Starts from no assumed state, so other renderers may run between passes.
+void RenderQueue::draw(RenderPass pass) {
+    size_t begin = passBegin(pass);
+    size_t end = passBegin(static_cast<RenderPass>(static_cast<uint8_t>(pass) + 1));
+    if (begin == end) {
+        return;
+    }
+
+    Shader *shader = nullptr;
+    GLuint vao = 0;
+    bool vaoBound = false;
+    const Material *material = nullptr;
+    const std::vector<Light> *lights = nullptr;
+    int instanced = -1;
+    const ShaderUniforms *uniforms = nullptr;
+
+    for (size_t position = begin; position < end; ++position) {
+        const DrawItem &item = items[order[position]];
+        if (item.shader != shader) {
+            shader = item.shader;
+            shader->use();
+            uniforms = &shaderUniforms.find(shader)->second;
+            instanced = -1;
+            ++frameStats.programChanges;
+        }
+        // Block bindings are context state, so they survive program changes.
+        if (item.material && item.material != material) {
+            material = item.material;
+            const StreamAllocation &block = materialBlocks[materialIds.find(material)->second];
+            GLStateCache::get().bindBufferRange(GL_UNIFORM_BUFFER, MaterialBlockBinding, block.buffer, block.offset, sizeof(MaterialUniforms));
+            ++frameStats.materialChanges;
+        }
+        const std::vector<Light> *itemLights = resolveLights(item);
+        if (itemLights && itemLights != lights) {
+            lights = itemLights;
+            const StreamAllocation &block = lightBlocks.find(lights)->second;
+            GLStateCache::get().bindBufferRange(GL_UNIFORM_BUFFER, LightBlockBinding, block.buffer, block.offset, sizeof(LightBlockUniforms));
+            ++frameStats.lightChanges;
+        }
+        int wantInstanced = item.instanceBuffer ? 1 : 0;
+        if (wantInstanced != instanced) {
+            instanced = wantInstanced;
+            shader->set(uniforms->instanced, instanced);
+        }
+        if (!vaoBound || item.draw.VAO != vao) {
+            if (vaoBound) {
+                DisableInstanceAttributes();
+            }
+            vao = item.draw.VAO;
+            vaoBound = true;
+            GLStateCache::get().bindVertexArray(vao);
+            ++frameStats.vaoChanges;
+        }
+
+        if (item.instanceBuffer) {
+            BindInstanceAttributes(item.instanceBuffer, item.instanceOffset);
+            // The meshes of a lone object share its instance and all other
+            // state, so sorted neighbours like that go out as one multi-draw.
+            size_t last = position;
+            while (last + 1 < end && item.instanceCount == 1) {
+                const DrawItem &next = items[order[last + 1]];
+                if (next.shader != item.shader || next.material != item.material || resolveLights(next) != itemLights ||
+                    next.draw.VAO != item.draw.VAO || next.instanceBuffer != item.instanceBuffer ||
+                    next.instanceOffset != item.instanceOffset || next.instanceCount != 1) {
+                    break;
+                }
+                ++last;
+            }
+            if (last > position) {
+                for (size_t merged = position; merged <= last; ++merged) {
+                    multiDraws.add(items[order[merged]].draw);
+                }
+                multiDraws.submit();
+                multiDraws.clear();
+                frameStats.mergedDraws += last - position + 1;
+                position = last;
+            } else {
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.draw.indexCount, item.draw.indexType, item.draw.indexOffset,
+                                                  item.instanceCount, item.draw.baseVertex);
+            }
+        } else {
+            DisableInstanceAttributes();
+            shader->set(uniforms->model, item.modelMatrix);
+            glDrawElementsBaseVertex(GL_TRIANGLES, item.draw.indexCount, item.draw.indexType, item.draw.indexOffset, item.draw.baseVertex);
+        }
+        ++frameStats.draws;
+    }
+
+    DisableInstanceAttributes();
+    if (shader && instanced == 1) {
+        shader->set(uniforms->instanced, 0);
+    }
+}
+
+void RenderQueue::finish() {
+    stream.endFrame();
+}
@@ -1,28 +1,109 @@
 #include "Shader.h"
+#include "UniformBlocks.h"
 #include <sys/stat.h>
 #include <chrono>
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
-    : vertexPath(vertexPath), fragmentPath(fragmentPath) {
-    std::ifstream vShaderFile(vertexPath);
-    std::ifstream fShaderFile(fragmentPath);
+namespace {
 
-    if (!vShaderFile.is_open() || !fShaderFile.is_open()) {
-        std::cerr << "Failed to open shader files: " << vertexPath << " and/or " << fragmentPath << std::endl;
-        return;
+const char *StageName(GLenum type) {
+    switch (type) {
+    case GL_VERTEX_SHADER:
+        return "VERTEX";
+    case GL_FRAGMENT_SHADER:
+        return "FRAGMENT";
+    default:
+        return "COMPUTE";
+    }
+}
+
+const char *StageLabel(GLenum type) {
+    switch (type) {
+    case GL_VERTEX_SHADER:
+        return "Vertex";
+    case GL_FRAGMENT_SHADER:
+        return "Fragment";
+    default:
+        return "Compute";
+    }
+}
+
+// FNV-1a; hashes a by-name lookup without building a std::string.
+uint32_t HashUniformName(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name; ++name) {
+        hash = (hash ^ uint8_t(*name)) * 16777619u;
+    }
+    return hash;
+}
+
+bool UniformTypeMatches(GLenum wanted, GLenum actual) {
+    if (wanted == actual) {
+        return true;
+    }
+    if (wanted != GL_INT) {
+        return false;
+    }
+    switch (actual) {
+    case GL_BOOL:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The shared source sits in the same directory as the stage.
+std::string CommonSourcePath(const std::string &stagePath) {
+    size_t slash = stagePath.find_last_of('/');
+    return (slash == std::string::npos ? std::string() : stagePath.substr(0, slash + 1)) + "common.glsl";
+}
+
+bool ReadSource(const std::string &path, std::string &source) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
     }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    source = stream.str();
+    return true;
+}
 
-    std::stringstream vShaderStream, fShaderStream;
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
+// Puts common after the #version line, which must stay first. #line keeps
+// compile errors pointing at the stage's own line numbers; the common
+// source reports as source string 1.
+std::string InsertCommonSource(const std::string &source, const std::string &common) {
+    size_t insertAt = 0;
+    int nextLine = 1;
+    if (source.compare(0, 8, "#version") == 0) {
+        size_t newline = source.find('\n');
+        insertAt = newline == std::string::npos ? source.size() : newline + 1;
+        nextLine = 2;
+    }
+    std::string result = source.substr(0, insertAt);
+    if (insertAt == source.size() && insertAt > 0 && source.back() != '\n') {
+        result += '\n';
+    }
+    result += "#line 1 1\n" + common + "\n#line " + std::to_string(nextLine) + " 0\n";
+    result.append(source, insertAt, std::string::npos);
+    return result;
+}
 
-    std::string vertexCode = vShaderStream.str();
-    std::string fragmentCode = fShaderStream.str();
+} // namespace
 
-    compileAndLinkShaders(vertexCode, fragmentCode);
+Shader::Shader(const char* vertexPath, const char* fragmentPath)
+    : stages{{GL_VERTEX_SHADER, vertexPath, 0}, {GL_FRAGMENT_SHADER, fragmentPath, 0}}, commonPath(CommonSourcePath(vertexPath)) {
+    load();
+}
 
-    vertexShaderLastWriteTime = getLastWriteTime(vertexPath);
-    fragmentShaderLastWriteTime = getLastWriteTime(fragmentPath);
+Shader::Shader(const char* computePath)
+    : stages{{GL_COMPUTE_SHADER, computePath, 0}}, commonPath(CommonSourcePath(computePath)) {
+    load();
 }
 
 void Shader::reloadIfModified() {
@@ -38,65 +119,76 @@ std::time_t Shader::getLastWriteTime(const std::string& path) const {
 }
 
 void Shader::checkForModification() {
-    std::time_t currentVertexShaderWriteTime = getLastWriteTime(vertexPath);
-    std::time_t currentFragmentShaderWriteTime = getLastWriteTime(fragmentPath);
-
-    if (currentVertexShaderWriteTime != vertexShaderLastWriteTime || currentFragmentShaderWriteTime != fragmentShaderLastWriteTime) {
-        std::ifstream vShaderFile(vertexPath);
-        std::ifstream fShaderFile(fragmentPath);
-
-        if (!vShaderFile.is_open() || !fShaderFile.is_open()) {
-            std::cerr << "Failed to open shader files: " << vertexPath << " and/or " << fragmentPath << std::endl;
+    if (getLastWriteTime(commonPath) != commonWriteTime) {
+        load();
+        return;
+    }
+    for (const Stage &stage : stages) {
+        if (getLastWriteTime(stage.path) != stage.lastWriteTime) {
+            load();
             return;
         }
+    }
+}
 
-        std::stringstream vShaderStream, fShaderStream;
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
+std::string Shader::describe() const {
+    std::string paths;
+    for (const Stage &stage : stages) {
+        paths += (paths.empty() ? "" : " / ") + stage.path;
+    }
+    return paths;
+}
 
-        std::string vertexCode = vShaderStream.str();
-        std::string fragmentCode = fShaderStream.str();
+bool Shader::load() {
+    std::string common;
+    if (!ReadSource(commonPath, common)) {
+        std::cerr << "Failed to open shared shader source: " << commonPath << std::endl;
+        return false;
+    }
+    std::vector<std::string> sources;
+    for (const Stage &stage : stages) {
+        std::string source;
+        if (!ReadSource(stage.path, source)) {
+            std::cerr << "Failed to open shader files: " << describe() << std::endl;
+            return false;
+        }
+        sources.push_back(InsertCommonSource(source, common));
+    }
 
-        compileAndLinkShaders(vertexCode, fragmentCode);
+    compileAndLinkShaders(sources);
 
-        vertexShaderLastWriteTime = currentVertexShaderWriteTime;
-        fragmentShaderLastWriteTime = currentFragmentShaderWriteTime;
+    commonWriteTime = getLastWriteTime(commonPath);
+    for (Stage &stage : stages) {
+        stage.lastWriteTime = getLastWriteTime(stage.path);
     }
+    return true;
 }
 
-void Shader::compileAndLinkShaders(const std::string& vertexCode, const std::string& fragmentCode) {
-    const char* vShaderCode = vertexCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
-
-    unsigned int vertex, fragment;
+void Shader::compileAndLinkShaders(const std::vector<std::string>& sources) {
     int success;
     char infoLog[512];
 
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-    } else {
-        std::cout << "Vertex shader compiled successfully.\n";
-    }
-
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-        std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-    } else {
-        std::cout << "Fragment shader compiled successfully.\n";
+    std::vector<unsigned int> shaders;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const char* code = sources[i].c_str();
+        unsigned int shader = glCreateShader(stages[i].type);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, 512, NULL, infoLog);
+            std::cerr << "ERROR::SHADER::" << StageName(stages[i].type) << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+        } else {
+            std::cout << StageLabel(stages[i].type) << " shader compiled successfully.\n";
+        }
+        shaders.push_back(shader);
     }
 
+    unsigned int previous = ID;
     ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
+    for (unsigned int shader : shaders) {
+        glAttachShader(ID, shader);
+    }
     glLinkProgram(ID);
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success) {
@@ -104,8 +196,78 @@ void Shader::compileAndLinkShaders(const std::string& vertexCode, const std::str
         std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
     } else {
         std::cout << "Shader program linked successfully.\n";
+        AssignSharedBindings(ID);
     }
+    introspectUniforms();
 
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    for (unsigned int shader : shaders) {
+        glDeleteShader(shader);
+    }
+
+    // A reload replaces the program; drop the old one and its cached uniforms.
+    if (previous) {
+        GLStateCache::get().deleteProgram(previous);
+    }
+}
+
+// Lists the program's default-block uniforms by name, then re-resolves
+// every slot handed out so far against the new list.
+void Shader::introspectUniforms() {
+    activeUniforms.clear();
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(ID, GLuint(i), GLsizei(name.size()), &length, &size, &type, name.data());
+        GLint location = glGetUniformLocation(ID, name.data());
+        if (location < 0) {
+            continue; // member of a uniform block
+        }
+        std::string key(name.data(), length);
+        // Arrays are listed as "name[0]"; answer to the bare name as well.
+        if (key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0) {
+            activeUniforms[key.substr(0, key.size() - 3)] = {location, type};
+        }
+        activeUniforms[key] = {location, type};
+    }
+
+    for (size_t slot = 0; slot < uniformSlots.size(); ++slot) {
+        uniformLocations[slot] = resolveUniform(uniformSlots[slot]);
+    }
+}
+
+GLint Shader::resolveUniform(const UniformSlot &slot) const {
+    auto found = activeUniforms.find(slot.name);
+    if (found == activeUniforms.end()) {
+        // Elements past the first of an array are not listed on their own.
+        if (slot.name.find('[') == std::string::npos) {
+            return -1;
+        }
+        return glGetUniformLocation(ID, slot.name.c_str());
+    }
+    if (!UniformTypeMatches(slot.type, found->second.type)) {
+        std::cerr << "Uniform " << slot.name << " in " << describe() << " does not have the requested type" << std::endl;
+        return -1;
+    }
+    return found->second.location;
+}
+
+uint32_t Shader::findUniform(const char *name, GLenum type) {
+    uint32_t hash = HashUniformName(name);
+    auto range = slotsByHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const UniformSlot &slot = uniformSlots[it->second];
+        if (slot.type == type && slot.name == name) {
+            return it->second;
+        }
+    }
+    uint32_t slot = static_cast<uint32_t>(uniformSlots.size());
+    uniformSlots.push_back({name, type});
+    uniformLocations.push_back(resolveUniform(uniformSlots.back()));
+    slotsByHash.emplace(hash, slot);
+    return slot;
 }
@@ -0,0 +1,277 @@
+#include "ShadowCascades.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+#include "GLStateCache.h"
+#include "InstanceRenderer.h"
+
+namespace {
+
+// Weight of the logarithmic split scheme against the uniform one.
+constexpr float SplitLambda = 0.75f;
+// Half width of a map over the radius of its slice; the margin lets the
+// snapped center wander without uncovering the slice.
+constexpr float CoverScale = 1.125f;
+
+static_assert(CoverScale * (1.0f - 1.0f / ShadowCascades::CacheSnapSteps) >= 1.0f, "snapping must keep the slice covered");
+
+} // namespace
+
+ShadowCascades::ShadowCascades(const std::string &shaderDirectory, int resolution)
+    : casterShader((shaderDirectory + "shadow_caster_vertex.glsl").c_str(), (shaderDirectory + "shadow_caster_fragment.glsl").c_str()),
+      resolution(resolution) {
+    lightViewProjectionUniform = casterShader.uniform<glm::mat4>("lightViewProjection");
+}
+
+ShadowCascades::~ShadowCascades() {
+    release();
+}
+
+void ShadowCascades::update(const DirectionalLight &sun, const glm::mat4 &view, float fieldOfView, float aspect, float nearPlane,
+                            float farPlane, float casterDistance) {
+    frameStats = ShadowStats();
+    for (Cascade &cascade : cascades) {
+        cascade.staticCasters.reset();
+        cascade.dynamicCasters.reset();
+    }
+
+    glm::vec3 direction = glm::normalize(sun.direction);
+    uniforms.sunDirection = glm::vec4(-direction, 1.0f);
+    uniforms.sunColor = glm::vec4(sun.color, sun.intensity);
+    glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+    glm::mat4 inverseView = glm::inverse(view);
+    glm::mat4 textureBias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+
+    // Squared distance of a frustum corner from the view axis, per unit depth.
+    float tanY = std::tan(fieldOfView * 0.5f);
+    float cornerSq = tanY * tanY * (1.0f + aspect * aspect);
+
+    float sliceNear = nearPlane;
+    for (int i = 0; i < ShadowCascadeCount; ++i) {
+        float fraction = float(i + 1) / ShadowCascadeCount;
+        float logSplit = nearPlane * std::pow(farPlane / nearPlane, fraction);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+        float sliceFar = SplitLambda * logSplit + (1.0f - SplitLambda) * uniformSplit;
+
+        // Smallest sphere around the slice, centered on the view axis. It
+        // only depends on the projection, so turning never resizes it.
+        float centerDepth = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + cornerSq), sliceFar);
+        float farDistance = sliceFar - centerDepth;
+        float radius = std::sqrt(farDistance * farDistance + sliceFar * sliceFar * cornerSq);
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+        glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+        float halfWidth = radius * CoverScale;
+        float step = 2.0f * halfWidth / CacheSnapSteps; // a whole number of texels
+        glm::vec3 lightCenter = glm::floor(glm::vec3(lightView * glm::vec4(center, 1.0f)) / step + 0.5f) * step;
+        float depthMargin = radius + step * 0.5f;
+        // Light space looks down -z, so the sun is towards +z.
+        glm::mat4 projection = glm::ortho(lightCenter.x - halfWidth, lightCenter.x + halfWidth, lightCenter.y - halfWidth,
+                                          lightCenter.y + halfWidth, -(lightCenter.z + depthMargin + casterDistance),
+                                          -(lightCenter.z - depthMargin));
+
+        Cascade &cascade = cascades[i];
+        cascade.lightViewProjection = projection * lightView;
+        cascade.frustum = Frustum::FromMatrix(cascade.lightViewProjection);
+        cascade.texelSize = 2.0f * halfWidth / resolution;
+        uniforms.cascades[i] = textureBias * cascade.lightViewProjection;
+        uniforms.splits[i] = sliceFar;
+        uniforms.texelSizes[i] = cascade.texelSize;
+        sliceNear = sliceFar;
+    }
+}
+
+bool ShadowCascades::staticStale(int cascade) const {
+    const Cascade &c = cascades[cascade];
+    return c.cachedVersion != staticVersion || c.cachedMatrix != c.lightViewProjection;
+}
+
+void ShadowCascades::create() {
+    GLStateCache &state = GLStateCache::get();
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    shadowMaps = textures[0];
+    staticMaps = textures[1];
+    for (GLuint texture : textures) {
+        state.bindTexture(ShadowMapUnit, GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, ShadowCascadeCount, 0, GL_DEPTH_COMPONENT,
+                     GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GLint filter = texture == shadowMaps ? GL_LINEAR : GL_NEAREST;
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+    }
+    // Linear filtering of a comparison gives 2x2 PCF in hardware.
+    state.bindTexture(ShadowMapUnit, GL_TEXTURE_2D_ARRAY, shadowMaps);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    glGenFramebuffers(2, framebuffers);
+    for (int i = 0; i < 2; ++i) {
+        attachLayer(framebuffers[i], textures[i], 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR::SHADOWS::FRAMEBUFFER_INCOMPLETE: 0x" << std::hex << status << std::dec << std::endl;
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowCascades::attachLayer(GLuint framebuffer, GLuint texture, int layer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+}
+
+// Appends the list's instances in batch order; returns where they start.
+// Batches sharing their predecessor's lone instance reuse its copy.
+size_t ShadowCascades::appendInstances(const CommandList &list) {
+    size_t first = instanceData.size();
+    for (size_t b = 0; b < list.batchCount(); ++b) {
+        const CommandList::Batch &batch = list.batch(b);
+        if (b > 0 && SharesInstance(list.batch(b - 1).key, list.batch(b - 1).instances, batch.key, batch.instances)) {
+            continue;
+        }
+        instanceData.insert(instanceData.end(), batch.instances.begin(), batch.instances.end());
+    }
+    return first;
+}
+
+// Walks the instances the way appendInstances laid them out. The meshes of a
+// lone caster in one arena go out as a single multi-draw.
+void ShadowCascades::drawCasters(const CommandList &list, size_t first, const glm::mat4 &lightViewProjection) {
+    casterShader.set(lightViewProjectionUniform, lightViewProjection);
+    size_t next = first;
+    for (size_t b = 0; b < list.batchCount();) {
+        const CommandList::Batch &batch = list.batch(b);
+        if (b == 0 || !SharesInstance(list.batch(b - 1).key, list.batch(b - 1).instances, batch.key, batch.instances)) {
+            first = next;
+            next += batch.instances.size();
+        }
+        DrawRange draw = GetDrawRange(batch.key.model->meshes[batch.key.mesh], batch.key.lod);
+        GLStateCache::get().bindVertexArray(draw.VAO);
+        BindInstanceAttributes(instanceBuffer, instanceOffset + first * sizeof(InstanceData));
+
+        size_t end = b + 1;
+        multiDraws.clear();
+        multiDraws.add(draw);
+        while (end < list.batchCount() && SharesInstance(list.batch(end - 1).key, list.batch(end - 1).instances, list.batch(end).key,
+                                                         list.batch(end).instances)) {
+            const CommandList::Batch &merged = list.batch(end);
+            DrawRange mergedDraw = GetDrawRange(merged.key.model->meshes[merged.key.mesh], merged.key.lod);
+            if (mergedDraw.VAO != draw.VAO) {
+                break;
+            }
+            multiDraws.add(mergedDraw);
+            ++end;
+        }
+        if (end > b + 1) {
+            multiDraws.submit();
+        } else {
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, draw.indexCount, draw.indexType, draw.indexOffset,
+                                              static_cast<GLsizei>(batch.instances.size()), draw.baseVertex);
+        }
+        DisableInstanceAttributes();
+        ++frameStats.draws;
+        frameStats.instances += end - b > 1 ? end - b : batch.instances.size();
+        b = end;
+    }
+}
+
+void ShadowCascades::render(StreamBuffer &stream) {
+    if (!shadowMaps) {
+        create();
+    }
+    GLStateCache &state = GLStateCache::get();
+
+    // Everything drawn this frame goes up in one upload.
+    bool stale[ShadowCascadeCount];
+    size_t staticFirst[ShadowCascadeCount], dynamicFirst[ShadowCascadeCount];
+    instanceData.clear();
+    for (int i = 0; i < ShadowCascadeCount; ++i) {
+        stale[i] = staticStale(i);
+        staticFirst[i] = stale[i] ? appendInstances(cascades[i].staticCasters) : 0;
+        dynamicFirst[i] = appendInstances(cascades[i].dynamicCasters);
+    }
+    bool uploaded = true;
+    if (!instanceData.empty()) {
+        size_t bytes = instanceData.size() * sizeof(InstanceData);
+        StreamAllocation allocation = stream.allocate(bytes, alignof(InstanceData));
+        uploaded = allocation.data != nullptr;
+        if (uploaded) {
+            std::memcpy(allocation.data, instanceData.data(), bytes);
+            instanceBuffer = allocation.buffer;
+            instanceOffset = allocation.offset;
+        }
+        stream.flush();
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glViewport(0, 0, resolution, resolution);
+    state.setCapability(GL_DEPTH_TEST, true);
+    state.depthFunc(GL_LESS);
+    state.depthMask(GL_TRUE);
+    // Casters in front of a cascade's near plane flatten onto it instead of
+    // being clipped away.
+    state.setCapability(GL_DEPTH_CLAMP, true);
+    state.setCapability(GL_POLYGON_OFFSET_FILL, true);
+    glPolygonOffset(2.0f, 4.0f);
+    casterShader.use();
+
+    // Without the upload the maps keep last frame's casters.
+    for (int i = 0; uploaded && i < ShadowCascadeCount; ++i) {
+        Cascade &cascade = cascades[i];
+        if (stale[i]) {
+            attachLayer(framebuffers[1], staticMaps, i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            drawCasters(cascade.staticCasters, staticFirst[i], cascade.lightViewProjection);
+            cascade.cachedMatrix = cascade.lightViewProjection;
+            cascade.cachedVersion = staticVersion;
+            cascade.mapHoldsStatic = false;
+            ++frameStats.staticRenders;
+        }
+        bool dynamic = cascade.dynamicCasters.batchCount() > 0;
+        if (!dynamic && cascade.mapHoldsStatic) {
+            continue;
+        }
+        attachLayer(framebuffers[1], staticMaps, i);
+        attachLayer(framebuffers[0], shadowMaps, i);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[1]);
+        glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        cascade.mapHoldsStatic = !dynamic;
+        if (dynamic) {
+            drawCasters(cascade.dynamicCasters, dynamicFirst[i], cascade.lightViewProjection);
+            ++frameStats.dynamicCascades;
+        }
+    }
+
+    state.setCapability(GL_POLYGON_OFFSET_FILL, false);
+    state.setCapability(GL_DEPTH_CLAMP, false);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    shadowBlock.upload(&uniforms, sizeof(uniforms));
+    shadowBlock.bind(ShadowBlockBinding, 0, sizeof(uniforms));
+    state.bindTexture(ShadowMapUnit, GL_TEXTURE_2D_ARRAY, shadowMaps);
+}
+
+void ShadowCascades::release() {
+    if (shadowMaps) {
+        GLuint textures[2] = {shadowMaps, staticMaps};
+        GLStateCache::get().deleteTextures(2, textures);
+        glDeleteFramebuffers(2, framebuffers);
+        shadowMaps = staticMaps = 0;
+        framebuffers[0] = framebuffers[1] = 0;
+        for (Cascade &cascade : cascades) {
+            cascade.cachedVersion = ~0u;
+            cascade.mapHoldsStatic = false;
+        }
+    }
+    shadowBlock.release();
+}
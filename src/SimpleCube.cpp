@@ -1,15 +1,22 @@
 #include "SimpleCube.h"
+#include "GLStateCache.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 SimpleCube::SimpleCube(const glm::vec3 &position, const glm::vec4 &color, float metallic, float roughness)
     : position(position), color(color), metallic(metallic), roughness(roughness) {
     setupCube();
+
+    MaterialUniforms material = {};
+    material.baseColor = color;
+    material.metallic = metallic;
+    material.roughness = roughness;
+    materialBlock.upload(&material, sizeof(material));
 }
 
 SimpleCube::~SimpleCube() {
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    GLStateCache::get().deleteVertexArrays(1, &VAO);
+    GLStateCache::get().deleteBuffers(1, &VBO);
 }
 
 void SimpleCube::setupCube() {
@@ -61,9 +68,9 @@ void SimpleCube::setupCube() {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
 
-    glBindVertexArray(VAO);
+    GLStateCache::get().bindVertexArray(VAO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLStateCache::get().bindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
     // Position attribute
@@ -74,19 +81,15 @@ void SimpleCube::setupCube() {
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    glBindVertexArray(0);
+    GLStateCache::get().bindVertexArray(0);
 }
 
 void SimpleCube::Render(Shader &shader) {
     glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
     shader.setMat4("model", model);
 
-    // Set material properties
-    shader.setVec4("material.baseColor", color);
-    shader.setFloat("material.metallic", metallic);
-    shader.setFloat("material.roughness", roughness);
+    materialBlock.bind(MaterialBlockBinding, 0, sizeof(MaterialUniforms));
 
-    glBindVertexArray(VAO);
+    GLStateCache::get().bindVertexArray(VAO);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
 }
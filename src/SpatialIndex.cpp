@@ -0,0 +1,295 @@
+#include "SpatialIndex.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Slab test; t is the entry distance, clamped to 0 for origins inside the box.
+static bool RayIntersectsBox(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance,
+                             const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, float &t) {
+    glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    t = enter;
+    return enter <= exit;
+}
+
+static float DistanceSquaredToBox(const glm::vec3 &point, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+    glm::vec3 offset = point - glm::clamp(point, boundsMin, boundsMax);
+    return glm::dot(offset, offset);
+}
+
+SpatialIndex::SpatialIndex(const glm::vec2 &worldMin, const glm::vec2 &worldMax, int maxDepth)
+    : worldMin(worldMin), worldSize(std::max(worldMax.x - worldMin.x, worldMax.y - worldMin.y)),
+      maxDepth(std::min(std::max(maxDepth, 0), 15)) {
+    // Levels 0..maxDepth, each a full 2^d x 2^d grid.
+    nodes.resize(((size_t(1) << (2 * (this->maxDepth + 1))) - 1) / 3);
+    clear();
+}
+
+void SpatialIndex::clear() {
+    std::fill(nodes.begin(), nodes.end(), Node());
+    items.clear();
+    freeItems.clear();
+    itemCount = 0;
+    minY = FLT_MAX;
+    maxY = -FLT_MAX;
+}
+
+size_t SpatialIndex::nodeIndex(const Cell &cell) const {
+    size_t levelStart = ((size_t(1) << (2 * cell.depth)) - 1) / 3;
+    return levelStart + (size_t(cell.z) << cell.depth) + cell.x;
+}
+
+void SpatialIndex::looseBounds(const Cell &cell, glm::vec3 &boundsMin, glm::vec3 &boundsMax) const {
+    float cellSize = worldSize / float(1 << cell.depth);
+    boundsMin = glm::vec3(worldMin.x + (cell.x - 0.5f) * cellSize, minY, worldMin.y + (cell.z - 0.5f) * cellSize);
+    boundsMax = glm::vec3(boundsMin.x + 2.0f * cellSize, maxY, boundsMin.z + 2.0f * cellSize);
+}
+
+SpatialIndex::Cell SpatialIndex::placement(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) const {
+    glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+    for (int depth = maxDepth; depth > 0; --depth) {
+        int cells = 1 << depth;
+        float cellSize = worldSize / float(cells);
+        Cell cell = {depth,
+                     std::min(std::max(int(std::floor((center.x - worldMin.x) / cellSize)), 0), cells - 1),
+                     std::min(std::max(int(std::floor((center.z - worldMin.y) / cellSize)), 0), cells - 1)};
+        float looseMinX = worldMin.x + (cell.x - 0.5f) * cellSize;
+        float looseMinZ = worldMin.y + (cell.z - 0.5f) * cellSize;
+        if (boundsMin.x >= looseMinX && boundsMax.x <= looseMinX + 2.0f * cellSize &&
+            boundsMin.z >= looseMinZ && boundsMax.z <= looseMinZ + 2.0f * cellSize) {
+            return cell;
+        }
+    }
+    return {0, 0, 0};
+}
+
+void SpatialIndex::link(Handle handle, const Cell &cell) {
+    Item &item = items[handle];
+    Node &node = nodes[nodeIndex(cell)];
+    item.node = static_cast<int32_t>(nodeIndex(cell));
+    item.depth = static_cast<uint8_t>(cell.depth);
+    item.x = static_cast<uint16_t>(cell.x);
+    item.z = static_cast<uint16_t>(cell.z);
+    item.prev = -1;
+    item.next = node.firstItem;
+    if (node.firstItem >= 0) {
+        items[node.firstItem].prev = static_cast<int32_t>(handle);
+    }
+    node.firstItem = static_cast<int32_t>(handle);
+    for (Cell up = cell; up.depth >= 0; --up.depth, up.x >>= 1, up.z >>= 1) {
+        ++nodes[nodeIndex(up)].subtreeItems;
+    }
+}
+
+void SpatialIndex::unlink(Handle handle) {
+    Item &item = items[handle];
+    if (item.prev >= 0) {
+        items[item.prev].next = item.next;
+    } else {
+        nodes[item.node].firstItem = item.next;
+    }
+    if (item.next >= 0) {
+        items[item.next].prev = item.prev;
+    }
+    for (Cell up = {item.depth, item.x, item.z}; up.depth >= 0; --up.depth, up.x >>= 1, up.z >>= 1) {
+        --nodes[nodeIndex(up)].subtreeItems;
+    }
+    item.node = -1;
+}
+
+SpatialIndex::Handle SpatialIndex::insert(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, uint32_t id) {
+    Handle handle;
+    if (!freeItems.empty()) {
+        handle = freeItems.back();
+        freeItems.pop_back();
+    } else {
+        handle = static_cast<Handle>(items.size());
+        items.emplace_back();
+    }
+    Item &item = items[handle];
+    item.boundsMin = boundsMin;
+    item.boundsMax = boundsMax;
+    item.id = id;
+    minY = std::min(minY, boundsMin.y);
+    maxY = std::max(maxY, boundsMax.y);
+    link(handle, placement(boundsMin, boundsMax));
+    ++itemCount;
+    return handle;
+}
+
+void SpatialIndex::update(Handle handle, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+    Item &item = items[handle];
+    item.boundsMin = boundsMin;
+    item.boundsMax = boundsMax;
+    minY = std::min(minY, boundsMin.y);
+    maxY = std::max(maxY, boundsMax.y);
+    Cell cell = placement(boundsMin, boundsMax);
+    if (cell.depth != item.depth || cell.x != item.x || cell.z != item.z) {
+        unlink(handle);
+        link(handle, cell);
+    }
+}
+
+void SpatialIndex::remove(Handle handle) {
+    unlink(handle);
+    freeItems.push_back(handle);
+    --itemCount;
+}
+
+template <typename Accept>
+void SpatialIndex::acceptSubtree(const Cell &cell, Accept &accept) {
+    const Node &node = nodes[nodeIndex(cell)];
+    if (node.subtreeItems == 0) {
+        return;
+    }
+    ++lastStats.nodesVisited;
+    for (int32_t i = node.firstItem; i >= 0; i = items[i].next) {
+        accept(items[i]);
+        ++lastStats.itemsAccepted;
+    }
+    if (cell.depth < maxDepth) {
+        for (int child = 0; child < 4; ++child) {
+            acceptSubtree(Cell{cell.depth + 1, 2 * cell.x + (child & 1), 2 * cell.z + (child >> 1)}, accept);
+        }
+    }
+}
+
+template <typename Classify, typename Visit, typename Accept>
+void SpatialIndex::traverse(const Cell &cell, Classify &classify, Visit &visit, Accept &accept) {
+    const Node &node = nodes[nodeIndex(cell)];
+    if (node.subtreeItems == 0) {
+        return;
+    }
+    // The root also holds boxes outside the world bounds, so it is never judged.
+    if (cell.depth > 0) {
+        glm::vec3 boundsMin, boundsMax;
+        looseBounds(cell, boundsMin, boundsMax);
+        Overlap overlap = classify(boundsMin, boundsMax);
+        if (overlap == Overlap::Outside) {
+            return;
+        }
+        if (overlap == Overlap::Inside) {
+            acceptSubtree(cell, accept);
+            return;
+        }
+    }
+    ++lastStats.nodesVisited;
+    for (int32_t i = node.firstItem; i >= 0; i = items[i].next) {
+        visit(items[i]);
+        ++lastStats.itemsTested;
+    }
+    if (cell.depth < maxDepth) {
+        for (int child = 0; child < 4; ++child) {
+            traverse(Cell{cell.depth + 1, 2 * cell.x + (child & 1), 2 * cell.z + (child >> 1)}, classify, visit, accept);
+        }
+    }
+}
+
+void SpatialIndex::queryFrustum(const Frustum &frustum, FrustumCuller &culler, std::vector<uint32_t> &ids) {
+    lastStats = SpatialQueryStats();
+    culler.clear();
+    auto classify = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+        glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+        glm::vec3 extent = 0.5f * (boundsMax - boundsMin);
+        Overlap overlap = Overlap::Inside;
+        for (const glm::vec4 &plane : frustum.planes) {
+            glm::vec3 normal(plane);
+            float distance = glm::dot(normal, center) + plane.w;
+            float radius = glm::dot(glm::abs(normal), extent);
+            if (distance + radius < 0.0f) {
+                return Overlap::Outside;
+            }
+            if (distance - radius < 0.0f) {
+                overlap = Overlap::Intersects;
+            }
+        }
+        return overlap;
+    };
+    auto visit = [&](const Item &item) { culler.add(item.boundsMin, item.boundsMax, item.id); };
+    auto accept = [&](const Item &item) { ids.push_back(item.id); };
+    traverse(Cell{0, 0, 0}, classify, visit, accept);
+    culler.cull(frustum, ids);
+}
+
+void SpatialIndex::querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &ids) {
+    lastStats = SpatialQueryStats();
+    float radiusSquared = radius * radius;
+    auto classify = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+        if (DistanceSquaredToBox(center, boundsMin, boundsMax) > radiusSquared) {
+            return Overlap::Outside;
+        }
+        glm::vec3 farthest = glm::max(glm::abs(boundsMin - center), glm::abs(boundsMax - center));
+        return glm::dot(farthest, farthest) <= radiusSquared ? Overlap::Inside : Overlap::Intersects;
+    };
+    auto visit = [&](const Item &item) {
+        if (DistanceSquaredToBox(center, item.boundsMin, item.boundsMax) <= radiusSquared) {
+            ids.push_back(item.id);
+        }
+    };
+    auto accept = [&](const Item &item) { ids.push_back(item.id); };
+    traverse(Cell{0, 0, 0}, classify, visit, accept);
+}
+
+void SpatialIndex::queryBox(const glm::vec3 &queryMin, const glm::vec3 &queryMax, std::vector<uint32_t> &ids) {
+    lastStats = SpatialQueryStats();
+    auto overlaps = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+        return glm::all(glm::lessThanEqual(boundsMin, queryMax)) && glm::all(glm::lessThanEqual(queryMin, boundsMax));
+    };
+    auto classify = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+        if (!overlaps(boundsMin, boundsMax)) {
+            return Overlap::Outside;
+        }
+        bool inside = glm::all(glm::lessThanEqual(queryMin, boundsMin)) && glm::all(glm::lessThanEqual(boundsMax, queryMax));
+        return inside ? Overlap::Inside : Overlap::Intersects;
+    };
+    auto visit = [&](const Item &item) {
+        if (overlaps(item.boundsMin, item.boundsMax)) {
+            ids.push_back(item.id);
+        }
+    };
+    auto accept = [&](const Item &item) { ids.push_back(item.id); };
+    traverse(Cell{0, 0, 0}, classify, visit, accept);
+}
+
+void SpatialIndex::queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, std::vector<RayHit> &hits) {
+    lastStats = SpatialQueryStats();
+    glm::vec3 inverseDirection = 1.0f / direction;
+    auto classify = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+        float t;
+        return RayIntersectsBox(origin, inverseDirection, maxDistance, boundsMin, boundsMax, t) ? Overlap::Intersects : Overlap::Outside;
+    };
+    auto visit = [&](const Item &item) {
+        float t;
+        if (RayIntersectsBox(origin, inverseDirection, maxDistance, item.boundsMin, item.boundsMax, t)) {
+            hits.push_back({item.id, t});
+        }
+    };
+    auto accept = [&](const Item &item) { visit(item); }; // a ray never contains a node
+    traverse(Cell{0, 0, 0}, classify, visit, accept);
+}
+
+bool SpatialIndex::raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, RayHit &hit) {
+    lastStats = SpatialQueryStats();
+    glm::vec3 inverseDirection = 1.0f / direction;
+    bool found = false;
+    hit.distance = maxDistance;
+    // Nodes and items beyond the nearest hit so far are skipped.
+    auto classify = [&](const glm::vec3 &boundsMin, const glm::vec3 &boundsMax) {
+        float t;
+        return RayIntersectsBox(origin, inverseDirection, hit.distance, boundsMin, boundsMax, t) ? Overlap::Intersects : Overlap::Outside;
+    };
+    auto visit = [&](const Item &item) {
+        float t;
+        if (RayIntersectsBox(origin, inverseDirection, hit.distance, item.boundsMin, item.boundsMax, t)) {
+            hit = {item.id, t};
+            found = true;
+        }
+    };
+    auto accept = [&](const Item &item) { visit(item); };
+    traverse(Cell{0, 0, 0}, classify, visit, accept);
+    return found;
+}
@@ -0,0 +1,179 @@
+#include "StreamBuffer.h"
+#include <algorithm>
+#include <iostream>
+#include "GLStateCache.h"
+
+namespace {
+
+const size_t RegionAlignment = 256; // covers every uniform buffer offset alignment in practice
+const GLbitfield PersistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+StreamBuffer::StreamBuffer(size_t frameCapacity)
+    : frameCapacity(AlignUp(std::max<size_t>(frameCapacity, 1), RegionAlignment)) {
+}
+
+StreamBuffer::~StreamBuffer() {
+    release();
+}
+
+void StreamBuffer::create(size_t capacity) {
+    frameCapacity = AlignUp(capacity, RegionAlignment);
+    persistent = GLAD_GL_VERSION_4_4 && glBufferStorage;
+    glGenBuffers(1, &buffer);
+    GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (persistent) {
+        GLsizeiptr size = GLsizeiptr(frameCapacity * FrameCount);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, PersistentFlags);
+        mapped = static_cast<unsigned char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, PersistentFlags));
+        mappedOffset = 0;
+        if (mapped) {
+            return;
+        }
+        // Buffer storage is immutable, so the fallback needs a new buffer.
+        std::cerr << "Failed to map the stream buffer persistently; orphaning it every frame instead" << std::endl;
+        GLStateCache::get().deleteBuffers(1, &buffer);
+        glGenBuffers(1, &buffer);
+        GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        persistent = false;
+    }
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(frameCapacity), nullptr, GL_STREAM_DRAW);
+}
+
+// Fallback path: fresh storage every frame, so mapping never waits on draws.
+void StreamBuffer::mapFrame() {
+    GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(frameCapacity), nullptr, GL_STREAM_DRAW);
+    mapped = static_cast<unsigned char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, GLsizeiptr(frameCapacity),
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    mappedOffset = 0;
+    if (!mapped) {
+        std::cerr << "Failed to map the stream buffer" << std::endl;
+    }
+}
+
+// Fallback path after a flush: nothing has been drawn from past head yet.
+void StreamBuffer::mapRest() {
+    GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    mapped = static_cast<unsigned char *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, GLintptr(head), GLsizeiptr(frameCapacity - head),
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    mappedOffset = head;
+    if (!mapped) {
+        std::cerr << "Failed to map the stream buffer" << std::endl;
+    }
+}
+
+void StreamBuffer::beginFrame() {
+    if (!buffer) {
+        create(frameCapacity);
+    }
+    head = 0;
+    frameStats = StreamStats();
+    frameStats.persistent = persistent;
+
+    if (!persistent) {
+        if (mapped) {
+            flush();
+        }
+        mapFrame();
+    } else {
+        frame = (frame + 1) % FrameCount;
+        if (GLsync fence = fences[frame]) {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            frameStats.waited = status == GL_TIMEOUT_EXPIRED;
+            while (status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            }
+            glDeleteSync(fence);
+            fences[frame] = nullptr;
+        }
+    }
+    frameStats.capacity = frameCapacity;
+}
+
+StreamAllocation StreamBuffer::allocate(size_t size, size_t alignment) {
+    size_t base = persistent ? frame * frameCapacity : 0;
+    size_t offset = AlignUp(base + head, alignment);
+    if (offset + size > base + frameCapacity) {
+        grow(size + alignment);
+        base = persistent ? frame * frameCapacity : 0;
+        offset = AlignUp(base, alignment);
+    }
+    if (!persistent && !mapped && head < frameCapacity) {
+        mapRest();
+    }
+    head = offset + size - base;
+    frameStats.bytes += size;
+
+    StreamAllocation allocation;
+    allocation.data = mapped ? mapped + (offset - mappedOffset) : nullptr;
+    allocation.buffer = buffer;
+    allocation.offset = offset;
+    return allocation;
+}
+
+// The old buffer may still be read by earlier frames and by this frame's
+// draws; GL keeps its storage alive until they finish, so deleting it after
+// this frame's draws are issued is enough.
+void StreamBuffer::grow(size_t minimum) {
+    if (!persistent && mapped) {
+        flush();
+    }
+    retired.push_back(buffer);
+    buffer = 0;
+    mapped = nullptr;
+    deleteFences();
+    create(std::max(frameCapacity * 2, minimum));
+    if (!persistent) {
+        mapFrame();
+    }
+    head = 0;
+    frameStats.capacity = frameCapacity;
+}
+
+void StreamBuffer::flush() {
+    if (!persistent && mapped) {
+        GLStateCache::get().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        mapped = nullptr;
+    }
+}
+
+void StreamBuffer::endFrame() {
+    if (persistent && buffer) {
+        fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    if (!retired.empty()) {
+        GLStateCache::get().deleteBuffers(GLsizei(retired.size()), retired.data());
+        retired.clear();
+    }
+}
+
+void StreamBuffer::deleteFences() {
+    for (GLsync &fence : fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+}
+
+void StreamBuffer::release() {
+    deleteFences();
+    flush();
+    if (!retired.empty()) {
+        GLStateCache::get().deleteBuffers(GLsizei(retired.size()), retired.data());
+        retired.clear();
+    }
+    if (buffer) {
+        // Deleting a buffer also unmaps it.
+        GLStateCache::get().deleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+    }
+}
@@ -0,0 +1,98 @@
+#include "UniformBlocks.h"
+#include <algorithm>
+#include "GLStateCache.h"
+
+void AssignSharedBindings(GLuint program) {
+    static const struct {
+        const char *name;
+        GLuint binding;
+    } blocks[] = {
+        {"Camera", CameraBlockBinding},
+        {"Lights", LightBlockBinding},
+        {"Material", MaterialBlockBinding},
+        {"Clusters", ClusterBlockBinding},
+        {"Shadows", ShadowBlockBinding},
+    };
+    for (const auto &block : blocks) {
+        GLuint index = glGetUniformBlockIndex(program, block.name);
+        if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, block.binding);
+        }
+    }
+
+    static const struct {
+        const char *name;
+        GLuint unit;
+    } samplers[] = {
+        {"clusterLights", ClusterLightsUnit},
+        {"clusterRanges", ClusterRangesUnit},
+        {"clusterIndices", ClusterIndicesUnit},
+        {"gAlbedoMetal", GBufferAlbedoUnit},
+        {"gNormalRough", GBufferNormalUnit},
+        {"gDepth", GBufferDepthUnit},
+        {"shadowMap", ShadowMapUnit},
+    };
+    for (const auto &sampler : samplers) {
+        GLint location = glGetUniformLocation(program, sampler.name);
+        if (location >= 0) {
+            GLStateCache::get().uniform1i(program, location, GLint(sampler.unit));
+        }
+    }
+}
+
+MaterialUniforms PackMaterialBlock(const Material &material) {
+    MaterialUniforms block = {};
+    block.baseColor = material.baseColor;
+    block.metallic = material.metallic;
+    block.roughness = material.roughness;
+    return block;
+}
+
+LightBlockUniforms PackLightBlock(const std::vector<Light> &lights) {
+    LightBlockUniforms block = {};
+    block.count = static_cast<int32_t>(std::min(lights.size(), size_t(MaxLights)));
+    for (int32_t i = 0; i < block.count; ++i) {
+        block.lights[i].position = lights[i].position;
+        block.lights[i].intensity = lights[i].intensity;
+        block.lights[i].color = lights[i].color;
+    }
+    return block;
+}
+
+size_t UniformBufferAlignment() {
+    static size_t alignment = 0;
+    if (!alignment) {
+        GLint value = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+        alignment = value > 0 ? size_t(value) : 256;
+    }
+    return alignment;
+}
+
+UniformBlock::~UniformBlock() {
+    release();
+}
+
+void UniformBlock::upload(const void *data, size_t size) {
+    if (!buffer) {
+        glGenBuffers(1, &buffer);
+    }
+    GLStateCache::get().bindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (size > capacity) {
+        capacity = size + size / 2;
+    }
+    glBufferData(GL_UNIFORM_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+}
+
+void UniformBlock::bind(GLuint binding, size_t offset, size_t size) const {
+    GLStateCache::get().bindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, GLintptr(offset), GLsizeiptr(size));
+}
+
+void UniformBlock::release() {
+    if (buffer) {
+        GLStateCache::get().deleteBuffers(1, &buffer);
+        buffer = 0;
+        capacity = 0;
+    }
+}
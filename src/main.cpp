@@ -6,7 +6,12 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include <cmath>
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
 #include <vector>
 #include <tiny_gltf.h>
 #include "Shader.h"
@@ -14,6 +19,24 @@
 #include "LoadModel.h"
 #include "RenderGLTF.h"
 #include "SimpleCube.h"
+#include "ModelData.h"
+#include "AsyncLoader.h"
+#include "AssetCache.h"
+#include "InstanceRenderer.h"
+#include "CommandList.h"
+#include "GeometryPool.h"
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include "FrustumCuller.h"
+#include "SpatialIndex.h"
+#include "OcclusionBuffer.h"
+#include "Pvs.h"
+#include "UniformBlocks.h"
+#include "LightClusters.h"
+#include "DeferredRenderer.h"
+#include "GpuTimer.h"
+#include "ShadowCascades.h"
+#include "GpuScene.h"
 
 glm::mat4 projection;
 glm::vec3 cameraPos = glm::vec3(3.0f, 3.0f, -12.0f);
@@ -30,164 +53,147 @@ float lastFrameTime = 0.0f;
 const float animationDuration = 78.0f; // Total duration of the animation in frames
 const float frameDuration = 1.0f / 24.0f; // Duration of each frame assuming 24 FPS
 
-Shader* shaderPtr = nullptr;
-
-struct AnimationData {
-    std::vector<float> times;
-    std::vector<glm::vec3> translations;
-    std::vector<glm::vec3> scales;
-};
-
-struct Material {
-    glm::vec4 baseColor;
-    float metallic;
-    float roughness;
-};
-
-struct Light {
-    glm::vec3 position;
-    glm::vec3 color;
-    float intensity;
-};
+const double uploadBudgetSeconds = 0.002; // GL upload time allowed per frame
+const float fieldOfView = 45.0f;
+const float statsInterval = 5.0f; // Seconds between --stats reports
+const float worldExtent = 1024.0f; // Half size of the XZ area covered by the spatial index
+const float nearPlane = 0.1f;
+const float farPlane = 100.0f;
+const size_t objectsPerChunk = 64; // Fewest objects worth handing to a recording thread
+const glm::vec3 backgroundColor(0.8f);
+const DirectionalLight sun = {glm::vec3(-0.4f, -1.0f, -0.3f), glm::vec3(1.0f, 0.96f, 0.9f), 0.8f};
+const float shadowCasterDistance = 50.0f; // how far towards the sun casters are looked for
+const char *pvsPath = "../src/objects/scene.pvs"; // written by running with --build-pvs
+
+LodSelector lodSelector; // Screen-space error threshold for mesh LODs
+// Static shadow casters are cached across frames, so they must not follow
+// the camera's LOD choice; they are always drawn at full detail.
+LodSelector staticShadowLods = {glm::vec3(0.0f), 1.0f, 0.0f};
+bool deferredShading = false; // toggled with G, or started with --deferred
 
 class SpawnObject {
 public:
-    std::vector<Mesh> meshes;
-    std::vector<AnimationData> animations;
-    std::vector<Material> materials; // Store materials
-    std::vector<Light> lights;       // Store lights
+    ModelHandle model; // Shared meshes, materials, animations and lights
     glm::vec3 position;
     glm::mat4 modelMatrix;
+    glm::vec4 color;
     float animationTime;
     float animationSpeed;
+    SpatialIndex::Handle spatialHandle; // invalid until the model is ready
+    GpuScene::Handle gpuHandle;         // likewise
 
-    SpawnObject(const std::string &path, const glm::vec3 &initialPosition)
-        : position(initialPosition), animationTime(0.0f), animationSpeed(1.0f) {
-        tinygltf::Model model;
-        if (!LoadGLTFModel(model, path)) {
-            std::cerr << "Failed to load model." << std::endl;
+    // Draws nothing until the shared model has finished loading.
+    SpawnObject(ModelHandle model, const glm::vec3 &initialPosition)
+        : model(std::move(model)), position(initialPosition), modelMatrix(1.0f), color(1.0f), animationTime(0.0f), animationSpeed(1.0f),
+          spatialHandle(SpatialIndex::InvalidHandle), gpuHandle(GpuScene::InvalidHandle) {}
+
+    // Touches only this object, so objects can animate in parallel.
+    void Animate(float deltaTime) {
+        if (!model.ready()) {
             return;
         }
-        LoadAnimationData(model);
-        LoadMaterialData(model); // Load materials
-        LoadLightData(model);    // Load lights
-        for (const auto &gltfMesh : model.meshes) {
-            CreateMeshFromGLTF(model, gltfMesh, meshes);
+        const auto &animations = model.model().animations;
+        animationTime += deltaTime * animationSpeed;
+        if (!animations.empty()) {
+            const auto &animData = animations[0];
+            if (!animData.times.empty()) {
+                animationTime = fmod(animationTime, animData.times.back());
+                UpdateModelTransformation(modelMatrix, animData.times, animData.translations, animData.scales, animationTime);
+            }
         }
-        modelMatrix = glm::mat4(1.0f);
     }
 
-    void LoadAnimationData(const tinygltf::Model &model) {
-        for (const auto &animation : model.animations) {
-            AnimationData animData;
-            for (const auto &sampler : animation.samplers) {
-                const auto &inputAccessor = model.accessors[sampler.input];
-                const auto &outputAccessor = model.accessors[sampler.output];
-                const auto &inputBufferView = model.bufferViews[inputAccessor.bufferView];
-                const auto &inputBuffer = model.buffers[inputBufferView.buffer];
-                const auto &outputBufferView = model.bufferViews[outputAccessor.bufferView];
-                const auto &outputBuffer = model.buffers[outputBufferView.buffer];
-
-                std::vector<float> inputData(inputAccessor.count);
-                std::vector<glm::vec3> outputVec3Data(outputAccessor.count);
-
-                std::memcpy(inputData.data(), inputBuffer.data.data() + inputBufferView.byteOffset + inputAccessor.byteOffset, inputAccessor.count * sizeof(float));
-                std::memcpy(outputVec3Data.data(), outputBuffer.data.data() + outputBufferView.byteOffset + outputAccessor.byteOffset, outputAccessor.count * sizeof(glm::vec3));
-
-                animData.times = inputData;
-
-                for (const auto &channel : animation.channels) {
-                    if (channel.sampler == &sampler - &animation.samplers[0]) {
-                        if (channel.target_path == "translation") {
-                            animData.translations = outputVec3Data;
-                        } else if (channel.target_path == "scale") {
-                            animData.scales = outputVec3Data;
-                        }
-                    }
-                }
-            }
-            animations.push_back(animData);
+    // Keeps the object's entry in the spatial index current; id is what
+    // queries on the index report for it.
+    void UpdateIndex(SpatialIndex &index, uint32_t id) {
+        glm::vec3 worldMin, worldMax;
+        if (!WorldBounds(worldMin, worldMax)) {
+            return;
+        }
+        if (spatialHandle == SpatialIndex::InvalidHandle) {
+            spatialHandle = index.insert(worldMin, worldMax, id);
+        } else {
+            index.update(spatialHandle, worldMin, worldMax);
         }
     }
 
-    void LoadMaterialData(const tinygltf::Model &model) {
-        for (const auto &gltfMaterial : model.materials) {
-            Material material;
-            auto baseColorFactor = gltfMaterial.values.find("baseColorFactor");
-            if (baseColorFactor != gltfMaterial.values.end()) {
-                const auto &color = baseColorFactor->second.number_array;
-                material.baseColor = glm::vec4(color[0], color[1], color[2], color[3]);
-            } else {
-                material.baseColor = glm::vec4(1.0f);
-            }
-
-            auto metallicFactor = gltfMaterial.values.find("metallicFactor");
-            if (metallicFactor != gltfMaterial.values.end()) {
-                material.metallic = static_cast<float>(metallicFactor->second.Factor());
-            } else {
-                material.metallic = 1.0f;
-            }
-
-            auto roughnessFactor = gltfMaterial.values.find("roughnessFactor");
-            if (roughnessFactor != gltfMaterial.values.end()) {
-                material.roughness = static_cast<float>(roughnessFactor->second.Factor());
-            } else {
-                material.roughness = 1.0f;
-            }
-
-            materials.push_back(material);
+    // Adds the object to the GPU-driven scene once loaded; afterwards only
+    // animated objects have anything to update.
+    void SyncGpuScene(GpuScene &scene) {
+        if (!model.ready()) {
+            return;
+        }
+        glm::mat4 modelWithInitialPosition = glm::translate(modelMatrix, position);
+        if (gpuHandle == GpuScene::InvalidHandle) {
+            gpuHandle = scene.add(model.model(), modelWithInitialPosition, color);
+        } else if (!IsStatic()) {
+            scene.update(gpuHandle, modelWithInitialPosition);
         }
     }
 
-    void LoadLightData(const tinygltf::Model &model) {
-        for (const auto &node : model.nodes) {
-            if (node.extensions.find("KHR_lights_punctual") != node.extensions.end()) {
-                const auto &lightIndex = node.extensions.at("KHR_lights_punctual").Get("light").Get<int>();
-                const tinygltf::Light &light = model.lights[lightIndex];
-
-                Light lightData;
-                lightData.position = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
-                lightData.color = glm::vec3(light.color[0], light.color[1], light.color[2]);
-                lightData.intensity = light.intensity;
-
-                lights.push_back(lightData);
-            }
+    // World-space bounds of the whole model; false until it has loaded.
+    bool WorldBounds(glm::vec3 &worldMin, glm::vec3 &worldMax) const {
+        if (!model.ready()) {
+            return false;
         }
+        const LoadedModel &loaded = model.model();
+        TransformBounds(glm::translate(modelMatrix, position), loaded.boundsMin, loaded.boundsMax, worldMin, worldMax);
+        return true;
     }
 
-    void Update(float deltaTime) {
-        animationTime += deltaTime * animationSpeed;
-        if (!animations.empty()) {
-            const auto &animData = animations[0];
-            if (!animData.times.empty()) {
-                animationTime = fmod(animationTime, animData.times.back());
-                UpdateModelTransformation(modelMatrix, animData.times, animData.translations, animData.scales, animationTime);
+    // Animated or failed models can't be baked into the PVS.
+    bool IsStatic() const {
+        return model.ready() && model.model().animations.empty();
+    }
+
+    void AddPvsOccluders(std::vector<PvsOccluder> &occluders, uint32_t id) const {
+        glm::mat4 modelWithInitialPosition = glm::translate(modelMatrix, position);
+        for (const Mesh &mesh : model.model().meshes) {
+            if (mesh.occluder) {
+                occluders.push_back({modelWithInitialPosition, mesh.boundsMin, mesh.boundsMax, id});
             }
         }
     }
 
-    void Render(Shader &shader) {
+    // The model's lights in world space. Those with a range are clustered;
+    // the rest light every pixel through the Lights block.
+    void AddLights(std::vector<Light> &unbounded, std::vector<Light> &clustered) const {
+        if (!model.ready()) {
+            return;
+        }
         glm::mat4 modelWithInitialPosition = glm::translate(modelMatrix, position);
-        shader.setMat4("model", modelWithInitialPosition);
-        
-        // Set materials
-        if (!materials.empty()) {
-            shader.setVec4("material.baseColor", materials[0].baseColor);
-            shader.setFloat("material.metallic", materials[0].metallic);
-            shader.setFloat("material.roughness", materials[0].roughness);
+        float scale = std::max(glm::length(glm::vec3(modelWithInitialPosition[0])),
+                               std::max(glm::length(glm::vec3(modelWithInitialPosition[1])), glm::length(glm::vec3(modelWithInitialPosition[2]))));
+        for (const Light &light : model.model().lights) {
+            Light placed = light;
+            placed.position = glm::vec3(modelWithInitialPosition * glm::vec4(light.position, 1.0f));
+            placed.range = light.range * scale;
+            (light.range > 0.0f ? clustered : unbounded).push_back(placed);
         }
+    }
 
-        // Set lights
-        for (size_t i = 0; i < lights.size(); ++i) {
-            shader.setVec3("lights[" + std::to_string(i) + "].position", lights[i].position);
-            shader.setVec3("lights[" + std::to_string(i) + "].color", lights[i].color);
-            shader.setFloat("lights[" + std::to_string(i) + "].intensity", lights[i].intensity);
+    // Rasterizes the boxes of meshes marked as occluders at import.
+    void AddOccluders(OcclusionBuffer &occlusion) const {
+        if (!model.ready()) {
+            return;
+        }
+        glm::mat4 modelWithInitialPosition = glm::translate(modelMatrix, position);
+        for (const Mesh &mesh : model.model().meshes) {
+            if (mesh.occluder) {
+                occlusion.addOccluder(modelWithInitialPosition, mesh.boundsMin, mesh.boundsMax);
+            }
         }
-        shader.setInt("numLights", static_cast<int>(lights.size()));
+    }
 
-        for (auto &mesh : meshes) {
-            RenderMesh(mesh);
+    // Records one instance of every mesh; the renderer sets materials and
+    // lights per batch and draws all instances of a mesh together. Safe to
+    // call from recording threads.
+    void Render(CommandList &commands, const LodSelector &lods, const Frustum &frustum) const {
+        if (!model.ready()) {
+            return;
         }
+        glm::mat4 modelWithInitialPosition = glm::translate(modelMatrix, position);
+        commands.drawModel(model.model(), modelWithInitialPosition, color, lods, &frustum);
     }
 
 private:
@@ -224,10 +230,15 @@ private:
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
-    projection = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 100.0f);
-    if (shaderPtr) {
-        shaderPtr->use();
-        shaderPtr->setMat4("projection", projection);
+    projection = glm::perspective(glm::radians(fieldOfView), (float)width / (float)height, nearPlane, farPlane);
+    lodSelector.pixelScale = height / (2.0f * std::tan(glm::radians(fieldOfView) * 0.5f));
+}
+
+// G switches between forward and deferred shading.
+void key_callback(GLFWwindow* /*window*/, int key, int /*scancode*/, int action, int /*mods*/) {
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        deferredShading = !deferredShading;
+        std::cout << "Shading: " << (deferredShading ? "deferred" : "forward") << std::endl;
     }
 }
 
@@ -272,17 +283,63 @@ void processInput(GLFWwindow *window) {
     updateCameraVectors();
 }
 
-int main() {
+// Waits for every model, then bakes visibility for the static objects.
+bool BuildScenePvs(AsyncLoader &loader, const std::vector<SpawnObject> &objects) {
+    while (!loader.idle()) {
+        loader.processUploads(1.0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::vector<PvsObject> pvsObjects(objects.size());
+    std::vector<PvsOccluder> occluders;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        pvsObjects[i].dynamic = !objects[i].IsStatic();
+        if (!pvsObjects[i].dynamic) {
+            objects[i].WorldBounds(pvsObjects[i].boundsMin, pvsObjects[i].boundsMax);
+            objects[i].AddPvsOccluders(occluders, static_cast<uint32_t>(i));
+        }
+    }
+
+    PvsData pvs;
+    return BuildPvs(pvsObjects, occluders, PvsBuildSettings(), pvs) && WritePvs(pvsPath, pvs);
+}
+
+int main(int argc, char **argv) {
+    bool buildPvs = false;
+    bool gpuDrivenRequested = false;
+    bool printStats = false; // per-frame and import reports
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--build-pvs") == 0) {
+            buildPvs = true;
+        } else if (std::strcmp(argv[i], "--deferred") == 0) {
+            deferredShading = true;
+        } else if (std::strcmp(argv[i], "--gpu-driven") == 0) {
+            gpuDrivenRequested = true;
+        } else if (std::strcmp(argv[i], "--stats") == 0) {
+            printStats = true;
+        }
+    }
+
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
         return -1;
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    GLFWwindow* window = glfwCreateWindow(800, 600, "tcity", NULL, NULL);
+    // The GPU-driven path needs GL 4.3; without it (macOS stops at 4.1) the
+    // 3.3 context and the CPU path are used.
+    GLFWwindow* window = NULL;
+    if (gpuDrivenRequested) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        window = glfwCreateWindow(800, 600, "tcity", NULL, NULL);
+    }
+    if (!window) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        window = glfwCreateWindow(800, 600, "tcity", NULL, NULL);
+    }
     if (!window) {
         std::cerr << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -295,16 +352,63 @@ int main() {
         return -1;
     }
 
-    glEnable(GL_DEPTH_TEST);
+    bool gpuDriven = gpuDrivenRequested && GpuScene::supported();
+    if (gpuDrivenRequested && !gpuDriven) {
+        std::cerr << "GL 4.3 is not available, using CPU culling" << std::endl;
+    }
+
+    GLStateCache::get().setCapability(GL_DEPTH_TEST, true);
 
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetKeyCallback(window, key_callback);
 
     Shader shader("../src/shaders/vertex_shader.glsl", "../src/shaders/fragment_shader.glsl");
-    shaderPtr = &shader;
+    DeferredRenderer deferred("../src/shaders/");
+    ShadowCascades shadows("../src/shaders/");
+    GpuTimer gpuTimer;
+    std::unique_ptr<GpuScene> gpuScene;
+    if (gpuDriven) {
+        gpuScene.reset(new GpuScene("../src/shaders/"));
+    }
+
+    GeometryPool geometry;
+    AsyncLoader loader;
+    loader.setGeometryPool(&geometry);
+    loader.setImportReports(printStats);
+    AssetCache assets(loader);
+    InstanceRenderer instances;
+    CommandRecorder recorder;
+    RenderQueue queue;
+    UniformBlock cameraBlock;
+
+    // Unbounded lights shade every pixel through the Lights block; lights
+    // with a range only reach the pixels of the clusters they touch.
+    std::vector<Light> sceneLights;
+    sceneLights.push_back({glm::vec3(0.0f, -1.0f, -10.0f), glm::vec3(1.0f), 1.0f});
+    std::vector<Light> frameLights;
+    std::vector<Light> clusteredLights;
+    LightClusters lightClusters;
+    queue.setSceneLights(&frameLights);
+    SpatialIndex spatialIndex(glm::vec2(-worldExtent), glm::vec2(worldExtent));
+    FrustumCuller culler;
+    OcclusionBuffer occlusion;
+    std::vector<uint32_t> visibleObjects;
+    FrustumCuller shadowCuller;
+    std::vector<uint32_t> casterObjects;
+    size_t staticObjects = 0;
+    float lastStatsTime = 0.0f;
 
     std::vector<SpawnObject> objects;
-    objects.emplace_back("../src/objects/untitled-cubered-material.glb", glm::vec3(-2.0f, 0.0f, -5.0f));
-    objects.emplace_back("../src/objects/untitled-cube-anim.glb", glm::vec3(2.0f, 0.0f, -5.0f));
+    objects.emplace_back(assets.get("../src/objects/untitled-cubered-material.glb", GLTFLoadMode::Mapped), glm::vec3(-2.0f, 0.0f, -5.0f));
+    objects.emplace_back(assets.get("../src/objects/untitled-cube-anim.glb", GLTFLoadMode::Mapped), glm::vec3(2.0f, 0.0f, -5.0f));
+
+    PvsData pvs;
+    if (buildPvs) {
+        BuildScenePvs(loader, objects);
+        glfwSetWindowShouldClose(window, true);
+    } else {
+        LoadPvs(pvsPath, objects.size(), pvs);
+    }
 
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
@@ -321,29 +425,218 @@ int main() {
 
         processInput(window);
 
-        glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        loader.processUploads(uploadBudgetSeconds);
+        geometry.defragment();
 
         shader.reloadIfModified();
+        deferred.reloadShadersIfModified();
+        if (gpuScene) {
+            gpuScene->reloadShadersIfModified();
+        }
         shader.use();
 
         glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        shader.setMat4("view", view);
-        shader.setMat4("projection", projection);
-
-            // Set light properties
-        glm::vec3 lightColor(1.0f, 1.0f, 1.0f); // white light
-        shader.setVec3("lights[0].color", lightColor);
+        lodSelector.cameraPosition = cameraPos;
+
+        // Camera matrices reach every program through one block per frame.
+        CameraUniforms camera;
+        camera.view = view;
+        camera.projection = projection;
+        camera.viewProjection = projection * view;
+        camera.inverseViewProjection = glm::inverse(camera.viewProjection);
+        camera.position = glm::vec4(cameraPos, 1.0f);
+        cameraBlock.upload(&camera, sizeof(camera));
+        cameraBlock.bind(CameraBlockBinding, 0, sizeof(camera));
+
+        // Animate everything, but only queue objects whose bounds touch the
+        // frustum. The spatial index is not thread safe, so it updates serially.
+        recorder.parallelFor(objects.size(), objectsPerChunk, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                objects[i].Animate(deltaTime);
+            }
+        });
+        for (size_t i = 0; i < objects.size(); ++i) {
+            objects[i].UpdateIndex(spatialIndex, static_cast<uint32_t>(i));
+        }
 
-        glm::vec3 lightPos(0.0f, -1.0f, -10.0f); // light coming from above
-        shader.setVec3("lights[0].position", lightPos);
+        // Every object's lights, visible or not: they can reach visible surfaces.
+        frameLights = sceneLights;
+        clusteredLights.clear();
+        for (const SpawnObject &object : objects) {
+            object.AddLights(frameLights, clusteredLights);
+        }
+        lightClusters.build(clusteredLights, view, projection, nearPlane, farPlane);
+        lightClusters.upload();
+
+        // Static casters are cached per cascade, so they are only recorded
+        // when a cascade needs redrawing; animated ones every frame. Runs
+        // before the camera query, which the stats below report on.
+        glfwGetFramebufferSize(window, &width, &height);
+        size_t readyStatic = 0;
+        for (const SpawnObject &object : objects) {
+            readyStatic += object.IsStatic();
+        }
+        if (readyStatic != staticObjects) {
+            staticObjects = readyStatic;
+            shadows.invalidateStatic();
+        }
+        // The stream frame opens here: the shadow pass is its first user.
+        queue.clear();
+        shadows.update(sun, view, glm::radians(fieldOfView), height > 0 ? float(width) / float(height) : 1.0f, nearPlane, farPlane,
+                       shadowCasterDistance);
+        for (int cascade = 0; cascade < ShadowCascadeCount; ++cascade) {
+            bool stale = shadows.staticStale(cascade);
+            casterObjects.clear();
+            spatialIndex.queryFrustum(shadows.frustum(cascade), shadowCuller, casterObjects);
+            for (uint32_t index : casterObjects) {
+                if (!objects[index].IsStatic()) {
+                    objects[index].Render(shadows.dynamicCasters(cascade), lodSelector, shadows.frustum(cascade));
+                } else if (stale) {
+                    objects[index].Render(shadows.staticCasters(cascade), staticShadowLods, shadows.frustum(cascade));
+                }
+            }
+        }
+        shadows.render(queue.streamBuffer());
+
+        Frustum frustum = Frustum::FromMatrix(projection * view);
+        visibleObjects.clear();
+        int pvsCell = -1;
+        size_t inFrustum = 0;
+        if (gpuScene) {
+            // The compute pass culls every object, so the CPU only keeps the
+            // GPU's copy of the instances current.
+            for (SpawnObject &object : objects) {
+                object.SyncGpuScene(*gpuScene);
+            }
+        } else {
+            // Inside the PVS grid its cell's list replaces the spatial query, so
+            // statically hidden objects are rejected before any other test.
+            pvsCell = pvs.cellAt(cameraPos);
+            if (pvsCell >= 0) {
+                culler.clear();
+                for (uint32_t index : pvs.visibleObjects(pvsCell)) {
+                    glm::vec3 worldMin, worldMax;
+                    if (objects[index].WorldBounds(worldMin, worldMax)) {
+                        culler.add(worldMin, worldMax, index);
+                    }
+                }
+                culler.cull(frustum, visibleObjects);
+            } else {
+                spatialIndex.queryFrustum(frustum, culler, visibleObjects);
+            }
 
-        float lightIntensity = 1.0f; // intensity of the light
-        shader.setFloat("lights[0].intensity", lightIntensity);
+            // Objects hidden behind the boxes of nearer buildings never reach the queue.
+            inFrustum = visibleObjects.size();
+            occlusion.begin(projection * view);
+            for (uint32_t index : visibleObjects) {
+                objects[index].AddOccluders(occlusion);
+            }
+            occlusion.rasterize();
+            size_t unoccluded = 0;
+            for (uint32_t index : visibleObjects) {
+                glm::vec3 worldMin, worldMax;
+                objects[index].WorldBounds(worldMin, worldMax);
+                if (occlusion.isVisible(worldMin, worldMax)) {
+                    visibleObjects[unoccluded++] = index;
+                }
+            }
+            visibleObjects.resize(unoccluded);
 
-        for (auto &obj : objects) {
-            obj.Update(deltaTime);
-            obj.Render(shader);
+            // Worker threads record the visible objects; this thread only replays
+            // the lists and talks to GL.
+            recorder.record(visibleObjects.size(), objectsPerChunk, [&](CommandList &commands, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    objects[visibleObjects[i]].Render(commands, lodSelector, frustum);
+                }
+            });
+        }
+        // Deferred frames shade opaque pixels once from the G-buffer and draw
+        // transparent batches forward on top. Without usable targets the
+        // frame falls back to forward shading.
+        bool deferredFrame = deferredShading && deferred.resize(width, height);
+        gpuTimer.begin();
+        if (gpuScene) {
+            gpuScene->prepare(frustum, lodSelector, frameLights);
+            if (deferredFrame) {
+                deferred.beginGeometry();
+                gpuScene->draw(deferred.geometryShader(), RenderPass::Opaque);
+                deferred.light(queue.streamBuffer(), frameLights, clusteredLights, frustum, backgroundColor);
+                gpuScene->draw(shader, RenderPass::Transparent);
+                deferred.present();
+            } else {
+                glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                gpuScene->draw(shader, RenderPass::Opaque);
+                gpuScene->draw(shader, RenderPass::Transparent);
+            }
+            queue.finish();
+        } else if (deferredFrame) {
+            instances.flush(deferred.geometryShader(), queue, recorder.lists(), recorder.listCount(), &shader);
+            deferred.beginGeometry();
+            queue.prepare();
+            queue.draw(RenderPass::Opaque);
+            deferred.light(queue.streamBuffer(), frameLights, clusteredLights, frustum, backgroundColor);
+            queue.draw(RenderPass::Transparent);
+            queue.finish();
+            deferred.present();
+        } else {
+            glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            instances.flush(shader, queue, recorder.lists(), recorder.listCount());
+            queue.execute();
+        }
+        gpuTimer.end();
+
+        if (printStats && currentTime - lastStatsTime >= statsInterval) {
+            if (gpuScene) {
+                const GpuSceneStats &gpuStats = gpuScene->stats();
+                std::cout << "GPU-driven: " << gpuStats.instances << " instances of " << gpuStats.objects << " objects culled on the GPU, "
+                          << gpuStats.commands << " indirect commands for " << gpuStats.meshes << " meshes, " << gpuStats.multiDraws
+                          << " multi-draws" << std::endl;
+            } else {
+                const RenderQueueStats &stats = queue.stats();
+                std::cout << "Render queue: " << stats.draws << " draws (" << stats.mergedDraws << " items multi-drawn), program changes "
+                          << stats.unsortedProgramChanges << " -> " << stats.programChanges << ", VAO changes " << stats.unsortedVaoChanges << " -> " << stats.vaoChanges
+                          << ", material changes " << stats.unsortedMaterialChanges << " -> " << stats.materialChanges << std::endl;
+                if (pvsCell >= 0) {
+                    std::cout << "PVS cell " << pvsCell << ": " << pvs.visibleObjects(pvsCell).size() << " of " << objects.size()
+                              << " objects potentially visible, " << inFrustum << " in the frustum" << std::endl;
+                } else {
+                    std::cout << "Frustum culling: " << inFrustum << " of " << spatialIndex.size() << " objects visible, "
+                              << spatialIndex.stats().nodesVisited << " nodes visited, " << spatialIndex.stats().itemsAccepted << " accepted whole, "
+                              << culler.stats().tested << " boxes tested" << std::endl;
+                }
+                const OcclusionStats &occlusionStats = occlusion.stats();
+                std::cout << "Occlusion culling: " << occlusionStats.occluded << " of " << occlusionStats.tested << " objects hidden by "
+                          << occlusionStats.occluders << " occluders (" << occlusionStats.triangles << " triangles)" << std::endl;
+            }
+            const StreamStats &streamStats = queue.streamBuffer().stats();
+            std::cout << "Stream buffer: " << streamStats.bytes << " of " << streamStats.capacity << " bytes this frame, "
+                      << (streamStats.persistent ? "persistently mapped" : "orphaned per frame")
+                      << (streamStats.waited ? ", waited for the GPU" : "") << std::endl;
+            const LightClusterStats &clusterStats = lightClusters.stats();
+            std::cout << "Clustered lights: " << clusterStats.lights << " of " << clusteredLights.size() << " in view, "
+                      << clusterStats.references << " cluster references, at most " << clusterStats.maxPerCluster << " per cluster";
+            if (clusterStats.dropped) {
+                std::cout << ", " << clusterStats.dropped << " dropped";
+            }
+            std::cout << std::endl;
+            std::cout << "Shading: " << (deferredFrame ? "deferred" : "forward") << ", " << gpuTimer.milliseconds() << " ms GPU per frame";
+            if (deferredFrame) {
+                std::cout << ", " << deferred.stats().lightVolumes << " light volumes (" << deferred.stats().culledVolumes
+                          << " outside the frustum)";
+            }
+            std::cout << std::endl;
+            const ShadowStats &shadowStats = shadows.stats();
+            std::cout << "Shadows: " << shadowStats.staticRenders << " of " << ShadowCascadeCount << " cascades redrew static casters, "
+                      << shadowStats.dynamicCascades << " drew moving casters, " << shadowStats.draws << " draws, "
+                      << shadowStats.instances << " instances" << std::endl;
+            const GLStateStats &glStats = GLStateCache::get().stats();
+            std::cout << "GL state cache: skipped " << glStats.skipped() << " of " << glStats.issued() + glStats.skipped()
+                      << " state calls since the last report (uniforms " << glStats.uniforms.skipped << ", programs " << glStats.programs.skipped
+                      << ", VAOs " << glStats.vertexArrays.skipped << ", buffers " << glStats.buffers.skipped << ")" << std::endl;
+            GLStateCache::get().resetStats();
+            lastStatsTime = currentTime;
         }
 
         // simpleCube.Render(shader);
@@ -352,6 +645,21 @@ int main() {
         glfwPollEvents();
     }
 
+    // Release the shared models while the context is still current.
+    objects.clear();
+    assets.prune();
+    loader.shutdown();
+    queue.release();
+    lightClusters.release();
+    deferred.release();
+    shadows.release();
+    gpuTimer.release();
+    if (gpuScene) {
+        gpuScene->release();
+    }
+    cameraBlock.release();
+    geometry.release();
+
     glfwTerminate();
     return -1;
 }
@@ -0,0 +1,73 @@
+// Shared by every program: Shader::load inserts this file after the #version
+// line of each stage. Blocks are std140 and mirrored by the structs in
+// UniformBlocks.h.
+
+#define MAX_LIGHTS 8
+#define SHADOW_CASCADES 4
+
+struct Light {
+    vec3 position;
+    float intensity;
+    vec3 color;
+};
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 inverseViewProjection;
+    vec4 position;
+} camera;
+
+layout (std140) uniform Lights {
+    Light lights[MAX_LIGHTS];
+    int lightCount;
+};
+
+// Sun and cascaded shadow maps, from ShadowCascades.
+layout (std140) uniform Shadows {
+    mat4 cascades[SHADOW_CASCADES]; // world to shadow map texture space
+    vec4 splits;        // view depth where each cascade ends
+    vec4 texelSizes;    // world size of a shadow map texel per cascade
+    vec4 sunDirection;  // towards the sun; w is 1 while the sun is on
+    vec4 sunColor;      // rgb color, a intensity
+} shadows;
+
+uniform sampler2DArrayShadow shadowMap;
+
+// Fraction of the sunlight reaching worldPos, from the first cascade that
+// covers it: four bilinear comparisons, 4x4 texels in all. Past the last
+// cascade nothing is shadowed.
+float SunShadow(vec3 worldPos, vec3 norm, float viewDepth) {
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADES && viewDepth > shadows.splits[cascade]) {
+        ++cascade;
+    }
+    if (cascade == SHADOW_CASCADES) {
+        return 1.0;
+    }
+    // Looking up a little off the surface, along its normal, avoids acne.
+    vec4 coord = shadows.cascades[cascade] * vec4(worldPos + norm * shadows.texelSizes[cascade] * 1.5, 1.0);
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            vec2 offset = (vec2(x, y) * 2.0 - 1.0) * texel;
+            lit += texture(shadowMap, vec4(coord.xy + offset, float(cascade), coord.z));
+        }
+    }
+    return lit * 0.25;
+}
+
+vec3 SunLighting(vec3 worldPos, vec3 norm, vec3 viewDir, float viewDepth) {
+    if (shadows.sunDirection.w == 0.0) {
+        return vec3(0.0);
+    }
+    vec3 lightDir = shadows.sunDirection.xyz;
+    float diff = max(dot(norm, lightDir), 0.0);
+    if (diff == 0.0) {
+        return vec3(0.0);
+    }
+    float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32);
+    return (diff + spec) * shadows.sunColor.rgb * shadows.sunColor.a * SunShadow(worldPos, norm, viewDepth);
+}
@@ -0,0 +1,48 @@
+#version 330 core
+// Deferred pass for the unbounded lights: shades every G-buffer pixel with
+// the Lights block and the shadowed sun, like fragment_shader.glsl, and
+// fills pixels nothing was drawn to with the background.
+out vec4 FragColor;
+
+uniform sampler2D gAlbedoMetal;
+uniform sampler2D gNormalRough;
+uniform sampler2D gDepth;
+uniform vec3 background;
+
+vec3 WorldPosition(ivec2 pixel, float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+    vec4 world = camera.inverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0) {
+        FragColor = vec4(background, 1.0);
+        return;
+    }
+    vec3 albedo = texelFetch(gAlbedoMetal, pixel, 0).rgb;
+    vec3 norm = normalize(texelFetch(gNormalRough, pixel, 0).xyz);
+    vec3 fragPos = WorldPosition(pixel, depth);
+    vec3 viewDir = normalize(camera.position.xyz - fragPos);
+    vec3 lighting = vec3(0.0);
+
+    for (int i = 0; i < lightCount; ++i) {
+        vec3 ambient = 0.1 * lights[i].color;
+
+        vec3 lightDir = normalize(lights[i].position - fragPos);
+        float diff = max(dot(norm, lightDir), 0.0);
+        vec3 diffuse = diff * lights[i].color;
+
+        vec3 reflectDir = reflect(-lightDir, norm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+        vec3 specular = spec * lights[i].color;
+
+        lighting += ambient + diffuse + specular;
+    }
+
+    lighting += SunLighting(fragPos, norm, viewDir, -(camera.view * vec4(fragPos, 1.0)).z);
+
+    FragColor = vec4(lighting * albedo, 1.0);
+}
@@ -3,39 +3,85 @@ out vec4 FragColor;
 
 in vec3 FragPos;
 in vec3 Normal;
+in vec4 InstanceColor;
 
-struct Material {
+// Blocks are std140 and mirrored by the structs in UniformBlocks.h.
+layout (std140) uniform Material {
     vec4 baseColor;
     float metallic;
     float roughness;
-};
+} material;
 
-struct Light {
-    vec3 position;
-    vec3 color;
-    float intensity;
-};
+// Clustered lights, binned on the CPU by LightClusters: per light two texels
+// (position and range, color and intensity); per cluster the first index
+// into clusterIndices and the count.
+layout (std140) uniform Clusters {
+    uvec4 grid;   // w: clustered light count
+    vec4 depth;   // slice scale, slice bias, near, far
+} clusters;
 
-uniform Material material;
-uniform Light lights[1];
-uniform vec3 viewPos;
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
 
-void main() {
-    // Ambient lighting
-    vec3 ambient = 0.1 * lights[0].color;
+vec3 ClusteredLighting(vec3 norm, vec3 viewDir) {
+    if (clusters.grid.w == 0u) {
+        return vec3(0.0);
+    }
+    vec4 viewPosition = camera.view * vec4(FragPos, 1.0);
+    vec4 clipPosition = camera.projection * viewPosition;
+    vec2 tile = (clipPosition.xy / clipPosition.w * 0.5 + 0.5) * vec2(clusters.grid.xy);
+    float slice = floor(log(-viewPosition.z) * clusters.depth.x + clusters.depth.y);
+    uvec3 cell = uvec3(clamp(vec3(tile, slice), vec3(0.0), vec3(clusters.grid.xyz) - 1.0));
+    int cluster = int((cell.z * clusters.grid.y + cell.y) * clusters.grid.x + cell.x);
+
+    uvec2 range = texelFetch(clusterRanges, cluster).xy;
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; ++i) {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+        vec4 positionRange = texelFetch(clusterLights, light * 2);
+        vec4 colorIntensity = texelFetch(clusterLights, light * 2 + 1);
+
+        // Inverse square falloff, windowed to reach zero at the range.
+        vec3 toLight = positionRange.xyz - FragPos;
+        float distanceSq = max(dot(toLight, toLight), 1e-4);
+        float ratio = distanceSq / (positionRange.w * positionRange.w);
+        float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+        float attenuation = colorIntensity.w * window * window / distanceSq;
 
-    // Diffuse lighting
+        vec3 lightDir = toLight * inversesqrt(distanceSq);
+        float diff = max(dot(norm, lightDir), 0.0);
+        float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32);
+        result += (diff + spec) * colorIntensity.rgb * attenuation;
+    }
+    return result;
+}
+
+void main() {
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lights[0].position - FragPos);
-    float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * lights[0].color;
-
-    // Specular lighting
-    vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 reflectDir = reflect(-lightDir, norm);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
-    vec3 specular = spec * lights[0].color;
-
-    vec3 lighting = (ambient + diffuse + specular) * material.baseColor.rgb;
-    FragColor = vec4(lighting, material.baseColor.a);
+    vec3 viewDir = normalize(camera.position.xyz - FragPos);
+    vec3 lighting = vec3(0.0);
+
+    for (int i = 0; i < lightCount; ++i) {
+        // Ambient lighting
+        vec3 ambient = 0.1 * lights[i].color;
+
+        // Diffuse lighting
+        vec3 lightDir = normalize(lights[i].position - FragPos);
+        float diff = max(dot(norm, lightDir), 0.0);
+        vec3 diffuse = diff * lights[i].color;
+
+        // Specular lighting
+        vec3 reflectDir = reflect(-lightDir, norm);
+        float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
+        vec3 specular = spec * lights[i].color;
+
+        lighting += ambient + diffuse + specular;
+    }
+
+    lighting += ClusteredLighting(norm, viewDir);
+    lighting += SunLighting(FragPos, norm, viewDir, -(camera.view * vec4(FragPos, 1.0)).z);
+
+    vec4 baseColor = material.baseColor * InstanceColor;
+    FragColor = vec4(lighting * baseColor.rgb, baseColor.a);
 }
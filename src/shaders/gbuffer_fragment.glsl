@@ -0,0 +1,20 @@
+#version 330 core
+// Geometry pass of the deferred path; runs after vertex_shader.glsl.
+layout (location = 0) out vec4 AlbedoMetal;  // RGBA8
+layout (location = 1) out vec4 NormalRough;  // RGBA16F, world-space normal
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec4 InstanceColor;
+
+layout (std140) uniform Material {
+    vec4 baseColor;
+    float metallic;
+    float roughness;
+} material;
+
+void main() {
+    vec4 baseColor = material.baseColor * InstanceColor;
+    AlbedoMetal = vec4(baseColor.rgb, material.metallic);
+    NormalRough = vec4(normalize(Normal), material.roughness);
+}
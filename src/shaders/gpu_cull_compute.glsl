@@ -0,0 +1,85 @@
+#version 430 core
+// Culling pass of GpuScene: one invocation per instance. A visible instance
+// takes the next slot of its mesh and LOD's indirect command and copies its
+// per-instance attributes there for the draw.
+layout (local_size_x = 64) in;
+
+struct Instance {
+    mat4 model;
+    vec4 color;
+    uint mesh;
+    uint padding0, padding1, padding2;
+};
+
+struct MeshInfo {
+    vec4 boundsMin; // w: LOD count
+    vec4 boundsMax;
+    vec4 lodErrors;
+    uint firstCommand;
+    uint padding0, padding1, padding2;
+};
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+struct VisibleInstance {
+    mat4 model;
+    vec4 color;
+};
+
+layout (std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+layout (std430, binding = 1) readonly buffer Meshes { MeshInfo meshes[]; };
+layout (std430, binding = 2) buffer Commands { DrawCommand commands[]; };
+layout (std430, binding = 3) writeonly buffer Visible { VisibleInstance visible[]; };
+
+uniform vec4 frustumPlanes[6];
+uniform vec3 cameraPosition;
+uniform float pixelScale;
+uniform float maxPixelError;
+uniform int instanceCount;
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(instanceCount)) {
+        return;
+    }
+    Instance instance = instances[index];
+    MeshInfo mesh = meshes[instance.mesh];
+
+    // World bounds as in TransformBounds, tested as in Frustum::intersects.
+    vec3 center = vec3(instance.model * vec4(0.5 * (mesh.boundsMin.xyz + mesh.boundsMax.xyz), 1.0));
+    vec3 extent = 0.5 * (mesh.boundsMax.xyz - mesh.boundsMin.xyz);
+    vec3 worldExtent = abs(instance.model[0].xyz) * extent.x +
+                       abs(instance.model[1].xyz) * extent.y +
+                       abs(instance.model[2].xyz) * extent.z;
+    for (int i = 0; i < 6; ++i) {
+        vec3 normal = frustumPlanes[i].xyz;
+        if (dot(normal, center) + frustumPlanes[i].w + dot(abs(normal), worldExtent) < 0.0) {
+            return;
+        }
+    }
+
+    // Same choice as LodSelector::select.
+    int lodCount = int(mesh.boundsMin.w);
+    int lod = 0;
+    float scale = max(length(instance.model[0].xyz), max(length(instance.model[1].xyz), length(instance.model[2].xyz)));
+    float radius = 0.5 * length(mesh.boundsMax.xyz - mesh.boundsMin.xyz) * scale;
+    float distance = length(center - cameraPosition) - radius;
+    if (distance > 0.0 && maxPixelError > 0.0) {
+        for (int i = 1; i < lodCount; ++i) {
+            if (mesh.lodErrors[i] * scale * pixelScale / distance > maxPixelError) {
+                break;
+            }
+            lod = i;
+        }
+    }
+
+    uint command = mesh.firstCommand + uint(lod);
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    visible[commands[command].baseInstance + slot] = VisibleInstance(instance.model, instance.color);
+}
@@ -0,0 +1,42 @@
+#version 330 core
+// One ranged light added to the G-buffer pixels its volume covers, with the
+// falloff of ClusteredLighting in fragment_shader.glsl. Blended additively.
+out vec4 FragColor;
+
+flat in vec4 PositionRange;
+flat in vec4 ColorIntensity;
+
+uniform sampler2D gAlbedoMetal;
+uniform sampler2D gNormalRough;
+uniform sampler2D gDepth;
+
+vec3 WorldPosition(ivec2 pixel, float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+    vec4 world = camera.inverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0) {
+        discard; // background
+    }
+    vec3 fragPos = WorldPosition(pixel, depth);
+    vec3 toLight = PositionRange.xyz - fragPos;
+    float distanceSq = max(dot(toLight, toLight), 1e-4);
+    float ratio = distanceSq / (PositionRange.w * PositionRange.w);
+    if (ratio >= 1.0) {
+        discard;
+    }
+    float window = 1.0 - ratio * ratio;
+    float attenuation = ColorIntensity.w * window * window / distanceSq;
+
+    vec3 norm = normalize(texelFetch(gNormalRough, pixel, 0).xyz);
+    vec3 viewDir = normalize(camera.position.xyz - fragPos);
+    vec3 lightDir = toLight * inversesqrt(distanceSq);
+    float diff = max(dot(norm, lightDir), 0.0);
+    float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), 32);
+    vec3 albedo = texelFetch(gAlbedoMetal, pixel, 0).rgb;
+    FragColor = vec4((diff + spec) * ColorIntensity.rgb * attenuation * albedo, 0.0);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+// A sphere mesh around the unit sphere, placed and scaled per instance to
+// cover one light's range.
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aPositionRange;  // per instance
+layout (location = 2) in vec4 aColorIntensity; // per instance
+
+flat out vec4 PositionRange;
+flat out vec4 ColorIntensity;
+
+void main() {
+    PositionRange = aPositionRange;
+    ColorIntensity = aColorIntensity;
+    gl_Position = camera.viewProjection * vec4(aPositionRange.xyz + aPos * aPositionRange.w, 1.0);
+}
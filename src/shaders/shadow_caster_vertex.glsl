@@ -0,0 +1,10 @@
+#version 330 core
+// Depth-only pass of ShadowCascades: instanced casters seen from the sun.
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aInstanceModel; // locations 3-6, one per instance
+
+uniform mat4 lightViewProjection;
+
+void main() {
+    gl_Position = lightViewProjection * aInstanceModel * vec4(aPos, 1.0);
+}
@@ -2,18 +2,22 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aInstanceModel; // locations 3-6, one per instance
+layout (location = 7) in vec4 aInstanceColor;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+out vec4 InstanceColor;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform bool instanced;
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    mat4 world = instanced ? aInstanceModel : model;
+    FragPos = vec3(world * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(world))) * aNormal;
     TexCoords = aTexCoords;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    InstanceColor = instanced ? aInstanceColor : vec4(1.0);
+    gl_Position = camera.viewProjection * vec4(FragPos, 1.0);
 }